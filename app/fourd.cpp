@@ -21,13 +21,18 @@
 #include "../common/fourmath.h"
 #include "../common/mesh.h"
 #include "../common/mesh_skinned.h"
+#include "../common/occlusion_buffer.h"
 #include "../common/physics.h"
 #include "../common/physics_help.h"
+#include "../common/quaxol_slicer.h"
 #include "../common/player_capsule_shape.h"
 #include "../common/raycast_shape.h"
 #include "../common/timer.h"
 #include "../common/tweak.h"
 #include "../common/types.h"
+#include "../common/view_volume.h"
+#include "../common/voxel_tracer.h"
+#include "../common/worker_pool.h"
 #include "../common/components/animated_rotation.h"
 #include "../common/components/camera_follow.h"
 #include "../common/components/mesh_cleanup.h"
@@ -39,13 +44,18 @@
 #include "entity.h"
 #include "imgui_console.h"
 #include "glhelper.h"
+#include "gpu_profiler.h"
+#include "headless.h"
 #include "imgui_wrapper.h"
 #include "input_handler.h"
+#include "quaxol_buffer.h"
 #include "render.h"
 #include "render_helper.h"
+#include "render_queue.h"
 #include "scene.h"
 #include "shader.h"
 #include "texture.h"
+#include "texture_loader.h"
 #include "components/gui_input_router.h"
 #include "components/reset_watcher.h"
 #include "components/quaxol_modifier.h"
@@ -227,6 +237,29 @@ void ToggleCameraMode(Camera::MovementMode mode) {
   }
 }
 
+// Projections and start position, shared by the window and the cpu trace
+// so they look at the same thing.
+void SetDefaultCameraView(Camera* pCamera, int width, int height,
+    bool multiPass) {
+  pCamera->SetZProjection(width, height, 90.0f /* fov */,
+      0.1f /* zNear */, 10000.0f /* zFar */);
+
+  if(multiPass) {
+    pCamera->SetWProjection(
+        -50.0f /* wNear */, 50.0f /* wFar */, 0.5f /* wScreenRatio */);
+  } else {
+    pCamera->SetWProjection(
+        0.0f /* wNear */, 50.0f /* wFar */, 0.5f /* wScreenRatio */);
+  }
+
+  if(g_useCapsuleShape.AsBool()) {
+    pCamera->SetCameraPosition(Vec4f(1.5f, 40.0f, 1.5f, 1.5f));
+  } else {
+    pCamera->SetCameraPosition(Vec4f(1.5f, 19.5f, 1.5f, 1.5f));
+  }
+  pCamera->_yaw = (float)PI;
+}
+
 void SetDefaultCameraMode() {
   if(VRWrapper::IsUsingVR() && g_vr) {
     g_vr->SetVRPreferredMovementMode(&g_camera);
@@ -267,27 +300,11 @@ bool Initialize(int width, int height) {
   tesseract.buildTesseract(g_blockSize, Vec4f(0,0,0,0.0f), Vec4f(0,0,0,0));
 
   // Set up some reasonable defaults
-  g_camera.SetZProjection(_width, _height, 90.0f /* fov */,
-      0.1f /* zNear */, 10000.0f /* zFar */);
-
   g_renderer.m_multiPass = true; //true; //false;
-  if(g_renderer.m_multiPass) {
-    g_camera.SetWProjection(
-        -50.0f /* wNear */, 50.0f /* wFar */, 0.5f /* wScreenRatio */);
-  } else {
-    g_camera.SetWProjection(
-        0.0f /* wNear */, 50.0f /* wFar */, 0.5f /* wScreenRatio */);
-  }
-
-  if(g_useCapsuleShape.AsBool()) {
-    g_camera.SetCameraPosition(Vec4f(1.5f, 40.0f, 1.5f, 1.5f));
-  } else {
-    g_camera.SetCameraPosition(Vec4f(1.5f, 19.5f, 1.5f, 1.5f));
-  }
+  SetDefaultCameraView(&g_camera, _width, _height, g_renderer.m_multiPass);
   //g_camera.SetCameraPosition(Vec4f(100.5f, 100.5f, 115.5f, 100.5f));
   //g_camera.ApplyRotationInput(-(float)PI / 1.0f, Camera::FORWARD, Camera::RIGHT);
   g_debugHeadPose.storeIdentity();
-  g_camera._yaw = (float)PI;
   SetDefaultCameraMode();
 
   g_inputHandler.AddInputTarget(&(g_camera.GetComponentBus()));
@@ -317,6 +334,7 @@ bool Initialize(int width, int height) {
 
   if(!g_renderer.Initialize(width, height))
     return false;
+  GpuProfiler::Initialize();
 
   g_renderer.ToggleAlphaDepthModes(Render::AlphaOnDepthOffSrcDest);
   // Just preload the shaders to check for compile errors
@@ -332,6 +350,7 @@ bool Initialize(int width, int height) {
     exit(-1);
   }
   g_shader = g_renderer.LoadShader("Rainbow"); // should be cached, this sets for some tools
+  Shader::PrintBinaryCacheStats();
   
   LoadLevel(g_startupLevel.c_str());
   //LoadLevel("current.bin");
@@ -354,10 +373,12 @@ bool Initialize(int width, int height) {
       "data/textures/orientedTexture.png",
     };
 
-    for (auto texName : texList) {
-      std::unique_ptr<::fd::Texture> pTex(new ::fd::Texture());
-      if(pTex->LoadFromFile(texName.c_str())) {
-        g_scene.AddTexture(pTex.release());
+    // decoded in parallel, NULLs for the ones that failed
+    ::fd::TTextureList textures;
+    ::fd::TextureLoader::LoadFiles(texList, textures);
+    for (auto pTex : textures) {
+      if(pTex) {
+        g_scene.AddTexture(pTex);
       }
     }
 
@@ -372,8 +393,10 @@ bool Initialize(int width, int height) {
 }
 
 void Deinitialize(void) {
+  ::fd::RenderHelper::ReleaseSharedMeshes();
   ::fd::Texture::DeinitializeTextureCache();
   ::fd::Shader::ClearShaderHash();
+  ::fd::Shader::ReleaseCameraBlock();
   ::fd::Platform::Shutdown();
 }
 
@@ -963,6 +986,9 @@ void DrawFrame(GLFWwindow* window) {
   WasGLErrorPlusPrint();
   if (!g_shader)
     return;
+  // before anything renders, so both eyes see the same scale
+  g_renderer.UpdateDynamicResolution();
+  GpuProfiler::PushScope("frame");
 
   //g_renderer.m_clearColor = Vec4f(158.0f / 255.0f, 224.0f / 255.0f, 238.0f / 255.0f, 0.0f);
   g_renderer.m_clearColor = Vec4f(0, 0, 0, 0);
@@ -980,23 +1006,53 @@ void DrawFrame(GLFWwindow* window) {
     Texture* renderColor;
     Texture* renderDepth;
     glClearColor(g_renderer.m_clearColor.x, g_renderer.m_clearColor.y, g_renderer.m_clearColor.z, g_renderer.m_clearColor.w);
-    g_vr->StartLeftEye(&g_camera, &renderColor, &renderDepth);
-    g_renderer.RenderAllScenesPerCamera(renderColor, renderDepth);
-    WasGLErrorPlusPrint();
-    if(renderVRUI)
-      ImGuiWrapper::Render(frameTime, uiOffset, &g_renderer, true /*doUpdate*/);
-    WasGLErrorPlusPrint();
-    g_vr->FinishLeftEye(&g_camera, &renderColor, &renderDepth);
-    glClearColor(g_renderer.m_clearColor.x, g_renderer.m_clearColor.y, g_renderer.m_clearColor.z, g_renderer.m_clearColor.w);
-    g_vr->StartRightEye(&g_camera, &renderColor, &renderDepth);
-    g_renderer.RenderAllScenesPerCamera(renderColor, renderDepth);
-    WasGLErrorPlusPrint();
-    if(renderVRUI)
-      ImGuiWrapper::Render(frameTime, uiOffset, &g_renderer, false /*doUpdate*/);
-    WasGLErrorPlusPrint();
-    g_vr->FinishRightEye(&g_camera, &renderColor, &renderDepth);
-    WasGLErrorPlusPrint();
+    // both eyes from one submission if the backend can do it
+    static TweakVariable tweakSinglePassStereo("vr.singlePassStereo", true);
+    static ::fd::Camera s_rightEyeCamera;
+    if(tweakSinglePassStereo.AsBool() && g_vr->StartStereo(
+        &g_camera, &s_rightEyeCamera, &renderColor, &renderDepth)) {
+      Shader::SetStereoCamera(&s_rightEyeCamera);
+      g_renderer.RenderAllScenesPerCamera(renderColor, renderDepth);
+      Shader::SetStereoCamera(NULL);
+      WasGLErrorPlusPrint();
+      if(renderVRUI) {
+        // the ui isn't stereo aware, so once into each half
+        int eyeWidth = renderColor->m_width / 2;
+        for(int eye = 0; eye < 2; eye++) {
+          glViewport(eye * eyeWidth, 0, eyeWidth, renderColor->m_height);
+          ImGuiWrapper::Render(frameTime, uiOffset, &g_renderer, (eye == 0) /*doUpdate*/);
+        }
+      }
+      WasGLErrorPlusPrint();
+      GpuProfiler::PushScope("vr submit stereo");
+      g_vr->FinishStereo(&g_camera, &s_rightEyeCamera);
+      GpuProfiler::PopScope("vr submit stereo");
+      WasGLErrorPlusPrint();
+    } else {
+      g_vr->StartLeftEye(&g_camera, &renderColor, &renderDepth);
+      g_renderer.RenderAllScenesPerCamera(renderColor, renderDepth);
+      WasGLErrorPlusPrint();
+      if(renderVRUI)
+        ImGuiWrapper::Render(frameTime, uiOffset, &g_renderer, true /*doUpdate*/);
+      WasGLErrorPlusPrint();
+      GpuProfiler::PushScope("vr submit left");
+      g_vr->FinishLeftEye(&g_camera, &renderColor, &renderDepth);
+      GpuProfiler::PopScope("vr submit left");
+      glClearColor(g_renderer.m_clearColor.x, g_renderer.m_clearColor.y, g_renderer.m_clearColor.z, g_renderer.m_clearColor.w);
+      g_vr->StartRightEye(&g_camera, &renderColor, &renderDepth);
+      g_renderer.RenderAllScenesPerCamera(renderColor, renderDepth);
+      WasGLErrorPlusPrint();
+      if(renderVRUI)
+        ImGuiWrapper::Render(frameTime, uiOffset, &g_renderer, false /*doUpdate*/);
+      WasGLErrorPlusPrint();
+      GpuProfiler::PushScope("vr submit right");
+      g_vr->FinishRightEye(&g_camera, &renderColor, &renderDepth);
+      GpuProfiler::PopScope("vr submit right");
+      WasGLErrorPlusPrint();
+    }
+    GpuProfiler::PushScope("vr finish frame");
     g_vr->FinishFrame();
+    GpuProfiler::PopScope("vr finish frame");
     WasGLErrorPlusPrint();
   } else {
     Vec2f uiOffset(0, 0);
@@ -1015,6 +1071,11 @@ void DrawFrame(GLFWwindow* window) {
   }
 
 
+  GpuProfiler::PopScope("frame");
+  RenderQueue::EndFrame();
+  g_renderer.EndFrame();
+  GpuProfiler::EndFrame();
+
   glFlush();
   glfwSwapBuffers(window);
   WasGLErrorPlusPrint();
@@ -1162,6 +1223,9 @@ void StaticInitialize() {
 
 void MainLoopShutdown() {
   SaveLevel("current");
+  GpuProfiler::Shutdown();
+  RenderHelper::ReleaseSharedMeshes();
+  g_renderer.ReleaseSliceCapture();
   ImGuiWrapper::Shutdown();
   glfwTerminate();
   delete g_vr;
@@ -1228,9 +1292,18 @@ void RunTests() {
 
   Shader::RunTests();
   Camera::RunTests();
+  ViewVolume::RunTests();
+  OcclusionBuffer::RunTests();
+  VoxelTracer::RunTests();
+  WorkerPool::RunTests();
+  QuaxolSlicer::RunTests();
+  bool quaxolBufferTestSuccess = QuaxolBuffer::RunTests();
+  assert(quaxolBufferTestSuccess);
   Physics::RunTests();
   PhysicsHelp::RunTests();
   Timer::RunTests();
+  bool textureLoaderTestSuccess = TextureLoader::RunTests();
+  assert(textureLoaderTestSuccess);
   #if defined(FD_USE_PYTHON_HOOK)
   bool pythonTestSuccess = PyVisInterface::RunTests();
   assert(pythonTestSuccess);
@@ -1254,6 +1327,88 @@ void glfwErrorCallback(int error, const char* description) {
   printf("GLFW Error: %d :  %s\n", error, description);
 }
 
+// No window, no input, no vr. Steps the scene at a fixed rate and renders
+// the capture's camera path into its offscreen target.
+int RunHeadless(const HeadlessSettings& settings) {
+  std::unique_ptr<HeadlessContext> context(HeadlessContext::Create());
+  if(!context) {
+    return -1;
+  }
+
+  glewExperimental=TRUE;
+  GLenum err = glewInit();
+#if defined(GLEW_ERROR_NO_GLX_DISPLAY)
+  // the entry points are loaded by then, there's just no glx to go with egl
+  if(err == GLEW_ERROR_NO_GLX_DISPLAY) {
+    err = GLEW_OK;
+  }
+#endif
+  if(err != GLEW_OK) {
+    printf("Glew init fail: Error: %s\n", glewGetErrorString(err));
+    return -1;
+  }
+  printf("OpenGL renderer string: %s\n", glGetString(GL_RENDERER));
+  printf("OpenGL version string: %s\n", glGetString(GL_VERSION));
+
+  ImGuiWrapper::s_bGuiDisabled = true;
+  if(!Initialize(settings.m_width, settings.m_height)) {
+    printf("Initialized failed\n");
+    return -1;
+  }
+  ReshapeGL(NULL /*window*/, settings.m_width, settings.m_height);
+
+  int result = 0;
+  {
+    HeadlessCapture capture(settings);
+    if(!capture.Initialize()) {
+      return -1;
+    }
+    for(int frame = 0; frame < settings.m_frames; frame++) {
+      g_scene.Step(settings.m_frameTime);
+
+      Texture* renderColor;
+      Texture* renderDepth;
+      capture.StartFrame(frame, &g_camera, &renderColor, &renderDepth);
+      GpuProfiler::PushScope("frame");
+      g_renderer.RenderAllScenesPerCamera(renderColor, renderDepth);
+      GpuProfiler::PopScope("frame");
+      RenderQueue::EndFrame();
+      g_renderer.EndFrame();
+      GpuProfiler::EndFrame();
+      if(!capture.FinishFrame(frame)) {
+        result = -1;
+      }
+    }
+    if(!capture.Finish()) {
+      result = -1;
+    }
+  }
+
+  GpuProfiler::Shutdown();
+  Deinitialize();
+  return result;
+}
+
+// No gl at all, just the level and the camera's defaults from Initialize,
+// ray cast on the cpu along the headless camera path.
+int RunCpuTrace(const HeadlessSettings& settings) {
+  std::string fullName = g_levelPath + g_startupLevel;
+  ChunkLoader chunkLoader;
+  std::unique_ptr<QuaxolChunk> chunk(chunkLoader.LoadFromFile(fullName.c_str()));
+  if(!chunk) {
+    printf("Couldn't load the level! name:%s\n", fullName.c_str());
+    return -1;
+  }
+
+  Camera camera;
+  // the same full w range as the multi pass window
+  SetDefaultCameraView(&camera, settings.m_width, settings.m_height,
+      true /* multiPass */);
+  camera.setMovementMode(Camera::MovementMode::WALK);
+
+  return RunCpuTrace(settings, *chunk, &camera) ? 0 : -1;
+}
+
 // At first I thought this was tacky, but they are so fast and it reminds
 // me they are going and relevant so it's sort of okay?
 #define RUN_TESTS
@@ -1294,12 +1449,50 @@ int main(int argc, const char *argv[]) {
       "--screensaver_move_thresh", "How much VR head movement turns off the screensaver");
   cmd_line.addOption<float>(VRWrapper::s_screenSaverRotateThreshold, VRWrapper::s_screenSaverRotateThreshold,
       "--screensaver_rotate_thresh", "How much VR head rotation turns off the screensaver");
+  bool disableShaderCache = false;
+  cmd_line.addFlag(disableShaderCache,
+      "--no_shader_cache", "Always compile shaders instead of using cached program binaries");
+  bool useNullVR = false;
+  VRWrapper::NullVRSettings nullVRSettings;
+  cmd_line.addFlag(useNullVR,
+      "--null_vr", "Render stereo to a simulated headset, for benchmarking without one");
+  cmd_line.addOption<int>(nullVRSettings.m_eyeWidth, nullVRSettings.m_eyeWidth,
+      "--null_vr_eye_width", "Per eye render width of the simulated headset");
+  cmd_line.addOption<int>(nullVRSettings.m_eyeHeight, nullVRSettings.m_eyeHeight,
+      "--null_vr_eye_height", "Per eye render height of the simulated headset");
+  cmd_line.addOption<float>(nullVRSettings.m_refreshRate, nullVRSettings.m_refreshRate,
+      "--null_vr_refresh", "Refresh rate in hz the simulated headset holds frames to");
+  cmd_line.addOption<float>(nullVRSettings.m_compositorMargin, nullVRSettings.m_compositorMargin,
+      "--null_vr_margin", "Seconds before vsync a simulated frame has to be done by");
+  cmd_line.addOption<std::string>(nullVRSettings.m_poseTrackFile, nullVRSettings.m_poseTrackFile,
+      "--null_vr_pose_track", "File of 'time yaw pitch roll x y z' head poses to loop");
+  bool headless = false;
+  HeadlessSettings headlessSettings;
+  cmd_line.addFlag(headless,
+      "--headless", "Render offscreen with no window or display, then exit");
+  cmd_line.addOption<int>(headlessSettings.m_frames, headlessSettings.m_frames,
+      "--headless_frames", "How many frames the headless run renders");
+  cmd_line.addOption<int>(headlessSettings.m_width, headlessSettings.m_width,
+      "--headless_width", "Headless render target width");
+  cmd_line.addOption<int>(headlessSettings.m_height, headlessSettings.m_height,
+      "--headless_height", "Headless render target height");
+  cmd_line.addOption<int>(headlessSettings.m_captureEvery, headlessSettings.m_captureEvery,
+      "--headless_capture_every", "Save a png every this many frames, 0 for none");
+  cmd_line.addOption<std::string>(headlessSettings.m_cameraPath, headlessSettings.m_cameraPath,
+      "--headless_camera_path", "File of 'time yaw pitch roll x y z w' camera offsets");
+  cmd_line.addOption<std::string>(headlessSettings.m_outputDir, headlessSettings.m_outputDir,
+      "--headless_out", "Directory for the headless pngs and timings.csv");
+  bool cpuTrace = false;
+  cmd_line.addFlag(cpuTrace,
+      "--cpu_trace", "Ray cast the start level on the cpu with the headless settings, no gl");
   cmd_line.parse(argc, argv);
 
   printf("Screensaver was %f\n", g_screensaverTime);
   printf("DisabledUI was %d\n", ImGuiWrapper::s_bGuiDisabled);
   printf("eyecandy was %d\n", g_startupAddEyeCandy);
 
+  Shader::s_useBinaryCache = !disableShaderCache;
+
   if(displayUsage) {
     printf("Helpy?\n%s\n", cmd_line.getUsage().c_str());
     return 0;
@@ -1318,8 +1511,19 @@ int main(int argc, const char *argv[]) {
   printf("Completed tests.\n");
 #endif // RUN_TESTS
 
+  if(cpuTrace) {
+    return RunCpuTrace(headlessSettings);
+  }
+  if(headless) {
+    return RunHeadless(headlessSettings);
+  }
+
   // ovr is supposed to preceed glfw
-  g_vr = VRWrapper::CreateVR();
+  if(useNullVR) {
+    g_vr = VRWrapper::CreateNullVR(nullVRSettings);
+  } else {
+    g_vr = VRWrapper::CreateVR();
+  }
   if(g_screensaverTime > 0.0f && g_vr) {
     g_vr->m_doScreenSaver = true;
   }
@@ -1428,6 +1632,13 @@ int main(int argc, const char *argv[]) {
 
   ReshapeGL(g_glfwWindow, startWidth, startHeight);
 
+#ifdef RUN_TESTS
+  if(useNullVR && VRWrapper::IsUsingVR() && g_vr) {
+    bool scaledDepthTestSuccess = g_renderer.RunScaledDepthTest(g_vr, &g_camera);
+    assert(scaledDepthTestSuccess);
+  }
+#endif // RUN_TESTS
+
   double keepAliveTime = 5.0f; //write every five seconds
   double keepAliveNext = 0.0f;
 
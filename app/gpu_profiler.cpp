@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+#include "gpu_profiler.h"
+
+#include "../common/tweak.h"
+#include "glhelper.h"
+
+namespace fd {
+
+bool GpuProfiler::s_supported = false;
+bool GpuProfiler::s_enabled = false;
+GpuProfiler::FrameSet GpuProfiler::s_frames[GpuProfiler::c_numFrameSets];
+int GpuProfiler::s_writeFrame = 0;
+std::vector<int> GpuProfiler::s_openRecords;
+GpuProfiler::ScopeHistoryList GpuProfiler::s_history;
+int GpuProfiler::s_droppedFrames = 0;
+
+static TweakVariable tweakGpuProfile("render.gpuProfile", true);
+
+bool GpuProfiler::Initialize() {
+  s_supported = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query);
+  if (!s_supported) {
+    printf("No timestamp queries, gpu profiling is off\n");
+    return false;
+  }
+  for (auto& frame : s_frames) {
+    frame.m_usedQueries = 0;
+  }
+  s_enabled = tweakGpuProfile.AsBool();
+  return true;
+}
+
+void GpuProfiler::Shutdown() {
+  for (auto& frame : s_frames) {
+    if (!frame.m_queries.empty()) {
+      glDeleteQueries((GLsizei)frame.m_queries.size(), frame.m_queries.data());
+    }
+    frame.m_queries.clear();
+    frame.m_records.clear();
+    frame.m_usedQueries = 0;
+  }
+  s_openRecords.clear();
+  s_history.clear();
+  s_supported = false;
+  s_enabled = false;
+}
+
+int GpuProfiler::IssueTimestamp(FrameSet& frame) {
+  // the pool only grows, a steady frame stops allocating after the first
+  if (frame.m_usedQueries == (int)frame.m_queries.size()) {
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    frame.m_queries.push_back(query);
+  }
+  int queryIndex = frame.m_usedQueries++;
+  glQueryCounter(frame.m_queries[queryIndex], GL_TIMESTAMP);
+  return queryIndex;
+}
+
+void GpuProfiler::PushScope(const char* name) {
+  if (!s_enabled) return;
+
+  FrameSet& frame = s_frames[s_writeFrame];
+  Record record;
+  record.m_name = name;
+  record.m_depth = (int)s_openRecords.size();
+  record.m_beginQuery = IssueTimestamp(frame);
+  record.m_endQuery = -1;
+  s_openRecords.push_back((int)frame.m_records.size());
+  frame.m_records.push_back(record);
+}
+
+void GpuProfiler::PopScope(const char* name) {
+  if (!s_enabled || s_openRecords.empty()) return;
+
+  FrameSet& frame = s_frames[s_writeFrame];
+  Record& record = frame.m_records[s_openRecords.back()];
+  assert(strcmp(record.m_name, name) == 0);
+  record.m_endQuery = IssueTimestamp(frame);
+  s_openRecords.pop_back();
+}
+
+void GpuProfiler::EndFrame() {
+  if (!s_supported) return;
+
+  if (!s_openRecords.empty()) {
+    printf("GpuProfiler scope %s was still open at the end of the frame\n",
+        s_frames[s_writeFrame].m_records[s_openRecords.back()].m_name);
+    s_openRecords.clear();
+  }
+
+  // the set about to be reused holds the oldest frame still in flight
+  s_writeFrame = (s_writeFrame + 1) % c_numFrameSets;
+  FrameSet& frame = s_frames[s_writeFrame];
+  if (!frame.m_records.empty()) {
+    GLint available = 0;
+    glGetQueryObjectiv(frame.m_queries[frame.m_usedQueries - 1],
+        GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      CollectFrame(frame);
+    } else {
+      // still more than c_numFrameSets - 1 frames behind, skip it rather than stall
+      ++s_droppedFrames;
+    }
+  }
+  frame.m_usedQueries = 0;
+  frame.m_records.clear();
+
+  s_enabled = tweakGpuProfile.AsBool();
+  WasGLErrorPlusPrint();
+}
+
+GpuProfiler::ScopeHistory* GpuProfiler::FindOrAddHistory(
+    const char* name, int depth) {
+  for (auto& history : s_history) {
+    if (strcmp(history.m_name, name) == 0) {
+      return &history;
+    }
+  }
+  ScopeHistory history;
+  memset(&history, 0, sizeof(history));
+  history.m_name = name;
+  history.m_depth = depth;
+  s_history.push_back(history);
+  return &s_history.back();
+}
+
+void GpuProfiler::CollectFrame(FrameSet& frame) {
+  // everything gets a sample each frame, scopes that didn't run get a 0
+  std::vector<float> frameMs(s_history.size(), 0.0f);
+  for (auto& history : s_history) {
+    ++history.m_framesUnseen;
+  }
+
+  for (const auto& record : frame.m_records) {
+    if (record.m_endQuery < 0) continue;
+    GLuint64 begin = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(frame.m_queries[record.m_beginQuery],
+        GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(frame.m_queries[record.m_endQuery],
+        GL_QUERY_RESULT, &end);
+
+    ScopeHistory* pHistory = FindOrAddHistory(record.m_name, record.m_depth);
+    size_t index = pHistory - &s_history[0];
+    if (index >= frameMs.size()) {
+      frameMs.resize(index + 1, 0.0f);
+    }
+    frameMs[index] += (float)((double)(end - begin) / 1000000.0);
+    pHistory->m_framesUnseen = 0;
+  }
+
+  for (size_t h = 0; h < s_history.size(); ++h) {
+    ScopeHistory& history = s_history[h];
+    history.m_lastMs = frameMs[h];
+    history.m_samples[history.m_nextSample] = frameMs[h];
+    history.m_nextSample = (history.m_nextSample + 1) % c_historySize;
+    history.m_numSamples = (std::min)(history.m_numSamples + 1, (int)c_historySize);
+
+    float total = 0.0f;
+    history.m_maxMs = 0.0f;
+    for (int s = 0; s < history.m_numSamples; ++s) {
+      total += history.m_samples[s];
+      history.m_maxMs = (std::max)(history.m_maxMs, history.m_samples[s]);
+    }
+    history.m_averageMs = total / (float)history.m_numSamples;
+  }
+
+  // passes that were switched off fall out of the table once they age out
+  s_history.erase(std::remove_if(s_history.begin(), s_history.end(),
+      [](const ScopeHistory& history) {
+        return history.m_framesUnseen >= c_historySize;
+      }), s_history.end());
+}
+
+float GpuProfiler::GetLastMs(const char* name) {
+  for (const auto& history : s_history) {
+    if (strcmp(history.m_name, name) == 0) {
+      return history.m_lastMs;
+    }
+  }
+  return 0.0f;
+}
+
+} // namespace fd
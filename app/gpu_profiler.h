@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+
+namespace fd {
+
+// Times named scopes on the gpu with timestamp queries. Timestamps, unlike
+// GL_TIME_ELAPSED, can nest. Queries are kept in a ring of frame sets and a
+// frame's results are only read back when its set comes around again, so
+// nothing waits on the gpu. Three sets give the gpu two frames to finish
+// before a readback, two dropped a lot of frames once it was busy. A scope that runs more than once a frame,
+// per eye or per camera, is summed.
+class GpuProfiler {
+public:
+  static const int c_numFrameSets = 3;
+  static const int c_historySize = 60; // frames the rolling stats cover
+
+  struct ScopeHistory {
+    const char* m_name; // not owned, expected to be a literal
+    int m_depth; // nesting, for indenting the table
+    float m_samples[c_historySize]; // ms, a ring
+    int m_nextSample;
+    int m_numSamples; // up to c_historySize
+    int m_framesUnseen; // dropped once it's been gone the whole history
+    float m_lastMs;
+    float m_averageMs;
+    float m_maxMs;
+  };
+  typedef std::vector<ScopeHistory> ScopeHistoryList;
+
+  // needs a context with timestamp queries, everything is a no-op until then
+  static bool Initialize();
+  static void Shutdown();
+
+  static void PushScope(const char* name);
+  static void PopScope(const char* name);
+  // after the last scope of a frame, reads back the oldest one in flight
+  static void EndFrame();
+
+  static const ScopeHistoryList& GetHistory() { return s_history; }
+  // last collected frame's time for a scope, 0 if it hasn't shown up
+  static float GetLastMs(const char* name);
+  static int GetDroppedFrames() { return s_droppedFrames; }
+
+protected:
+  struct Record {
+    const char* m_name;
+    int m_depth;
+    int m_beginQuery;
+    int m_endQuery;
+  };
+
+  struct FrameSet {
+    std::vector<GLuint> m_queries;
+    int m_usedQueries;
+    std::vector<Record> m_records;
+  };
+
+  static bool s_supported;
+  static bool s_enabled; // only changes between frames, keeps scopes paired
+  static FrameSet s_frames[c_numFrameSets];
+  static int s_writeFrame;
+  static std::vector<int> s_openRecords;
+  static ScopeHistoryList s_history;
+  static int s_droppedFrames;
+
+  static int IssueTimestamp(FrameSet& frame);
+  static void CollectFrame(FrameSet& frame);
+  static ScopeHistory* FindOrAddHistory(const char* name, int depth);
+};
+
+class GpuScoper {
+  const char* _scope;
+public:
+  GpuScoper(const char* scope) : _scope(scope) {
+    GpuProfiler::PushScope(_scope);
+  }
+  ~GpuScoper() {
+    GpuProfiler::PopScope(_scope);
+  }
+};
+
+#define GPU_SCOPE_CONCAT_INNER(a, b) a##b
+#define GPU_SCOPE_CONCAT(a, b) GPU_SCOPE_CONCAT_INNER(a, b)
+#define GPU_SCOPE(str) GpuScoper GPU_SCOPE_CONCAT(gpuScoper, __LINE__)(str);
+
+} // namespace fd
@@ -0,0 +1,448 @@
+#include "headless.h"
+
+#include <algorithm>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif // WIN32
+
+#include "../common/camera.h"
+#include "../common/misc_defs.h"
+#include "../common/voxel_tracer.h"
+#include "glhelper.h"
+#include "gpu_profiler.h"
+#include "platform_interface.h"
+#include "texture.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../stb/stb_image_write.h"
+
+namespace fd {
+
+#ifndef WIN32
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+HeadlessContext* HeadlessContext::Create() {
+  // surfaceless first, the default display wants an x server on some setups
+  EGLDisplay display = EGL_NO_DISPLAY;
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay) {
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+        EGL_DEFAULT_DISPLAY, NULL);
+  }
+  if (display == EGL_NO_DISPLAY) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+  EGLint major = 0;
+  EGLint minor = 0;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    printf("headless: no egl display: 0x%x\n", eglGetError());
+    return NULL;
+  }
+
+  const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+    printf("headless: egl %d.%d can't make a context current without a surface\n",
+        major, minor);
+    eglTerminate(display);
+    return NULL;
+  }
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    printf("headless: egl has no desktop gl: 0x%x\n", eglGetError());
+    eglTerminate(display);
+    return NULL;
+  }
+
+  const EGLint configAttribs[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint numConfigs = 0;
+  if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs)
+      || numConfigs == 0) {
+    printf("headless: no gl config: 0x%x\n", eglGetError());
+    eglTerminate(display);
+    return NULL;
+  }
+
+  // the renderer still leans on fixed function bits, so compatibility
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+        EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT_KHR,
+    EGL_NONE
+  };
+  EGLContext context = eglCreateContext(
+      display, config, EGL_NO_CONTEXT, contextAttribs);
+  if (context == EGL_NO_CONTEXT) {
+    // older drivers without EGL_KHR_create_context, take what it gives
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  }
+  if (context == EGL_NO_CONTEXT
+      || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    printf("headless: couldn't make a gl context: 0x%x\n", eglGetError());
+    if (context != EGL_NO_CONTEXT) {
+      eglDestroyContext(display, context);
+    }
+    eglTerminate(display);
+    return NULL;
+  }
+
+  printf("headless: egl %d.%d %s\n", major, minor,
+      eglQueryString(display, EGL_VENDOR));
+  HeadlessContext* pContext = new HeadlessContext();
+  pContext->m_display = display;
+  pContext->m_context = context;
+  return pContext;
+}
+
+HeadlessContext::~HeadlessContext() {
+  if (m_display) {
+    eglMakeCurrent((EGLDisplay)m_display,
+        EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_context) {
+      eglDestroyContext((EGLDisplay)m_display, (EGLContext)m_context);
+    }
+    eglTerminate((EGLDisplay)m_display);
+  }
+}
+
+#else // WIN32
+
+HeadlessContext* HeadlessContext::Create() {
+  printf("headless: only egl on linux so far\n");
+  return NULL;
+}
+
+HeadlessContext::~HeadlessContext() {}
+
+#endif // WIN32
+
+HeadlessCapture::HeadlessCapture(const HeadlessSettings& settings)
+    : m_settings(settings)
+    , m_color(NULL)
+    , m_depth(NULL) {
+  m_timestampQueries[0] = m_timestampQueries[1] = 0;
+}
+
+HeadlessCapture::~HeadlessCapture() {
+  if (m_timestampQueries[0] != 0) {
+    glDeleteQueries(2, m_timestampQueries);
+  }
+  delete m_color;
+  delete m_depth;
+}
+
+bool HeadlessCapture::Initialize() {
+  if (!m_settings.m_cameraPath.empty()
+      && !LoadCameraPath(m_settings.m_cameraPath.c_str())) {
+    return false;
+  }
+  if (!Platform::MakeDirectory(m_settings.m_outputDir.c_str())) {
+    printf("headless: couldn't make %s\n", m_settings.m_outputDir.c_str());
+    return false;
+  }
+
+  std::unique_ptr<Texture> color(new Texture());
+  if (!color->CreateColorTarget(m_settings.m_width, m_settings.m_height))
+    return false;
+  std::unique_ptr<Texture> depth(new Texture());
+  if (!depth->CreateDepthTarget(m_settings.m_width, m_settings.m_height))
+    return false;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, color->m_framebuffer_id);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, color->GetTextureID(), 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_TEXTURE_2D, depth->GetTextureID(), 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("headless: framebuffer not ready: %d\n", status);
+    return false;
+  }
+  m_color = color.release();
+  m_depth = depth.release();
+
+  glGenQueries(2, m_timestampQueries);
+  m_timings.reserve(m_settings.m_frames);
+  printf("headless: %d frames at %dx%d into %s, %s camera path\n",
+      m_settings.m_frames, m_settings.m_width, m_settings.m_height,
+      m_settings.m_outputDir.c_str(),
+      m_path.empty() ? "built in" : m_settings.m_cameraPath.c_str());
+  return !WasGLErrorPlusPrint();
+}
+
+bool HeadlessCapture::LoadCameraPath(const char* fileName) {
+  FILE* file = fopen(fileName, "r");
+  if (!file) {
+    printf("headless: couldn't open camera path %s\n", fileName);
+    return false;
+  }
+  char line[256];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+    PathKey key;
+    if (sscanf(line, "%f %f %f %f %f %f %f %f", &key.m_time,
+        &key.m_yaw, &key.m_pitch, &key.m_roll, &key.m_position[0],
+        &key.m_position[1], &key.m_position[2], &key.m_position[3]) != 8) {
+      printf("headless: %s:%d wants \"time yaw pitch roll x y z w\"\n",
+          fileName, lineNumber);
+      continue;
+    }
+    if (!m_path.empty() && key.m_time <= m_path.back().m_time) {
+      printf("headless: %s:%d time doesn't increase\n", fileName, lineNumber);
+      continue;
+    }
+    m_path.push_back(key);
+  }
+  fclose(file);
+  if (m_path.empty()) {
+    printf("headless: no keys in %s\n", fileName);
+    return false;
+  }
+  return true;
+}
+
+// clamped at the ends, lerped between keys
+HeadlessCapture::PathKey HeadlessCapture::SampleCameraPath(float time) const {
+  PathKey out;
+  if (m_path.empty()) {
+    // a turn around while drifting through w, so the slicing gets exercised
+    out.m_time = time;
+    out.m_yaw = 30.0f * time;
+    out.m_pitch = 10.0f * sinf(time * 0.7f);
+    out.m_roll = 0.0f;
+    out.m_position[0] = 0.0f;
+    out.m_position[1] = 0.0f;
+    out.m_position[2] = 0.0f;
+    out.m_position[3] = 8.0f * sinf(time * 0.5f);
+    return out;
+  }
+  if (time <= m_path.front().m_time) {
+    return m_path.front();
+  }
+  if (time >= m_path.back().m_time) {
+    return m_path.back();
+  }
+  size_t next = 1;
+  while (m_path[next].m_time < time) {
+    next++;
+  }
+  const PathKey& a = m_path[next - 1];
+  const PathKey& b = m_path[next];
+  float t = (time - a.m_time) / (b.m_time - a.m_time);
+  out.m_time = time;
+  out.m_yaw = a.m_yaw + (b.m_yaw - a.m_yaw) * t;
+  out.m_pitch = a.m_pitch + (b.m_pitch - a.m_pitch) * t;
+  out.m_roll = a.m_roll + (b.m_roll - a.m_roll) * t;
+  for (int i = 0; i < 4; i++) {
+    out.m_position[i] = a.m_position[i] + (b.m_position[i] - a.m_position[i]) * t;
+  }
+  return out;
+}
+
+void HeadlessCapture::StartFrame(int frame, Camera* pCamera,
+    Texture** outRenderColor, Texture** outRenderDepth) {
+  m_cpuTimer.Start();
+  glQueryCounter(m_timestampQueries[0], GL_TIMESTAMP);
+
+  PoseCamera(frame, pCamera);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_color->m_framebuffer_id);
+  glViewport(0, 0, m_settings.m_width, m_settings.m_height);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  *outRenderColor = m_color;
+  *outRenderDepth = m_depth;
+  WasGLErrorPlusPrint();
+}
+
+void HeadlessCapture::PoseCamera(int frame, Camera* pCamera) const {
+  PathKey key = SampleCameraPath(frame * m_settings.m_frameTime);
+  const float toRadians = (float)PI / 180.0f;
+  Mat4f yaw;
+  Mat4f pitch;
+  Mat4f roll;
+  yaw.storeRotation(key.m_yaw * toRadians, 0, 2);
+  pitch.storeRotation(key.m_pitch * toRadians, 1, 2);
+  roll.storeRotation(key.m_roll * toRadians, 0, 1);
+  Pose4f pose;
+  pose.rotation = yaw * pitch * roll;
+  pose.position = Vec4f(key.m_position[0], key.m_position[1],
+      key.m_position[2], key.m_position[3]);
+  pCamera->UpdateRenderMatrix(&pose);
+  pCamera->SetZProjection(m_settings.m_width, m_settings.m_height,
+      pCamera->_zFov, pCamera->_zNear, pCamera->_zFar);
+}
+
+bool HeadlessCapture::FinishFrame(int frame) {
+  FrameTiming timing;
+  timing.m_frame = frame;
+  timing.m_cpuMs = m_cpuTimer.GetElapsed() * 1000.0;
+  glQueryCounter(m_timestampQueries[1], GL_TIMESTAMP);
+
+  bool success = true;
+  if (m_settings.m_captureEvery > 0 && (frame % m_settings.m_captureEvery) == 0) {
+    success = WriteFrame(frame);
+  }
+
+  // blocks until the frame is done, which the readback already did anyway
+  GLuint64 begin = 0;
+  GLuint64 end = 0;
+  glGetQueryObjectui64v(m_timestampQueries[0], GL_QUERY_RESULT, &begin);
+  glGetQueryObjectui64v(m_timestampQueries[1], GL_QUERY_RESULT, &end);
+  timing.m_gpuMs = (double)(end - begin) / 1000000.0;
+  m_timings.push_back(timing);
+  return success && !WasGLErrorPlusPrint();
+}
+
+bool HeadlessCapture::WriteFrame(int frame) {
+  int width = m_settings.m_width;
+  int height = m_settings.m_height;
+  int rowBytes = width * 3;
+  m_pixels.resize(rowBytes * height * 2);
+  unsigned char* read = m_pixels.data();
+  unsigned char* flipped = read + rowBytes * height;
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_color->m_framebuffer_id);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, read);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+  // gl's first row is the bottom one
+  for (int y = 0; y < height; y++) {
+    memcpy(flipped + y * rowBytes, read + (height - 1 - y) * rowBytes, rowBytes);
+  }
+
+  char fileName[512];
+  snprintf(fileName, sizeof(fileName), "%s/frame_%05d.png",
+      m_settings.m_outputDir.c_str(), frame);
+  if (!stbi_write_png(fileName, width, height, 3, flipped, rowBytes)) {
+    printf("headless: couldn't write %s\n", fileName);
+    return false;
+  }
+  return true;
+}
+
+bool HeadlessCapture::Finish() {
+  std::string fileName = m_settings.m_outputDir + "/timings.csv";
+  FILE* file = fopen(fileName.c_str(), "w");
+  if (!file) {
+    printf("headless: couldn't write %s\n", fileName.c_str());
+    return false;
+  }
+  fprintf(file, "frame,cpu_ms,gpu_ms\n");
+  for (const auto& timing : m_timings) {
+    fprintf(file, "%d,%.3f,%.3f\n", timing.m_frame, timing.m_cpuMs, timing.m_gpuMs);
+  }
+  fclose(file);
+
+  if (m_timings.empty()) {
+    return true;
+  }
+
+  // the first frames pay for lazy uploads and shader warmup, so show the
+  // median next to the mean
+  std::vector<double> cpu;
+  std::vector<double> gpu;
+  for (const auto& timing : m_timings) {
+    cpu.push_back(timing.m_cpuMs);
+    gpu.push_back(timing.m_gpuMs);
+  }
+  std::sort(cpu.begin(), cpu.end());
+  std::sort(gpu.begin(), gpu.end());
+  double cpuTotal = 0.0;
+  double gpuTotal = 0.0;
+  for (size_t f = 0; f < cpu.size(); f++) {
+    cpuTotal += cpu[f];
+    gpuTotal += gpu[f];
+  }
+  size_t count = cpu.size();
+  printf("headless: %d frames, cpu mean %.2fms median %.2fms max %.2fms,"
+      " gpu mean %.2fms median %.2fms max %.2fms\n", (int)count,
+      cpuTotal / count, cpu[count / 2], cpu.back(),
+      gpuTotal / count, gpu[count / 2], gpu.back());
+  for (const auto& scope : GpuProfiler::GetHistory()) {
+    printf("  %*s%-*s avg %.2fms max %.2fms\n", scope.m_depth * 2, "",
+        24 - scope.m_depth * 2, scope.m_name, scope.m_averageMs, scope.m_maxMs);
+  }
+  printf("headless: timings in %s\n", fileName.c_str());
+  return true;
+}
+
+bool RunCpuTrace(const HeadlessSettings& settings,
+    const QuaxolChunk& chunk, Camera* pCamera) {
+  // only for the camera path, it never makes its targets
+  HeadlessCapture path(settings);
+  if (!settings.m_cameraPath.empty()
+      && !path.LoadCameraPath(settings.m_cameraPath.c_str())) {
+    return false;
+  }
+  if (!Platform::MakeDirectory(settings.m_outputDir.c_str())) {
+    printf("cpu trace: couldn't make %s\n", settings.m_outputDir.c_str());
+    return false;
+  }
+  printf("cpu trace: %d frames at %dx%d into %s\n", settings.m_frames,
+      settings.m_width, settings.m_height, settings.m_outputDir.c_str());
+
+  std::unique_ptr<VoxelTracer> tracer(new VoxelTracer());
+  std::vector<double> mrays;
+  bool success = true;
+  std::string csvName = settings.m_outputDir + "/cpu_timings.csv";
+  FILE* csv = fopen(csvName.c_str(), "w");
+  if (!csv) {
+    printf("cpu trace: couldn't write %s\n", csvName.c_str());
+    return false;
+  }
+  fprintf(csv, "frame,trace_ms,mrays_per_s,hit_pixels\n");
+  for (int frame = 0; frame < settings.m_frames; frame++) {
+    path.PoseCamera(frame, pCamera);
+    tracer->Trace(*pCamera, chunk, settings.m_width, settings.m_height);
+    mrays.push_back(tracer->_lastMraysPerSecond);
+    fprintf(csv, "%d,%.3f,%.3f,%d\n", frame, tracer->_lastTraceMs,
+        tracer->_lastMraysPerSecond, tracer->_lastHits);
+
+    if (settings.m_captureEvery > 0 && (frame % settings.m_captureEvery) == 0) {
+      char fileName[512];
+      snprintf(fileName, sizeof(fileName), "%s/cpu_%05d.png",
+          settings.m_outputDir.c_str(), frame);
+      if (!stbi_write_png(fileName, settings.m_width, settings.m_height, 3,
+          tracer->GetColor(), settings.m_width * 3)) {
+        printf("cpu trace: couldn't write %s\n", fileName);
+        success = false;
+      }
+    }
+  }
+  fclose(csv);
+
+  if (!mrays.empty()) {
+    std::sort(mrays.begin(), mrays.end());
+    double total = 0.0;
+    for (double m : mrays) {
+      total += m;
+    }
+    printf("cpu trace: %d frames, mean %.2f Mrays/s median %.2f min %.2f\n",
+        (int)mrays.size(), total / mrays.size(), mrays[mrays.size() / 2],
+        mrays.front());
+  }
+  printf("cpu trace: timings in %s\n", csvName.c_str());
+  return success;
+}
+
+} // namespace fd
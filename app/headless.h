@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "../common/fourmath.h"
+#include "../common/timer.h"
+
+namespace fd {
+
+class Camera;
+class QuaxolChunk;
+class Texture;
+
+// A gl context with no window, display or surface behind it. On linux this is
+// EGL on mesa's surfaceless platform, which llvmpipe can provide on a build
+// box with no gpu. Everything has to render into an fbo.
+class HeadlessContext {
+public:
+  // NULL if there's no way to get a context, says why
+  static HeadlessContext* Create();
+  ~HeadlessContext();
+
+protected:
+  HeadlessContext() : m_display(NULL), m_context(NULL) {}
+
+  void* m_display; // EGLDisplay, kept opaque so egl.h stays out of here
+  void* m_context;
+};
+
+struct HeadlessSettings {
+  int m_width = 1280;
+  int m_height = 720;
+  int m_frames = 120;
+  float m_frameTime = 1.0f / 60.0f; // fixed, so runs are repeatable
+  int m_captureEvery = 1; // 0 for timings only
+  std::string m_cameraPath; // empty for a built in orbit
+  std::string m_outputDir = "headless";
+};
+
+// Renders a scripted camera path into an offscreen target, one fixed
+// timestep per frame. Dumps every m_captureEvery'th frame as a png and a
+// csv of each frame's cpu submit and gpu times for regression runs.
+class HeadlessCapture {
+public:
+  struct PathKey {
+    float m_time;
+    float m_yaw; // degrees
+    float m_pitch;
+    float m_roll;
+    float m_position[4]; // offset from the level's starting camera
+  };
+  typedef std::vector<PathKey> CameraPath;
+
+  struct FrameTiming {
+    int m_frame;
+    double m_cpuMs;
+    double m_gpuMs;
+  };
+
+  HeadlessCapture(const HeadlessSettings& settings);
+  ~HeadlessCapture();
+
+  bool Initialize();
+  // binds and clears the target, moves the camera along the path
+  void StartFrame(int frame, Camera* pCamera,
+      Texture** outRenderColor, Texture** outRenderDepth);
+  // waits for the gpu, reads back and saves the frame if it's a capture one
+  bool FinishFrame(int frame);
+  // writes the csv and prints a summary
+  bool Finish();
+
+  bool LoadCameraPath(const char* fileName);
+  PathKey SampleCameraPath(float time) const;
+  // moves the camera to where the path is at this frame, no gl involved
+  void PoseCamera(int frame, Camera* pCamera) const;
+
+protected:
+  bool WriteFrame(int frame);
+
+  HeadlessSettings m_settings;
+  CameraPath m_path;
+  Texture* m_color; // owned, has its own fbo with m_depth on it
+  Texture* m_depth;
+  GLuint m_timestampQueries[2];
+  Timer m_cpuTimer;
+  std::vector<FrameTiming> m_timings;
+  std::vector<unsigned char> m_pixels;
+};
+
+// The same camera path and frame numbering as HeadlessCapture, ray cast on
+// the cpu by a VoxelTracer instead, so no gl context is needed at all. The
+// pngs are the reference for image regressions, the csv has Mrays/s.
+bool RunCpuTrace(const HeadlessSettings& settings,
+    const QuaxolChunk& chunk, Camera* pCamera);
+
+} // namespace fd
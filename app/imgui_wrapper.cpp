@@ -2,6 +2,7 @@
 // which is probably the point of it?
 
 #include <memory>
+#include <vector>
 
 #include <GL/glew.h>
 #include "../imgui/imgui.h"
@@ -17,11 +18,15 @@
 #endif
 
 #include "glhelper.h"
+#include "gpu_profiler.h"
 #include "imgui_console.h"
 #include "imgui_tweak.h"
 #include "render.h"
+#include "render_queue.h"
 #include "shader.h"
+#include "stream_buffer.h"
 #include "texture.h"
+#include "../common/timer.h"
 
 namespace fd {
 
@@ -33,10 +38,30 @@ Shader* ImGuiWrapper::s_UIRender = NULL;
 Shader* ImGuiWrapper::s_UIRenderVR = NULL;
 
 static GLuint       g_FontTexture = 0;
-static int          g_AttribLocationTex = 0, g_AttribLocationProjMtx = 0;
 static int          g_AttribLocationPosition = 0, g_AttribLocationUV = 0, g_AttribLocationColor = 0;
-static size_t       g_VboSize = 0;
-static unsigned int g_VboHandle = 0, g_VaoHandle = 0, g_ElementsHandle = 0;
+static unsigned int g_VaoHandle = 0;
+
+// Draw data goes into rings that are never respecified, sized for a few
+// submissions a frame, they grow if the tweak window gets big.
+static const int c_streamVertsPerFrame = 32768;
+static const int c_streamIndicesPerFrame = 65536;
+static StreamBuffer* g_VertexStream = NULL;
+static StreamBuffer* g_IndexStream = NULL;
+
+// The second eye calls Render again without a NewFrame, which hands back
+// the same draw lists, so they're drawn from where the first eye put them.
+struct UploadedList {
+  GLint m_baseVertex;
+  GLintptr m_indexOffset;
+};
+static std::vector<UploadedList> g_uploadedLists;
+static int g_uploadedVerts = -1; // -1 if nothing's been uploaded this frame
+static int g_uploadedIndices = -1;
+static bool g_reuseUpload = false;
+
+// cpu side of the ui, summed over every Render in a frame
+ImGuiWrapper::FrameStats ImGuiWrapper::s_frameStats;
+ImGuiWrapper::FrameStats ImGuiWrapper::s_lastFrameStats;
 
 // this is the first ui image being used. On the second, let's make this decently general, eh?
 static Texture* s_ControllerTex = NULL;
@@ -158,20 +183,52 @@ void ImGuiRenderDrawLists(ImDrawData* draw_data) {
     { -1.0f, 1.0f, 0.0f, 1.0f },
   };
   glUseProgram(ImGuiWrapper::s_UIRender->getProgramId());
-  glUniform1i(g_AttribLocationTex, 0);
-  glUniformMatrix4fv(g_AttribLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
+  glUniform1i(ImGuiWrapper::s_UIRender->getHandle(Shader::UTexDiffuse0), 0);
+  glUniformMatrix4fv(ImGuiWrapper::s_UIRender->getHandle(Shader::UProjectionMatrix), 1, GL_FALSE, &ortho_projection[0][0]);
     glBindVertexArray(g_VaoHandle);
 
+    bool reuse = g_reuseUpload
+        && g_uploadedVerts == draw_data->TotalVtxCount
+        && g_uploadedIndices == draw_data->TotalIdxCount
+        && (int)g_uploadedLists.size() == draw_data->CmdListsCount;
+    if (!reuse) {
+        // all of it fits before any goes in, so a grow can't happen halfway
+        GLsizeiptr vertSize = ((GLsizeiptr)draw_data->TotalVtxCount + draw_data->CmdListsCount) * sizeof(ImDrawVert);
+        GLsizeiptr indexSize = ((GLsizeiptr)draw_data->TotalIdxCount + draw_data->CmdListsCount) * sizeof(ImDrawIdx);
+        if (g_VertexStream->Reserve(vertSize)) {
+            ImGuiWrapper::SetupVertexArray();
+            glBindVertexArray(g_VaoHandle);
+        }
+        g_IndexStream->Reserve(indexSize);
+        g_uploadedLists.resize(draw_data->CmdListsCount);
+        for (int n = 0; n < draw_data->CmdListsCount; n++)
+        {
+            const ImDrawList* cmd_list = draw_data->CmdLists[n];
+            UploadedList& uploaded = g_uploadedLists[n];
+            uploaded.m_baseVertex = -1;
+            if (cmd_list->VtxBuffer.Size == 0 || cmd_list->IdxBuffer.Size == 0)
+                continue;
+            GLintptr vertOffset = g_VertexStream->Write(cmd_list->VtxBuffer.Data, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert), sizeof(ImDrawVert));
+            GLintptr indexOffset = g_IndexStream->Write(cmd_list->IdxBuffer.Data, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx), sizeof(ImDrawIdx));
+            if (vertOffset < 0 || indexOffset < 0)
+                continue;
+            uploaded.m_baseVertex = (GLint)(vertOffset / sizeof(ImDrawVert));
+            uploaded.m_indexOffset = indexOffset;
+        }
+        g_uploadedVerts = draw_data->TotalVtxCount;
+        g_uploadedIndices = draw_data->TotalIdxCount;
+        ImGuiWrapper::s_frameStats.m_uploadedVerts += draw_data->TotalVtxCount;
+        ImGuiWrapper::s_frameStats.m_uploadedIndices += draw_data->TotalIdxCount;
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_IndexStream->GetBufferId());
+
     for (int n = 0; n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
-        const ImDrawIdx* idx_buffer_offset = 0;
-
-        glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert), (GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ElementsHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx), (GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+        const UploadedList& uploaded = g_uploadedLists[n];
+        if (uploaded.m_baseVertex < 0)
+            continue;
+        const ImDrawIdx* idx_buffer_offset = (const ImDrawIdx*)uploaded.m_indexOffset;
 
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
         {
@@ -183,8 +240,10 @@ void ImGuiRenderDrawLists(ImDrawData* draw_data) {
             else
             {
                 glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)pcmd->TextureId);
-                glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
-                glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, idx_buffer_offset);
+                // offset by the viewport for when the ui is drawn into half of a stereo target
+                glScissor(last_viewport[0] + (int)pcmd->ClipRect.x, last_viewport[1] + (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
+                glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, idx_buffer_offset, uploaded.m_baseVertex);
+                ImGuiWrapper::s_frameStats.m_drawCalls++;
             }
             idx_buffer_offset += pcmd->ElemCount;
         }
@@ -287,29 +346,23 @@ bool ImGuiWrapper::InitOpenGL() {
   //s_UIRenderVR = shaderVR.release();
 
   // wholesale ganked from imgui example to start
-  g_AttribLocationTex = glGetUniformLocation(s_UIRender->getProgramId(), "texDiffuse0");
-  g_AttribLocationProjMtx = glGetUniformLocation(s_UIRender->getProgramId(), "projectionMatrix");
-  g_AttribLocationPosition = glGetAttribLocation(s_UIRender->getProgramId(), "vertPosition");
-  g_AttribLocationUV = glGetAttribLocation(s_UIRender->getProgramId(), "vertCoord");
-  g_AttribLocationColor = glGetAttribLocation(s_UIRender->getProgramId(), "vertColor");
-
-  glGenBuffers(1, &g_VboHandle);
-  glGenBuffers(1, &g_ElementsHandle);
+  // attribs are bound to fixed slots before link so survive a reload,
+  // the uniforms are read from the shader's cache each frame instead
+  g_AttribLocationPosition = Shader::ALocVertPosition;
+  g_AttribLocationUV = Shader::ALocVertCoord;
+  g_AttribLocationColor = Shader::ALocVertColor;
+
+  g_VertexStream = new StreamBuffer();
+  g_IndexStream = new StreamBuffer();
+  if(!g_VertexStream->Initialize(c_streamVertsPerFrame * sizeof(ImDrawVert))
+      || !g_IndexStream->Initialize(c_streamIndicesPerFrame * sizeof(ImDrawIdx))) {
+    return false;
+  }
+  printf("ImGui draw data streams %s\n", g_VertexStream->IsPersistent()
+      ? "through persistent maps" : "through unsynchronized maps");
 
   glGenVertexArrays(1, &g_VaoHandle);
-  glBindVertexArray(g_VaoHandle);
-  glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
-  glEnableVertexAttribArray(g_AttribLocationPosition);
-  glEnableVertexAttribArray(g_AttribLocationUV);
-  glEnableVertexAttribArray(g_AttribLocationColor);
-
-#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
-  glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, pos));
-  glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, uv));
-  glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, col));
-#undef OFFSETOF
-  glBindVertexArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  SetupVertexArray();
 
 
   unsigned char* pixels;
@@ -336,13 +389,33 @@ bool ImGuiWrapper::InitOpenGL() {
   return true;
 }
 
+// points the vao at the vertex stream, again whenever the stream grows
+void ImGuiWrapper::SetupVertexArray() {
+  glBindVertexArray(g_VaoHandle);
+  glBindBuffer(GL_ARRAY_BUFFER, g_VertexStream->GetBufferId());
+  glEnableVertexAttribArray(g_AttribLocationPosition);
+  glEnableVertexAttribArray(g_AttribLocationUV);
+  glEnableVertexAttribArray(g_AttribLocationColor);
+
+#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
+  glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, pos));
+  glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, uv));
+  glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, col));
+#undef OFFSETOF
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void ImGuiWrapper::Shutdown() {
   ConsoleInterface::Shutdown();
 
   if (g_VaoHandle) glDeleteVertexArrays(1, &g_VaoHandle);
-  if (g_VboHandle) glDeleteBuffers(1, &g_VboHandle);
-  if (g_ElementsHandle) glDeleteBuffers(1, &g_ElementsHandle);
-  g_VaoHandle = g_VboHandle = g_ElementsHandle = 0;
+  g_VaoHandle = 0;
+  delete g_VertexStream;
+  g_VertexStream = NULL;
+  delete g_IndexStream;
+  g_IndexStream = NULL;
+  g_uploadedLists.clear();
 
   delete s_UIRender;
   s_UIRender = NULL;
@@ -366,6 +439,16 @@ void ImGuiWrapper::Shutdown() {
 void ImGuiWrapper::NewFrame(float deltaTime, int renderWidth, int renderHeight) {
   ImGuiIO& io = ImGui::GetIO();
 
+  s_lastFrameStats = s_frameStats;
+  s_frameStats = FrameStats();
+  g_uploadedVerts = -1;
+  g_uploadedIndices = -1;
+  if (g_VertexStream) {
+    g_VertexStream->NextFrame();
+    g_IndexStream->NextFrame();
+    s_lastFrameStats.m_streamStalls = g_VertexStream->GetStalls() + g_IndexStream->GetStalls();
+  }
+
   int w, h;
   glfwGetWindowSize(s_glfwWindow, &w, &h);
 
@@ -401,7 +484,7 @@ void ImGuiWrapper::NewFrame(float deltaTime, int renderWidth, int renderHeight)
   io.MouseWheel = 0.0f;
 }
 
-void RenderFpsOverlay(float frameTime, const Vec2f& offset) {
+void RenderFpsOverlay(float frameTime, const Vec2f& offset, ::fd::Render* renderer) {
   static bool opened = true;
   ImVec2 startPos(10.0f, 10.0f);
   startPos.x += offset.x();
@@ -413,6 +496,38 @@ void RenderFpsOverlay(float frameTime, const Vec2f& offset) {
       return;
   }
   ImGui::Text("Frametime: %f \t(fps:%f)", frameTime, (frameTime > 0.0f) ? 1.0f / frameTime : 0.0f);
+  const RenderQueue::Stats& stats = RenderQueue::s_lastFrameStats;
+  ImGui::Text("Draws: %d (%d instanced, %d items)", stats.m_drawCalls, stats.m_instancedDraws, stats.m_drawItems);
+  ImGui::Text("Changes: shader %d tex %d mesh %d", stats.m_shaderChanges, stats.m_textureChanges, stats.m_meshChanges);
+  ImGui::Text("Quaxol bricks drawn: %d (%d occluded by %d tris)",
+      stats.m_bricksDrawn, stats.m_bricksOccluded, stats.m_occluderTris);
+  const ImGuiWrapper::FrameStats& gui = ImGuiWrapper::s_lastFrameStats;
+  ImGui::Text("UI cpu: build %.2fms submit %.2fms, %d draws",
+      gui.m_buildMs, gui.m_submitMs, gui.m_drawCalls);
+  ImGui::Text("UI uploaded: %d verts %d indices (%d stream stalls)",
+      gui.m_uploadedVerts, gui.m_uploadedIndices, gui.m_streamStalls);
+  ImGui::Text("Render scale: %.3f (%.2fms gpu per eye)",
+      renderer->GetRenderScale(), renderer->GetLastEyeMs());
+  const RenderTargetPool::Stats& targets = renderer->GetTargetPool().m_lastFrameStats;
+  ImGui::Text("Targets: %d, %.1fMB (%.1fMB out at once), %d made %d freed",
+      targets.m_targets, (float)targets.m_bytes / (1024.0f * 1024.0f),
+      (float)targets.m_peakBytesInUse / (1024.0f * 1024.0f),
+      targets.m_created, targets.m_evicted);
+
+  // the default font is monospaced, so printf alignment makes the table
+  const GpuProfiler::ScopeHistoryList& gpuScopes = GpuProfiler::GetHistory();
+  if (!gpuScopes.empty()) {
+    ImGui::Separator();
+    ImGui::Text("%-24s %7s %7s %7s", "GPU ms", "last", "avg", "max");
+    for (const auto& scope : gpuScopes) {
+      ImGui::Text("%*s%-*s %7.2f %7.2f %7.2f", scope.m_depth * 2, "",
+          24 - scope.m_depth * 2, scope.m_name,
+          scope.m_lastMs, scope.m_averageMs, scope.m_maxMs);
+    }
+    if (GpuProfiler::GetDroppedFrames() > 0) {
+      ImGui::Text("%d frames came back too late to show", GpuProfiler::GetDroppedFrames());
+    }
+  }
   ImGui::End();
 }
 
@@ -529,8 +644,9 @@ void ImGuiWrapper::Render(float frameTime, const Vec2f& offset, ::fd::Render* re
   ImVec2 windowSize((float)renderer->m_viewWidth, (float)renderer->m_viewHeight);
 
   if(doUpdate) { 
+    Timer buildTimer;
 
-    RenderFpsOverlay(frameTime, offset);
+    RenderFpsOverlay(frameTime, offset, renderer);
     RenderVRDebugOverlay(frameTime, offset, renderer);
 
     RenderControlsSceen(windowSize);
@@ -554,9 +670,14 @@ void ImGuiWrapper::Render(float frameTime, const Vec2f& offset, ::fd::Render* re
     }
 
     ConsoleInterface::Render();
+    s_frameStats.m_buildMs += buildTimer.GetElapsed() * 1000.0;
   }
 
+  GPU_SCOPE("imgui");
+  Timer submitTimer;
+  g_reuseUpload = !doUpdate;
   ImGui::Render();
+  s_frameStats.m_submitMs += submitTimer.GetElapsed() * 1000.0;
   WasGLErrorPlusPrint();
 }
 
@@ -22,6 +22,19 @@ public: // probably just because of lazy
   static Shader* s_UIRenderVR;
   static bool s_consoleActive;
 
+  // cpu cost of the ui, apart from the gpu "imgui" scope. Summed over every
+  // Render call in a frame, NewFrame moves them to s_lastFrameStats.
+  struct FrameStats {
+    double m_buildMs = 0.0; // running the overlays, tweak window, console
+    double m_submitMs = 0.0; // ImGui::Render, uploads and draw calls
+    int m_drawCalls = 0;
+    int m_uploadedVerts = 0;
+    int m_uploadedIndices = 0;
+    int m_streamStalls = 0; // total times the rings waited on the gpu
+  };
+  static FrameStats s_frameStats;
+  static FrameStats s_lastFrameStats;
+
 public:
   static bool Init(GLFWwindow* glfwWindow,
       GLFWkeyfun keyCallback, GLFWmousebuttonfun mouseButtonCallback,
@@ -33,6 +46,8 @@ public:
   static void ToggleControllerMenu();
   static bool ToggleResetMenu(); // returns true if window is now shown
 
+  static void SetupVertexArray();
+
 protected:
   static bool InitOpenGL();
 
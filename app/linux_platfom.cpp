@@ -1,7 +1,9 @@
 #ifndef WIN32 // sorry future self mac port implementer
 
 #include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "platform_interface.h"
 #include "linux_platform.h"
@@ -272,8 +274,11 @@ void PlatformWindow::CaptureCursor(bool capture) {
 }
 
 void Platform::ThreadSleep(unsigned long milliseconds) {
-  assert(false); // just haven't tried it yet
-  //usleep(milliseconds);
+  usleep(milliseconds * 1000);
+}
+
+bool Platform::MakeDirectory(const char* path) {
+  return (mkdir(path, 0755) == 0) || (errno == EEXIST);
 }
 
 } // namespace fd
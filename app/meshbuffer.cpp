@@ -1,65 +1,275 @@
+#include <stddef.h>
+#include <string.h>
+#include <vector>
 #include <GL/glew.h>
 #include "meshbuffer.h"
 
 #include "../common/fourmath.h"
 #include "../common/mesh.h"
+#include "../common/mesh_skinned.h"
 #include "glhelper.h"
+#include "shader.h"
 
 namespace fd {
 
-MeshBuffer::MeshBuffer() : m_vertsId(-1), m_indicesId(-1),
-      m_primitiveType(0), m_count(0), m_pMesh(NULL) {}
+MeshBuffer::MeshBuffer()
+    : m_vertArrayId(0)
+    , m_vertsId(0)
+    , m_indicesId(0)
+    , m_primitiveType(GL_TRIANGLES)
+    , m_indexCount(0)
+    , m_meshVersion(-1)
+    , m_hasColors(false)
+    , m_bonesId(0)
+    , m_bonesTextureId(0)
+    , m_bonesSize(0)
+    , m_poseVersion(-1)
+{}
 
 MeshBuffer::~MeshBuffer() {
-  
+  Release();
+}
+
+void MeshBuffer::Release() {
+  if(m_vertArrayId != 0) {
+    glDeleteVertexArrays(1, &m_vertArrayId);
+    m_vertArrayId = 0;
+  }
+  if(m_vertsId != 0) {
+    glDeleteBuffers(1, &m_vertsId);
+    m_vertsId = 0;
+  }
+  if(m_indicesId != 0) {
+    glDeleteBuffers(1, &m_indicesId);
+    m_indicesId = 0;
+  }
+  if(m_bonesTextureId != 0) {
+    glDeleteTextures(1, &m_bonesTextureId);
+    m_bonesTextureId = 0;
+  }
+  if(m_bonesId != 0) {
+    glDeleteBuffers(1, &m_bonesId);
+    m_bonesId = 0;
+  }
+  m_indexCount = 0;
+  m_meshVersion = -1;
+  m_bonesSize = 0;
+  m_poseVersion = -1;
+}
+
+bool MeshBuffer::CreateBuffers() {
+  glGenVertexArrays(1, &m_vertArrayId);
+  glGenBuffers(1, &m_vertsId);
+  glGenBuffers(1, &m_indicesId);
+
+  glBindVertexArray(m_vertArrayId);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesId);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  return !WasGLErrorPlusPrint();
 }
 
 bool MeshBuffer::LoadFromMesh(Mesh* pMesh) {
-  m_pMesh = pMesh;
+  if(!pMesh)
+    return false;
 
-  if (m_pMesh->getNumberTriangles() <= 0)
-    return false; //or maybe true?
+  if(m_vertArrayId == 0 && !CreateBuffers())
+    return false;
 
-  m_count = m_pMesh->getNumberTriangles();
-  m_primitiveType = GL_TRIANGLES;
+  const Mesh::VecList& verts = pMesh->_verts;
+  const Mesh::VecList& colors = pMesh->_colors;
+  const Mesh::IndexList& indices = pMesh->_indices;
 
-  glGenBuffers(1, &m_vertsId);
+  // partial color lists were skipped per triangle before, so all or nothing
+  m_hasColors = !colors.empty() && colors.size() >= verts.size();
+
+  const unsigned short* pBoneIndices = NULL;
+  MeshSkinned* pSkinned = pMesh->hasSkinning()
+      ? dynamic_cast<MeshSkinned*>(pMesh) : NULL;
+  if(pSkinned && pSkinned->_vertBoneIndices.size() >= verts.size()
+      && !verts.empty()) {
+    pBoneIndices = &pSkinned->_vertBoneIndices[0];
+  }
+
+  GLsizeiptr positionsSize = sizeof(Vec4f) * verts.size();
+  GLsizeiptr colorsSize = m_hasColors ? sizeof(Vec4f) * verts.size() : 0;
+  GLsizeiptr bonesSize = pBoneIndices ? sizeof(unsigned short) * verts.size() : 0;
+  GLintptr colorsOffset = positionsSize;
+  GLintptr bonesOffset = positionsSize + colorsSize;
+
+  glBindVertexArray(m_vertArrayId);
   glBindBuffer(GL_ARRAY_BUFFER, m_vertsId);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(Vec4f) * m_pMesh->_verts.size(),
-      &(m_pMesh->_verts[0]), GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, positionsSize + colorsSize + bonesSize,
+      NULL, GL_STATIC_DRAW);
+  if(positionsSize > 0) {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, positionsSize, verts[0].raw());
+  }
+  glEnableVertexAttribArray(Shader::ALocVertPosition);
+  glVertexAttribPointer(Shader::ALocVertPosition, 4, GL_FLOAT, GL_FALSE,
+      sizeof(Vec4f), (GLvoid*)0);
+
+  if(m_hasColors) {
+    glBufferSubData(GL_ARRAY_BUFFER, colorsOffset, colorsSize, colors[0].raw());
+    glEnableVertexAttribArray(Shader::ALocVertColor);
+    glVertexAttribPointer(Shader::ALocVertColor, 4, GL_FLOAT, GL_FALSE,
+        sizeof(Vec4f), (GLvoid*)colorsOffset);
+  } else {
+    glDisableVertexAttribArray(Shader::ALocVertColor);
+  }
+
+  if(pBoneIndices) {
+    glBufferSubData(GL_ARRAY_BUFFER, bonesOffset, bonesSize, pBoneIndices);
+    glEnableVertexAttribArray(Shader::ALocVertBoneIndex);
+    glVertexAttribIPointer(Shader::ALocVertBoneIndex, 1, GL_UNSIGNED_SHORT,
+        sizeof(unsigned short), (GLvoid*)bonesOffset);
+  } else {
+    glDisableVertexAttribArray(Shader::ALocVertBoneIndex);
+  }
+
+  static_assert(sizeof(indices[0]) == sizeof(GLuint), "index upload assumes 32 bit ints");
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(),
+      indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+
+  glBindVertexArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  glGenBuffers(1, &m_indicesId);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesId);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-      sizeof(m_pMesh->_indices[0]) * m_pMesh->_indices.size(),
-      &(m_pMesh->_indices[0]), GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  m_primitiveType = GL_TRIANGLES;
+  m_indexCount = (GLsizei)indices.size();
+  m_meshVersion = pMesh->_version;
 
-  glGenVertexArrays(1, &m_vertAttribuesId);
-  //glBindVertexArray(m_vertAttribuesId);
-  //glBindVertexArray(0);
+  return !WasGLErrorPlusPrint();
+}
+
+bool MeshBuffer::UpdateBones(const MeshSkinned* pSkinned) {
+  if(!pSkinned || pSkinned->_boneRotations.empty()
+      || pSkinned->_boneRotations.size() != pSkinned->_bonePositions.size())
+    return false;
+  if(m_bonesTextureId != 0 && m_poseVersion == pSkinned->_poseVersion)
+    return true;
+
+  // Mat4f is column major like glUniformMatrix4fv wanted, so a column a texel
+  static std::vector<float> s_boneTexels;
+  int numBones = (int)pSkinned->_boneRotations.size();
+  s_boneTexels.resize(numBones * c_texelsPerBone * 4);
+  float* pTexel = s_boneTexels.data();
+  for(int b = 0; b < numBones; ++b) {
+    memcpy(pTexel, pSkinned->_boneRotations[b].raw(), sizeof(float) * 16);
+    memcpy(pTexel + 16, pSkinned->_bonePositions[b].raw(), sizeof(float) * 4);
+    pTexel += c_texelsPerBone * 4;
+  }
+
+  if(m_bonesId == 0) {
+    glGenBuffers(1, &m_bonesId);
+    glGenTextures(1, &m_bonesTextureId);
+    glBindTexture(GL_TEXTURE_BUFFER, m_bonesTextureId);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_bonesId);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+
+  GLsizeiptr size = sizeof(float) * s_boneTexels.size();
+  glBindBuffer(GL_TEXTURE_BUFFER, m_bonesId);
+  if(size != m_bonesSize) {
+    // the texture refers to the buffer, not its storage, so no re-attach
+    glBufferData(GL_TEXTURE_BUFFER, size, s_boneTexels.data(), GL_DYNAMIC_DRAW);
+    m_bonesSize = size;
+  } else {
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, s_boneTexels.data());
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  m_poseVersion = pSkinned->_poseVersion;
+  return !WasGLErrorPlusPrint();
+}
+
+void MeshBuffer::Draw() {
+  if(m_vertArrayId == 0 || m_indexCount == 0)
+    return;
 
-  return true;
+  Bind();
+  DrawBound();
+  Unbind();
 }
 
-bool MeshBuffer::Draw(GLuint vertPositionId) {
+void MeshBuffer::Bind() {
+  glBindVertexArray(m_vertArrayId);
+}
 
-  glBindVertexArray(m_vertsId);
-  glEnableVertexAttribArray(vertPositionId);
-  glVertexAttribPointer(vertPositionId, sizeof(Vec4f), GL_FLOAT, GL_FALSE, 
-    0 /* stride */, 0 /* offset pointer */);
+void MeshBuffer::Unbind() {
+  glBindVertexArray(0);
+}
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesId);
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertsId);
+void MeshBuffer::DrawBound() {
+  if(m_indexCount == 0)
+    return;
 
-  glDrawArrays(m_primitiveType, 0 /* first */, m_count);
-  
+  if(!m_hasColors) {
+    // generic attrib values aren't vao state, so set it every time
+    glVertexAttrib4fv(Shader::ALocVertColor, Vec4f::s_ones.raw());
+  }
+  int viewCount = Shader::GetViewCount();
+  if(viewCount > 1) {
+    glDrawElementsInstanced(m_primitiveType, m_indexCount, GL_UNSIGNED_INT,
+        (GLvoid*)0, viewCount);
+  } else {
+    glDrawElements(m_primitiveType, m_indexCount, GL_UNSIGNED_INT, (GLvoid*)0);
+  }
+}
+
+void MeshBuffer::DrawInstancedBound(GLuint instanceBufferId, GLsizei instanceCount) {
+  if(m_indexCount == 0 || instanceCount <= 0)
+    return;
+
+  if(!m_hasColors) {
+    glVertexAttrib4fv(Shader::ALocVertColor, Vec4f::s_ones.raw());
+  }
+
+  // with stereo each instance is drawn once per eye, back to back
+  int viewCount = Shader::GetViewCount();
+
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBufferId);
+  glEnableVertexAttribArray(Shader::ALocInstWorldPosition);
+  glVertexAttribPointer(Shader::ALocInstWorldPosition, 4, GL_FLOAT, GL_FALSE,
+      sizeof(Instance), (GLvoid*)offsetof(Instance, worldPosition));
+  glVertexAttribDivisor(Shader::ALocInstWorldPosition, viewCount);
+  // same memory layout SetOrientation hands to glUniformMatrix4fv, a column per slot
+  for(int col = 0; col < 4; ++col) {
+    GLuint loc = Shader::ALocInstWorldMatrix + col;
+    glEnableVertexAttribArray(loc);
+    glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+        (GLvoid*)(offsetof(Instance, worldMatrix) + sizeof(float) * 4 * col));
+    glVertexAttribDivisor(loc, viewCount);
+  }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-  glDisableVertexAttribArray(vertPositionId);
 
-  return WasGLErrorPlusPrint();
+  glDrawElementsInstanced(m_primitiveType, m_indexCount, GL_UNSIGNED_INT,
+      (GLvoid*)0, instanceCount * viewCount);
+
+  // leave the vao as DrawBound expects it
+  glDisableVertexAttribArray(Shader::ALocInstWorldPosition);
+  for(int col = 0; col < 4; ++col) {
+    glDisableVertexAttribArray(Shader::ALocInstWorldMatrix + col);
+  }
+}
+
+MeshBuffer* MeshBuffer::GetOrCreate(Mesh* pMesh) {
+  if(!pMesh)
+    return NULL;
+
+  MeshBuffer* pBuffer = dynamic_cast<MeshBuffer*>(pMesh->_renderData);
+  if(!pBuffer) {
+    delete pMesh->_renderData;
+    pBuffer = new MeshBuffer();
+    pMesh->_renderData = pBuffer;
+  }
+
+  if(pBuffer->m_meshVersion != pMesh->_version) {
+    if(!pBuffer->LoadFromMesh(pMesh)) {
+      printf("MeshBuffer failed to upload mesh\n");
+      return NULL;
+    }
+  }
+  return pBuffer;
 }
 
-} // namespace fd
\ No newline at end of file
+} // namespace fd
@@ -2,26 +2,68 @@
 
 #include <GL/glew.h>
 
+#include "../common/mesh.h"
+
 namespace fd {
 
-class Mesh;
-class MeshBuffer {
+class MeshSkinned;
+
+// Gpu copy of a Mesh, hung off the mesh itself as its _renderData so every
+// entity sharing the mesh shares the buffers, and they go away with it.
+// Positions, colors and bone indices are packed back to back in one vbo,
+// re-uploaded only when the mesh's _version moves. Skinned meshes also get
+// their full bone poses in a buffer texture, re-uploaded only when
+// updateFullPoses has run since, so the vbo itself never changes per frame.
+class MeshBuffer : public MeshRenderData {
 public:
+  // per instance layout for DrawInstanced, matches the inst* attribs in
+  // cvCommonTransform.glsl
+  struct Instance {
+    float worldMatrix[16];
+    float worldPosition[4];
+  };
+
+  GLuint m_vertArrayId;
   GLuint m_vertsId;
-  GLuint m_vertAttribuesId;
   GLuint m_indicesId;
   GLenum m_primitiveType;
-  GLint  m_count;
+  GLsizei m_indexCount;
+
+  int m_meshVersion;
+  bool m_hasColors;
 
-  Mesh*  m_pMesh;
+  // skinned only, a bone is c_texelsPerBone rgba32f texels: the four
+  // rotation columns, then the position. see getObjectSpace in
+  // vertSkinnedRainbow.glsl
+  static const int c_texelsPerBone = 5;
+  GLuint m_bonesId;
+  GLuint m_bonesTextureId;
+  GLsizeiptr m_bonesSize;
+  int m_poseVersion;
 
 public:
   MeshBuffer();
-  ~MeshBuffer();
+  virtual ~MeshBuffer();
 
   bool LoadFromMesh(Mesh* pMesh);
-  bool Draw(GLuint vertPositionId);
+  void Draw(); // Bind, DrawBound, Unbind
+
+  // split up so a sorted queue can skip rebinding the same mesh
+  void Bind();
+  void DrawBound();
+  // instanceBufferId holds instanceCount Instance structs, shader needs SetInstanced
+  void DrawInstancedBound(GLuint instanceBufferId, GLsizei instanceCount);
+  static void Unbind();
+  void Release();
+
+  // uploads the mesh's full poses if they moved, false if it has none
+  bool UpdateBones(const MeshSkinned* pSkinned);
+
+  // returns the up to date buffer for the mesh, creating or refreshing it
+  static MeshBuffer* GetOrCreate(Mesh* pMesh);
 
+protected:
+  bool CreateBuffers();
 };
 
 } // namespace fd
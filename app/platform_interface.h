@@ -20,6 +20,9 @@ public:
       const char* currentFile, std::string& nextFile);
 
   static void ThreadSleep(unsigned long milliseconds);
+
+  // just the last level, true if it's there afterwards
+  static bool MakeDirectory(const char* path);
 };
 
 
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+#include "quaxol_buffer.h"
+
+#include "../common/occlusion_buffer.h"
+#include "../common/quaxol.h"
+#include "../common/quaxol_slicer.h"
+#include "../common/view_volume.h"
+#include "glhelper.h"
+#include "shader.h"
+
+namespace fd {
+
+static_assert(sizeof(QuaxolVert) == sizeof(GLint),
+    "QuaxolBuffer::Vert::packed holds a QuaxolVert as is");
+
+// straight copy of the bitfields, getBlockLayer in cvCommonTransform.glsl
+// reads _uvInd back out of bits 20-25
+static GLint PackVert(const QuaxolVert& packVert) {
+  GLint packed;
+  memcpy(&packed, &packVert, sizeof(packed));
+  return packed;
+}
+
+QuaxolBuffer::QuaxolBuffer()
+    : m_vertArrayId(0)
+    , m_vertsId(0)
+    , m_indicesId(0)
+    , m_indexCount(0)
+    , m_bricksOccluded(0)
+    , m_pChunk(NULL)
+    , m_chunkVersion(-1)
+    , m_pSlicer(NULL)
+    , m_slicerVersion(-1)
+{}
+
+QuaxolBuffer::~QuaxolBuffer() {
+  Release();
+}
+
+void QuaxolBuffer::Release() {
+  if(m_vertArrayId != 0) {
+    glDeleteVertexArrays(1, &m_vertArrayId);
+    m_vertArrayId = 0;
+  }
+  if(m_vertsId != 0) {
+    glDeleteBuffers(1, &m_vertsId);
+    m_vertsId = 0;
+  }
+  if(m_indicesId != 0) {
+    glDeleteBuffers(1, &m_indicesId);
+    m_indicesId = 0;
+  }
+  m_indexCount = 0;
+  m_bricks.resize(0);
+  m_pChunk = NULL;
+  m_pSlicer = NULL;
+}
+
+bool QuaxolBuffer::CreateBuffers() {
+  glGenVertexArrays(1, &m_vertArrayId);
+  glGenBuffers(1, &m_vertsId);
+  glGenBuffers(1, &m_indicesId);
+
+  glBindVertexArray(m_vertArrayId);
+  glBindBuffer(GL_ARRAY_BUFFER, m_vertsId);
+  glEnableVertexAttribArray(Shader::ALocVertPosition);
+  glVertexAttribPointer(Shader::ALocVertPosition, 4, GL_FLOAT, GL_FALSE,
+      sizeof(Vert), (GLvoid*)offsetof(Vert, position));
+  glEnableVertexAttribArray(Shader::ALocVertColor);
+  glVertexAttribPointer(Shader::ALocVertColor, 4, GL_FLOAT, GL_FALSE,
+      sizeof(Vert), (GLvoid*)offsetof(Vert, color));
+  glEnableVertexAttribArray(Shader::ALocVertCoord);
+  glVertexAttribPointer(Shader::ALocVertCoord, 2, GL_FLOAT, GL_FALSE,
+      sizeof(Vert), (GLvoid*)offsetof(Vert, coord));
+  glEnableVertexAttribArray(Shader::ALocVertPacked);
+  glVertexAttribIPointer(Shader::ALocVertPacked, 1, GL_INT,
+      sizeof(Vert), (GLvoid*)offsetof(Vert, packed));
+  // element binding is vao state, so it only needs doing once
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesId);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  return !WasGLErrorPlusPrint();
+}
+
+// Chunk indices come in quads of (a, b, c), (c, b, d), see addFlaggedQuad.
+// The atlas uvs are per quad corner but the chunk shares verts between
+// quads, so each quad gets its own 4 verts here.
+// Quads are bucketed by the brick their center falls in, so each brick's
+// indices end up contiguous.
+void QuaxolBuffer::BuildVerts(
+    const QuaxolChunk* pChunk, const ColorList& colors) {
+  const IndexList::size_type c_indicesPerQuad = 6;
+  const float cornerU[4] = { 0.0f, 1.0f, 0.0f, 1.0f };
+  const float cornerV[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+  const ::fd::IndexList& indices = pChunk->m_indices;
+  const VecList& verts = pChunk->m_verts;
+  const QVertList& packVerts = pChunk->m_packVerts;
+  assert(indices.size() % c_indicesPerQuad == 0);
+
+  size_t numQuads = indices.size() / c_indicesPerQuad;
+  m_verts.resize(numQuads * 4);
+  m_indices.resize(numQuads * c_indicesPerQuad);
+
+  // pass one, which brick each quad is in and how many each brick gets
+  Brick emptyBrick = { 0, 0, Vec4f(), Vec4f() };
+  m_bricks.assign(c_numBricks, emptyBrick);
+  m_quadBricks.resize(numQuads);
+  for(size_t quad = 0; quad < numQuads; ++quad) {
+    const int* quadIndices = &indices[quad * c_indicesPerQuad];
+    Vec4f center = verts[quadIndices[0]] + verts[quadIndices[5]];
+    center *= 0.5f;
+    int brickIndex = 0;
+    for(int c = 0; c < 4; ++c) {
+      int brickCoord = (int)floor(center[c] / (pChunk->m_blockSize[c] * c_brickSize));
+      brickCoord = (std::min)((std::max)(brickCoord, 0), c_bricksPerSide - 1);
+      brickIndex = (brickIndex * c_bricksPerSide) + brickCoord;
+    }
+    m_quadBricks[quad] = brickIndex;
+    m_bricks[brickIndex].m_indexCount += (GLsizei)c_indicesPerQuad;
+  }
+
+  GLsizei runningIndex = 0;
+  for(auto& brick : m_bricks) {
+    brick.m_firstIndex = runningIndex;
+    runningIndex += brick.m_indexCount;
+    brick.m_indexCount = 0; // refilled as quads land below
+  }
+
+  // pass two, write each quad into its brick's slot
+  for(size_t quad = 0; quad < numQuads; ++quad) {
+    const int* quadIndices = &indices[quad * c_indicesPerQuad];
+    assert(quadIndices[3] == quadIndices[2] && quadIndices[4] == quadIndices[1]);
+    int corners[4] = {
+        quadIndices[0], quadIndices[1], quadIndices[2], quadIndices[5] };
+
+    Brick& brick = m_bricks[m_quadBricks[quad]];
+    size_t slot = (brick.m_firstIndex + brick.m_indexCount) / c_indicesPerQuad;
+    if(brick.m_indexCount == 0) {
+      brick.m_min = verts[corners[0]];
+      brick.m_max = verts[corners[0]];
+    }
+    brick.m_indexCount += (GLsizei)c_indicesPerQuad;
+
+    // the immediate mode version colored by the first tri's min w
+    const Vec4f& a = verts[corners[0]];
+    const Vec4f& b = verts[corners[1]];
+    const Vec4f& c = verts[corners[2]];
+    float minW = (std::min)(a.w, (std::min)(b.w, c.w));
+    const Vec4f& color = colors.empty()
+        ? Vec4f::s_ones : colors[((int)abs(minW)) % colors.size()];
+
+    GLuint baseVert = (GLuint)(slot * 4);
+    Vert* pVert = &m_verts[baseVert];
+    for(int corner = 0; corner < 4; ++corner) {
+      const Vec4f& pos = verts[corners[corner]];
+      const QuaxolVert& packVert = packVerts[corners[corner]];
+      for(int c = 0; c < 4; ++c) {
+        pVert->position[c] = pos[c];
+        pVert->color[c] = color[c];
+        brick.m_min[c] = (std::min)(brick.m_min[c], pos[c]);
+        brick.m_max[c] = (std::max)(brick.m_max[c], pos[c]);
+      }
+      pVert->coord[0] = cornerU[corner];
+      pVert->coord[1] = cornerV[corner];
+      pVert->packed = PackVert(packVert);
+      ++pVert;
+    }
+
+    GLuint* pIndex = &m_indices[slot * c_indicesPerQuad];
+    *pIndex++ = baseVert + 0;
+    *pIndex++ = baseVert + 1;
+    *pIndex++ = baseVert + 2;
+    *pIndex++ = baseVert + 2;
+    *pIndex++ = baseVert + 1;
+    *pIndex++ = baseVert + 3;
+  }
+}
+
+bool QuaxolBuffer::UpdateFromChunk(
+    const QuaxolChunk* pChunk, const ColorList& colors) {
+  if(!pChunk)
+    return false;
+
+  if(pChunk == m_pChunk && pChunk->m_renderVersion == m_chunkVersion)
+    return true; // already up to date
+
+  if(m_vertArrayId == 0 && !CreateBuffers())
+    return false;
+
+  BuildVerts(pChunk, colors);
+  m_pChunk = pChunk;
+  m_chunkVersion = pChunk->m_renderVersion;
+  m_pSlicer = NULL;
+
+  return UploadVerts();
+}
+
+bool QuaxolBuffer::UpdateFromSlicer(
+    const QuaxolSlicer* pSlicer, const ColorList& colors) {
+  if(!pSlicer)
+    return false;
+
+  if(pSlicer == m_pSlicer && pSlicer->_version == m_slicerVersion)
+    return true; // already up to date
+
+  if(m_vertArrayId == 0 && !CreateBuffers())
+    return false;
+
+  BuildSliceVerts(pSlicer, colors);
+  m_pSlicer = pSlicer;
+  m_slicerVersion = pSlicer->_version;
+  m_pChunk = NULL;
+
+  return UploadVerts();
+}
+
+// the slicer already keeps its tris per brick, so this just packs them
+void QuaxolBuffer::BuildSliceVerts(
+    const QuaxolSlicer* pSlicer, const ColorList& colors) {
+  m_verts.resize(0);
+  m_indices.resize(0);
+  m_bricks.resize(pSlicer->_bricks.size());
+  for(size_t b = 0; b < pSlicer->_bricks.size(); ++b) {
+    const QuaxolSlicer::Brick& sliceBrick = pSlicer->_bricks[b];
+    Brick& brick = m_bricks[b];
+    brick.m_firstIndex = (GLsizei)m_indices.size();
+    brick.m_indexCount = (GLsizei)sliceBrick._indices.size();
+    brick.m_min = sliceBrick._min;
+    brick.m_max = sliceBrick._max;
+
+    GLuint baseVert = (GLuint)m_verts.size();
+    for(const auto& sliceVert : sliceBrick._verts) {
+      const Vec4f& color = colors.empty()
+          ? Vec4f::s_ones : colors[((int)abs(sliceVert._colorW)) % colors.size()];
+      Vert vert;
+      for(int c = 0; c < 4; ++c) {
+        vert.position[c] = sliceVert._position[c];
+        vert.color[c] = color[c];
+      }
+      vert.coord[0] = sliceVert._u;
+      vert.coord[1] = sliceVert._v;
+      // cut positions aren't on the block grid, only the type carries over
+      QuaxolVert packVert;
+      packVert._position = 0;
+      packVert._uv_ao = 0;
+      packVert._uvInd = sliceVert._uvInd;
+      vert.packed = PackVert(packVert);
+      m_verts.push_back(vert);
+    }
+    for(auto index : sliceBrick._indices) {
+      m_indices.push_back(baseVert + (GLuint)index);
+    }
+  }
+}
+
+bool QuaxolBuffer::UploadVerts() {
+  glBindBuffer(GL_ARRAY_BUFFER, m_vertsId);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(Vert) * m_verts.size(),
+      m_verts.empty() ? NULL : &m_verts[0], GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glBindVertexArray(m_vertArrayId);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * m_indices.size(),
+      m_indices.empty() ? NULL : &m_indices[0], GL_STATIC_DRAW);
+  glBindVertexArray(0);
+
+  m_indexCount = (GLsizei)m_indices.size();
+
+  return !WasGLErrorPlusPrint();
+}
+
+int QuaxolBuffer::Draw(const ViewVolume* pView, const ViewVolume* pOtherView,
+    const OcclusionBuffer* pOcclusion) {
+  m_bricksOccluded = 0;
+  if(m_vertArrayId == 0 || m_indexCount == 0)
+    return 0;
+
+  // visible bricks that sit next to each other in the index buffer
+  // get merged into one range
+  m_drawCounts.resize(0);
+  m_drawOffsets.resize(0);
+  int bricksDrawn = 0;
+  GLsizei rangeEnd = -1;
+  for(const auto& brick : m_bricks) {
+    if(brick.m_indexCount == 0)
+      continue;
+    if(pView && !pView->IsBoxVisible(brick.m_min, brick.m_max)
+        && !(pOtherView && pOtherView->IsBoxVisible(brick.m_min, brick.m_max)))
+      continue;
+    if(pOcclusion && !pOcclusion->IsBoxVisible(brick.m_min, brick.m_max)) {
+      ++m_bricksOccluded;
+      continue;
+    }
+
+    ++bricksDrawn;
+    if(brick.m_firstIndex == rangeEnd) {
+      m_drawCounts.back() += brick.m_indexCount;
+    } else {
+      m_drawCounts.push_back(brick.m_indexCount);
+      m_drawOffsets.push_back((const GLvoid*)(sizeof(GLuint) * brick.m_firstIndex));
+    }
+    rangeEnd = brick.m_firstIndex + brick.m_indexCount;
+  }
+
+  if(m_drawCounts.empty())
+    return 0;
+
+  glBindVertexArray(m_vertArrayId);
+  int viewCount = Shader::GetViewCount();
+  if(viewCount > 1) {
+    // no instanced multi draw before 4.3, so a range at a time
+    for(size_t range = 0; range < m_drawCounts.size(); ++range) {
+      glDrawElementsInstanced(GL_TRIANGLES, m_drawCounts[range],
+          GL_UNSIGNED_INT, m_drawOffsets[range], viewCount);
+    }
+  } else {
+    glMultiDrawElements(GL_TRIANGLES, &m_drawCounts[0], GL_UNSIGNED_INT,
+        &m_drawOffsets[0], (GLsizei)m_drawCounts.size());
+  }
+  glBindVertexArray(0);
+  return bricksDrawn;
+}
+
+bool QuaxolBuffer::RunTests() {
+  // the shaders assume gcc and msvc both fill bitfields from the low bit
+  QuaxolVert packVert;
+  packVert._pos_x = 3;
+  packVert._pos_y = -1;
+  packVert._pos_z = 15;
+  packVert._pos_w = -16;
+  packVert._uvInd = 29;
+  packVert._ao = 5;
+  GLint packed = PackVert(packVert);
+  int layer = (packed >> 20) & 63;
+  if (layer != 29) {
+    printf("QuaxolBuffer packed layer came out as %d, not 29\n", layer);
+    return false;
+  }
+  return true;
+}
+
+} // namespace fd
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+
+#include "../common/fourmath.h"
+#include "../common/quaxol.h"
+
+namespace fd {
+
+class OcclusionBuffer;
+class QuaxolSlicer;
+class ViewVolume;
+
+// Gpu copy of a QuaxolChunk's triangles, or of a QuaxolSlicer's section.
+// Chunk tris are expanded per quad so each corner can carry its uv within
+// the block, and grouped into 4^4 block bricks so Draw can skip whatever a ViewVolume
+// rules out. Only re-uploaded after a remesh.
+class QuaxolBuffer {
+public:
+  static const int c_brickSize = 4; // in blocks per side
+  static const int c_bricksPerSide = QuaxolChunk::c_mxSz / c_brickSize;
+  static_assert(c_bricksPerSide * c_brickSize == QuaxolChunk::c_mxSz,
+      "bricks have to tile the chunk exactly");
+  static const int c_numBricks =
+      c_bricksPerSide * c_bricksPerSide * c_bricksPerSide * c_bricksPerSide;
+
+  struct Brick {
+    GLsizei m_firstIndex;
+    GLsizei m_indexCount;
+    Vec4f m_min; // bounds of the brick's actual quads
+    Vec4f m_max;
+  };
+  typedef std::vector<Brick> BrickList;
+
+  struct Vert {
+    float position[4];
+    float color[4];
+    float coord[2]; // 0-1 across the block face
+    GLint packed; // the QuaxolVert bits, the shader takes the block layer out
+  };
+  typedef std::vector<Vert> VertList;
+  typedef std::vector<GLuint> IndexList;
+  typedef std::vector<Vec4f> ColorList;
+
+  GLuint m_vertArrayId;
+  GLuint m_vertsId;
+  GLuint m_indicesId;
+  GLsizei m_indexCount;
+  BrickList m_bricks;
+  int m_bricksOccluded; // by the last Draw, passed the view but not pOcclusion
+
+  const QuaxolChunk* m_pChunk; // not owned, only used to spot a swapped chunk
+  int m_chunkVersion;
+  const QuaxolSlicer* m_pSlicer; // not owned, same deal as m_pChunk
+  int m_slicerVersion;
+
+protected:
+  // kept around to avoid reallocating on every remesh
+  VertList m_verts;
+  IndexList m_indices;
+  std::vector<int> m_quadBricks;
+  std::vector<GLsizei> m_drawCounts;
+  std::vector<const GLvoid*> m_drawOffsets;
+
+public:
+  QuaxolBuffer();
+  ~QuaxolBuffer();
+
+  // no-op unless the chunk changed since the last upload
+  bool UpdateFromChunk(const QuaxolChunk* pChunk, const ColorList& colors);
+  bool UpdateFromSlicer(const QuaxolSlicer* pSlicer, const ColorList& colors);
+  void Invalidate() { m_pChunk = NULL; m_pSlicer = NULL; }
+  // pView may be null to draw everything, returns how many bricks were drawn.
+  // With pOtherView a brick is drawn if either can see it, for stereo.
+  // pOcclusion must have been built from the same camera as pView.
+  int Draw(const ViewVolume* pView = NULL, const ViewVolume* pOtherView = NULL,
+      const OcclusionBuffer* pOcclusion = NULL);
+  void Release();
+
+  static bool RunTests();
+
+protected:
+  bool CreateBuffers();
+  void BuildVerts(const QuaxolChunk* pChunk, const ColorList& colors);
+  void BuildSliceVerts(const QuaxolSlicer* pSlicer, const ColorList& colors);
+  bool UploadVerts();
+};
+
+} // namespace fd
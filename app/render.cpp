@@ -1,14 +1,20 @@
+#include <algorithm>
+#include <math.h>
 #include <memory>
+#include <stddef.h>
 
 #include "render.h"
 
 #include "../common/camera.h"
 #include "../common/misc_defs.h"
+#include "../common/tweak.h"
 #include "glhelper.h"
+#include "gpu_profiler.h"
 #include "platform_interface.h"
 #include "scene.h"
 #include "shader.h"
 #include "texture.h"
+#include "vr_wrapper.h"
 
 namespace fd {
 
@@ -18,11 +24,32 @@ Render::Render()
     , m_multiPass(true)
     , m_pOverdrawQuaxol(NULL)
     , m_pSlicedQuaxol(NULL)
+    , m_pSlicedOverdrawQuaxol(NULL)
+    , m_pOverdrawReplay(NULL)
     , m_pComposeRenderTargets(NULL)
+    , m_pWeightedOitQuaxol(NULL)
+    , m_pWeightedOitOverdraw(NULL)
+    , m_pWeightedOitResolve(NULL)
+    , m_pSlicedLayersQuaxol(NULL)
+    , m_pComposeLayers(NULL)
     , m_overdrawColor(NULL)
     //, m_overdrawDepth(NULL)
     , m_renderColor(NULL)
     , m_renderDepth(NULL)
+    , m_oitAccum(NULL)
+    , m_oitWeight(NULL)
+    , m_sliceLayersColor(NULL)
+    , m_sliceLayersDepth(NULL)
+    , m_sliceLayersCount(0)
+    , m_sliceFeedbackId(0)
+    , m_sliceCaptureBufferId(0)
+    , m_sliceCaptureVertArrayId(0)
+    , m_sliceCaptureSize(0)
+    , m_renderScale(1.0f)
+    , m_renderScaleCooldown(0)
+    , m_sceneRenders(0)
+    , m_lastSceneRenders(1)
+    , m_lastEyeMs(0.0f)
     , m_bufferWidth(0)
     , m_bufferHeight(0)
     , m_viewWidth(0)
@@ -35,13 +62,18 @@ Render::Render()
 }
 
 Render::~Render() {
-  delete m_overdrawColor;
-  //delete m_overdrawDepth;
-  delete m_renderColor;
-  delete m_renderDepth;
+  m_targetPool.Clear();
+  ReleaseSliceCapture();
   delete m_pOverdrawQuaxol;
   delete m_pSlicedQuaxol;
+  delete m_pSlicedOverdrawQuaxol;
+  delete m_pOverdrawReplay;
   delete m_pComposeRenderTargets;
+  delete m_pWeightedOitQuaxol;
+  delete m_pWeightedOitOverdraw;
+  delete m_pWeightedOitResolve;
+  delete m_pSlicedLayersQuaxol;
+  delete m_pComposeLayers;
 }
 
 bool Render::Initialize(int width, int height) {
@@ -63,6 +95,25 @@ bool Render::Initialize(int width, int height) {
   }
   m_pSlicedQuaxol = sliced.release();
 
+  // has to match SliceCaptureVert
+  const char* sliceCaptureVaryings[] = {
+    "overdrawPosition", "overdrawColor", "overdrawClip" };
+  std::unique_ptr<Shader> slicedOverdraw(new Shader());
+  slicedOverdraw->AddDynamicMeshCommonSubShaders();
+  slicedOverdraw->SetFeedbackVaryings(sliceCaptureVaryings,
+      (int)(sizeof(sliceCaptureVaryings) / sizeof(sliceCaptureVaryings[0])));
+  if(!slicedOverdraw->LoadFromFile("SlicedOverdraw",
+      "data/vertSlicedOverdraw.glsl", "data/fragSliced.glsl")) {
+    return false;
+  }
+  m_pSlicedOverdrawQuaxol = slicedOverdraw.release();
+
+  std::unique_ptr<Shader> overdrawReplay(new Shader());
+  if(!overdrawReplay->LoadFromFileDerivedNames("OverdrawReplay")) {
+    return false;
+  }
+  m_pOverdrawReplay = overdrawReplay.release();
+
   std::unique_ptr<Shader> compose(new Shader());
   if(!compose->LoadFromFile(
       "Compose", "data/uivCompose.glsl", "data/uifCompose.glsl")) {
@@ -70,6 +121,46 @@ bool Render::Initialize(int width, int height) {
   }
   m_pComposeRenderTargets = compose.release();
 
+  std::unique_ptr<Shader> oitQuaxol(new Shader());
+  oitQuaxol->AddDynamicMeshCommonSubShaders();
+  if(!oitQuaxol->AddSubShader("data/cfWeightedOit.glsl", GL_FRAGMENT_SHADER)
+      || !oitQuaxol->LoadFromFile("QuaxolOit",
+          "data/vertQuaxol.glsl", "data/fragQuaxolOit.glsl")) {
+    return false;
+  }
+  m_pWeightedOitQuaxol = oitQuaxol.release();
+
+  std::unique_ptr<Shader> oitOverdraw(new Shader());
+  oitOverdraw->AddDynamicMeshCommonSubShaders();
+  if(!oitOverdraw->AddSubShader("data/cfWeightedOit.glsl", GL_FRAGMENT_SHADER)
+      || !oitOverdraw->LoadFromFile("OverdrawRainbowOit",
+          "data/vertOverdrawRainbow.glsl", "data/fragOverdrawRainbowOit.glsl")) {
+    return false;
+  }
+  m_pWeightedOitOverdraw = oitOverdraw.release();
+
+  std::unique_ptr<Shader> oitResolve(new Shader());
+  if(!oitResolve->LoadFromFile("WeightedOitResolve",
+      "data/uivCompose.glsl", "data/uifWeightedOitResolve.glsl")) {
+    return false;
+  }
+  m_pWeightedOitResolve = oitResolve.release();
+
+  // an editing view, so carry on without it if there's no geometry shader
+  std::unique_ptr<Shader> slicedLayers(new Shader());
+  slicedLayers->AddDynamicMeshCommonSubShaders();
+  std::unique_ptr<Shader> composeLayers(new Shader());
+  if(slicedLayers->AddSubShader("data/geomSlicedLayers.glsl", GL_GEOMETRY_SHADER)
+      && slicedLayers->LoadFromFile("SlicedLayers",
+          "data/vertSlicedLayers.glsl", "data/fragSliced.glsl")
+      && composeLayers->LoadFromFile("ComposeLayers",
+          "data/uivCompose.glsl", "data/uifComposeLayers.glsl")) {
+    m_pSlicedLayersQuaxol = slicedLayers.release();
+    m_pComposeLayers = composeLayers.release();
+  } else {
+    printf("Layered slices are unavailable\n");
+  }
+
   if(!ResizeRenderTargets(width, height))
     return false;
 
@@ -133,46 +224,96 @@ Shader* Render::LoadShader(const char* shaderName, bool reload) {
 
 
 bool Render::ResizeRenderTargets(int width, int height) {
-  if(m_overdrawColor) {
-    if(m_overdrawColor->m_width == width && m_overdrawColor->m_height == height) {
-      return true; // success but nothing is true I guess
-    }
-  }
-
   m_bufferWidth = width;
   m_bufferHeight = height;
   UpdateViewHeightFromBuffer();
+  return true;
+}
 
-  DEL_NULL(m_overdrawColor);
-  //DEL_NULL(m_overdrawDepth);
-  DEL_NULL(m_renderColor);
-  DEL_NULL(m_renderDepth);
-
+void Render::EndFrame() {
+  m_targetPool.EndFrame();
+}
 
-  if(!m_multiPass || width == 0 || height == 0)
-    return true; // don't need any of these unless it's multipass
+int Render::ScaleRenderDimension(int size) const {
+  if(size <= 0)
+    return size;
+  return (std::max)(1, (int)ceilf((float)size * m_renderScale));
+}
 
-  std::unique_ptr<Texture> colorOverdraw(new Texture());
-  if(!colorOverdraw->CreateColorTarget(width, height))
-    return false;
+bool Render::IsRenderScaled() const {
+  return ScaleRenderDimension(m_bufferWidth) != m_bufferWidth
+      || ScaleRenderDimension(m_bufferHeight) != m_bufferHeight;
+}
 
-  //std::unique_ptr<Texture> depthOverdraw(new Texture());
-  //if(!depthOverdraw->CreateDepthTarget(width, height))
-  //  return false;
+// Only the scene scales with the pixel count, everything else in the frame
+// is taken as a fixed cost. The profiler's numbers are a couple of frames
+// old and every change has the pool make a new set of targets, so the
+// scale moves in coarse steps, a limited amount at a time, and then sits
+// for a while.
+void Render::UpdateDynamicResolution() {
+  static TweakVariable tweakDynamicRes("render.dynamicRes", true);
+  static TweakVariable tweakTargetMs("render.dynamicResTargetMs", 11.0f);
+  static TweakVariable tweakMinScale("render.dynamicResMin", 0.5f);
+  static TweakVariable tweakMaxScale("render.dynamicResMax", 1.0f);
+  const float c_scaleStep = 1.0f / 16.0f; // what the scale is rounded to
+  const float c_maxScaleChange = 0.125f;
+  const float c_upHeadroom = 0.8f; // of the target, before going back up
+  const int c_cooldownFrames = 15;
+
+  m_lastSceneRenders = (std::max)(1, m_sceneRenders);
+  m_sceneRenders = 0;
+  float sceneMs = GpuProfiler::GetLastMs("scene");
+  float frameMs = GpuProfiler::GetLastMs("frame");
+  m_lastEyeMs = sceneMs / (float)m_lastSceneRenders;
+
+  float maxScale = (std::min)(1.0f, (std::max)(c_scaleStep, tweakMaxScale.AsFloat()));
+  float minScale = (std::min)(maxScale, (std::max)(c_scaleStep, tweakMinScale.AsFloat()));
+  float scale = m_renderScale;
+  if(!tweakDynamicRes.AsBool() || !m_multiPass) {
+    scale = maxScale;
+  } else if(m_renderScaleCooldown > 0) {
+    --m_renderScaleCooldown;
+  } else if(sceneMs > 0.0f && frameMs > 0.0f) {
+    float targetMs = tweakTargetMs.AsFloat();
+    if(frameMs > targetMs || frameMs < targetMs * c_upHeadroom) {
+      float fixedMs = (std::max)(0.0f, frameMs - sceneMs);
+      float sceneBudgetMs = (std::max)(targetMs * c_upHeadroom - fixedMs, targetMs * 0.1f);
+      // cost goes with the pixel count, the square of the scale
+      float wanted = scale * sqrtf(sceneBudgetMs / sceneMs);
+      wanted = (std::max)(scale - c_maxScaleChange, (std::min)(scale + c_maxScaleChange, wanted));
+      scale = floorf(wanted / c_scaleStep) * c_scaleStep;
+    }
+  }
+  scale = (std::max)(minScale, (std::min)(maxScale, scale));
 
-  std::unique_ptr<Texture> renderColor(new Texture());
-  if(!renderColor->CreateColorTarget(width, height))
-    return false;
+  if(scale != m_renderScale) {
+    m_renderScale = scale;
+    m_renderScaleCooldown = c_cooldownFrames;
+  }
+}
 
-  std::unique_ptr<Texture> renderDepth(new Texture());
-  if(!renderDepth->CreateDepthTarget(width, height))
-    return false;
+void Render::SetComposeViewport(Texture* pDestination) {
+  if(pDestination) {
+    glViewport(0, 0, pDestination->m_width, pDestination->m_height);
+  } else {
+    glViewport(0, 0, m_bufferWidth, m_bufferHeight);
+  }
+}
 
-  m_overdrawColor = colorOverdraw.release();
-  //m_overdrawDepth = depthOverdraw.release();
-  m_renderColor = renderColor.release();
-  m_renderDepth = renderDepth.release();
-  return true;
+void Render::BlitSceneDepth(Texture* pDestination, Texture* pDestinationDepth) {
+  // pooled framebuffers keep what their last user attached, so set both
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_renderColor->m_framebuffer_id);
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_TEXTURE_2D, m_renderDepth->m_texture_id, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pDestination->m_framebuffer_id);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_TEXTURE_2D, pDestinationDepth->m_texture_id, 0);
+  // depth can only be blit with nearest
+  glBlitFramebuffer(0, 0, m_renderDepth->m_width, m_renderDepth->m_height,
+      0, 0, pDestinationDepth->m_width, pDestinationDepth->m_height,
+      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, pDestination->m_framebuffer_id);
+  WasGLErrorPlusPrint();
 }
 
 void Render::UpdateViewHeightFromBuffer() {
@@ -241,7 +382,25 @@ void Render::RenderScene(Camera* pCamera, Scene* pScene,
     Texture* pRenderColor, Texture* pRenderDepth) {
   if(m_multiPass && m_pSlicedQuaxol && m_pOverdrawQuaxol
       && pRenderDepth && pRenderColor) {
+    // TODO: calc this from the block size and the w near and far
+    // currently tuned for -40 near, 40 far, 10 blocksize
+    static Vec4f sliceRange(0.456f, 0.556f, 0.0f, 0.0f);
+
+    // the cpu slice is the exact cross section at the middle of the range,
+    // instead of every quaxol face clipped down to the range in the shader
+    static TweakVariable tweakCpuSlice("render.cpuSlice", true);
+    // Without the cpu slice both passes transform the same quaxols, so the
+    // slice pass can capture the overdraw's verts instead. Falls back without
+    // transform feedback objects or with weighted oit overdraw.
+    static TweakVariable tweakSinglePass("render.singlePassSlice", false);
+    if(tweakSinglePass.AsBool() && !tweakCpuSlice.AsBool()
+        && m_alphaDepthMode != AlphaWeightedOit
+        && RenderSlicedOverdraw(pCamera, pScene, sliceRange)) {
+      return;
+    }
+
     // 1st pass of color, depth to ([eyefbo,colorfbo], [eyedepth,depthfbo])
+    GpuProfiler::PushScope("slice pass");
 
     glDisable(GL_BLEND);
     glEnable(GL_ALPHA_TEST);
@@ -253,10 +412,7 @@ void Render::RenderScene(Camera* pCamera, Scene* pScene,
     WasGLErrorPlusPrint();
 
     m_pSlicedQuaxol->StartUsing();
-    // TODO: calc this from the block size and the w near and far
-    // currently tuned for -40 near, 40 far, 10 blocksize
-    static Vec4f sliceRange(0.456f, 0.556f, 0.0f, 0.0f);
-    GLuint hSliceShaderRange = m_pSlicedQuaxol->getUniform("sliceRange");
+    GLint hSliceShaderRange = m_pSlicedQuaxol->getHandle(Shader::USliceRange);
     if(hSliceShaderRange != -1) {
       glUniform4fv(hSliceShaderRange, 1, sliceRange.raw());
       WasGLErrorPlusPrint();
@@ -271,22 +427,37 @@ void Render::RenderScene(Camera* pCamera, Scene* pScene,
     //float wPreNear = (1.0f - sliceAmount) * 0.5f * wRange;
     //pCamera->SetWProjection(savedWnear + wPreNear, savedWfar - wPreNear, 1.0f /*ratio*/);
 
-    pScene->RenderQuaxols(pCamera, m_pSlicedQuaxol);
+    if(tweakCpuSlice.AsBool()) {
+      pScene->RenderQuaxolSlice(pCamera, m_pSlicedQuaxol,
+          (sliceRange.x + sliceRange.y) * 0.5f);
+    } else {
+      pScene->RenderQuaxols(pCamera, m_pSlicedQuaxol);
+    }
     pScene->RenderGroundPlane(pCamera);
+    GpuProfiler::PopScope("slice pass");
 
     //pCamera->SetWProjection(savedWnear, savedWfar, savedWratio);
 
     // 2nd pass of depth - offset <= color blend to (overdrawfbo)
-    glBindFramebuffer(GL_FRAMEBUFFER, m_overdrawColor->m_framebuffer_id);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-        GL_TEXTURE_2D, m_overdrawColor->m_texture_id, 0);
-    //glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-    //    GL_TEXTURE_2D, m_overdrawDepth->m_texture_id, 0); // waste?
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    // good opportunity to do order independent alpha
-    // but first the stupid way
+    GPU_SCOPE("overdraw pass");
+    BindOverdrawTarget();
+
+    if(m_alphaDepthMode == AlphaWeightedOit && m_pWeightedOitOverdraw) {
+      m_pWeightedOitOverdraw->StartUsing();
+      GLint hOitRange = m_pWeightedOitOverdraw->getHandle(Shader::USliceRange);
+      if(hOitRange != -1) {
+        glUniform4fv(hOitRange, 1, sliceRange.raw());
+      }
+      m_pWeightedOitOverdraw->StopUsing();
+
+      // no depth, same as below, it just doesn't care about order
+      if(RenderWeightedOit(pCamera, pScene, m_pWeightedOitOverdraw, NULL)) {
+        glDepthMask(GL_TRUE);
+        return;
+      }
+    }
+
+    // the stupid way, order dependent
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     //glBlendFunc(GL_SRC_ALPHA, GL_ONE);
@@ -297,13 +468,13 @@ void Render::RenderScene(Camera* pCamera, Scene* pScene,
     WasGLErrorPlusPrint();
 
     m_pOverdrawQuaxol->StartUsing();
-    GLuint hOverdrawShaderRange = m_pOverdrawQuaxol->getUniform("sliceRange");
+    GLint hOverdrawShaderRange = m_pOverdrawQuaxol->getHandle(Shader::USliceRange);
     if(hOverdrawShaderRange != -1) {
       glUniform4fv(hOverdrawShaderRange, 1, sliceRange.raw());
     }
     m_pOverdrawQuaxol->StopUsing();
 
-    GLint hDepthTex = m_pOverdrawQuaxol->getUniform("texDepth");
+    GLint hDepthTex = m_pOverdrawQuaxol->getHandle(Shader::UTexDepth);
     if(hDepthTex != -1) {
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, pRenderDepth->GetTextureID());
@@ -320,71 +491,568 @@ void Render::RenderScene(Camera* pCamera, Scene* pScene,
     // restore depth mask
     glDepthMask(GL_TRUE);
 
+  } else if(m_alphaDepthMode == AlphaWeightedOit && m_pWeightedOitQuaxol) {
+    // solid first, the quaxols are tested against its depth
+    {
+      GPU_SCOPE("solid");
+      pScene->RenderQueued(pCamera);
+    }
+    if(!RenderWeightedOit(pCamera, pScene, m_pWeightedOitQuaxol, pRenderDepth)) {
+      // no float targets here, don't keep trying
+      ToggleAlphaDepthModes(AlphaOnDepthOffSrcDest);
+    }
   } else {
+    GPU_SCOPE("everything");
     pScene->RenderEverything(pCamera);
   }
 }
 
+// The slice pass with the overdraw pass's vertex work done alongside. The
+// solid slice goes to whatever is bound with the same state and centered
+// transform as the slice pass, so it depth tests normally, while the
+// projected overdraw verts are captured. Replaying those into
+// m_overdrawColor with no depth test is then the overdraw pass without
+// transforming the quaxols a second time.
+bool Render::RenderSlicedOverdraw(Camera* pCamera, Scene* pScene,
+    const Vec4f& sliceRange) {
+  if(!m_pSlicedOverdrawQuaxol || !m_pOverdrawReplay || !m_overdrawColor)
+    return false;
+  // glDrawTransformFeedback
+  if(!GLEW_VERSION_4_0 && !GLEW_ARB_transform_feedback2)
+    return false;
+  // stereo draws each vert once per eye
+  int maxVerts = pScene->UpdateQuaxolBuffer() * Shader::GetViewCount();
+  if(!PrepareSliceCapture(maxVerts))
+    return false;
+
+  {
+    GPU_SCOPE("single pass slice");
+    glDisable(GL_BLEND);
+    glEnable(GL_ALPHA_TEST);
+    glAlphaFunc(GL_GEQUAL, 0.2f);
+
+    glDepthFunc(GL_LESS);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    WasGLErrorPlusPrint();
+
+    m_pSlicedOverdrawQuaxol->StartUsing();
+    GLint hRange = m_pSlicedOverdrawQuaxol->getHandle(Shader::USliceRange);
+    if(hRange != -1) {
+      glUniform4fv(hRange, 1, sliceRange.raw());
+    }
+    m_pSlicedOverdrawQuaxol->StopUsing();
+
+    pScene->RenderQuaxolChunk(pCamera, m_pSlicedOverdrawQuaxol,
+        m_sliceFeedbackId);
+    pScene->RenderGroundPlane(pCamera);
+    WasGLErrorPlusPrint();
+  }
+
+  GPU_SCOPE("overdraw replay");
+  BindOverdrawTarget();
+
+  // same as the overdraw pass
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_ALPHA_TEST);
+  glDisable(GL_DEPTH_TEST);
+  glDepthFunc(GL_ALWAYS);
+  glDepthMask(GL_FALSE);
+
+  m_pOverdrawReplay->StartUsing();
+  glBindVertexArray(m_sliceCaptureVertArrayId);
+  // draws however many verts were captured, no read back
+  glDrawTransformFeedback(GL_TRIANGLES, m_sliceFeedbackId);
+  glBindVertexArray(0);
+  m_pOverdrawReplay->StopUsing();
+  WasGLErrorPlusPrint();
+
+  glDepthMask(GL_TRUE);
+  return true;
+}
+
+bool Render::PrepareSliceCapture(int maxVerts) {
+  if(maxVerts <= 0)
+    return false;
+
+  if(m_sliceFeedbackId == 0) {
+    glGenTransformFeedbacks(1, &m_sliceFeedbackId);
+    glGenBuffers(1, &m_sliceCaptureBufferId);
+    glGenVertexArrays(1, &m_sliceCaptureVertArrayId);
+
+    // the feedback object keeps its buffer binding
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, m_sliceFeedbackId);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_sliceCaptureBufferId);
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+    glBindVertexArray(m_sliceCaptureVertArrayId);
+    glBindBuffer(GL_ARRAY_BUFFER, m_sliceCaptureBufferId);
+    glEnableVertexAttribArray(Shader::ALocVertPosition);
+    glVertexAttribPointer(Shader::ALocVertPosition, 4, GL_FLOAT, GL_FALSE,
+        sizeof(SliceCaptureVert),
+        (GLvoid*)offsetof(SliceCaptureVert, position));
+    glEnableVertexAttribArray(Shader::ALocVertColor);
+    glVertexAttribPointer(Shader::ALocVertColor, 4, GL_FLOAT, GL_FALSE,
+        sizeof(SliceCaptureVert), (GLvoid*)offsetof(SliceCaptureVert, color));
+    glEnableVertexAttribArray(Shader::ALocVertClip);
+    glVertexAttribPointer(Shader::ALocVertClip, 1, GL_FLOAT, GL_FALSE,
+        sizeof(SliceCaptureVert), (GLvoid*)offsetof(SliceCaptureVert, clip));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  GLsizeiptr size = (GLsizeiptr)maxVerts * sizeof(SliceCaptureVert);
+  if(size > m_sliceCaptureSize) {
+    // some slack so placing quaxols doesn't reallocate every time
+    size += size / 4;
+    glBindBuffer(GL_ARRAY_BUFFER, m_sliceCaptureBufferId);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_sliceCaptureSize = size;
+  }
+
+  if(WasGLErrorPlusPrint()) {
+    ReleaseSliceCapture();
+    return false;
+  }
+  return true;
+}
+
+void Render::ReleaseSliceCapture() {
+  if(m_sliceFeedbackId == 0)
+    return;
+  glDeleteTransformFeedbacks(1, &m_sliceFeedbackId);
+  glDeleteBuffers(1, &m_sliceCaptureBufferId);
+  glDeleteVertexArrays(1, &m_sliceCaptureVertArrayId);
+  m_sliceFeedbackId = 0;
+  m_sliceCaptureBufferId = 0;
+  m_sliceCaptureVertArrayId = 0;
+  m_sliceCaptureSize = 0;
+}
+
+void Render::BindOverdrawTarget() {
+  glBindFramebuffer(GL_FRAMEBUFFER, m_overdrawColor->m_framebuffer_id);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, m_overdrawColor->m_texture_id, 0);
+  //glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+  //    GL_TEXTURE_2D, m_overdrawDepth->m_texture_id, 0); // waste?
+  // pooled, it may have been a solid target with a depth attached
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_TEXTURE_2D, 0, 0);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// Weighted blended order independent transparency. pAccumShader's quaxols
+// go into m_oitAccum/m_oitWeight in whatever order they come, then one
+// fullscreen resolve blends the average over the framebuffer that was bound.
+// pDepth is the solid depth to test against and may be null.
+bool Render::RenderWeightedOit(Camera* pCamera, Scene* pScene,
+    Shader* pAccumShader, Texture* pDepth) {
+  GPU_SCOPE("weighted oit");
+  GLint destFramebuffer = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &destFramebuffer);
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  int width = pDepth ? pDepth->m_width : (viewport[0] + viewport[2]);
+  int height = pDepth ? pDepth->m_height : (viewport[1] + viewport[3]);
+  if(!m_pWeightedOitResolve || !AcquireWeightedOitTargets(width, height))
+    return false;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_oitAccum->m_framebuffer_id);
+  if(pDepth) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_TEXTURE_2D, pDepth->GetTextureID(), 0);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      // multisampled eye depth won't go with it, so everything shows through
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+          GL_TEXTURE_2D, 0, 0);
+      pDepth = NULL;
+    }
+  }
+  const GLfloat clearAccum[] = { 0.0f, 0.0f, 0.0f, 1.0f }; // fully revealed
+  const GLfloat clearWeight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  glClearBufferfv(GL_COLOR, 0, clearAccum);
+  glClearBufferfv(GL_COLOR, 1, clearWeight);
+
+  // sums in rgb and in the weight target, revealage product in accum alpha,
+  // see cfWeightedOit.glsl
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_ALPHA_TEST);
+  if(pDepth) {
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+  } else {
+    glDisable(GL_DEPTH_TEST);
+  }
+  glDepthMask(GL_FALSE);
+  WasGLErrorPlusPrint();
+
+  pScene->RenderQuaxols(pCamera, pAccumShader);
+
+  glDepthMask(GL_TRUE);
+  if(pDepth) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_TEXTURE_2D, 0, 0);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, destFramebuffer);
+
+  // the one extra fullscreen pass
+  m_pWeightedOitResolve->StartUsing();
+  GLint hAccum = m_pWeightedOitResolve->getHandle(Shader::UTexOitAccum);
+  if(hAccum != -1) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_oitAccum->GetTextureID());
+    glUniform1i(hAccum, 0);
+  }
+  GLint hWeight = m_pWeightedOitResolve->getHandle(Shader::UTexOitWeight);
+  if(hWeight != -1) {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_oitWeight->GetTextureID());
+    glUniform1i(hWeight, 1);
+  }
+
+  glDisable(GL_DEPTH_TEST);
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+      GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  // covers the whole target and doesn't write a clip distance
+  GLboolean clipping = glIsEnabled(GL_CLIP_DISTANCE0);
+  glDisable(GL_CLIP_DISTANCE0);
+  DrawComposeVerts();
+  if(clipping) {
+    glEnable(GL_CLIP_DISTANCE0);
+  }
+  m_pWeightedOitResolve->StopUsing();
+  glActiveTexture(GL_TEXTURE0);
+  ReleaseWeightedOitTargets();
+
+  ToggleAlphaDepthModes(m_alphaDepthMode);
+  return !WasGLErrorPlusPrint();
+}
+
+bool Render::AcquireWeightedOitTargets(int width, int height) {
+  m_oitAccum = m_targetPool.AcquireFloat(width, height, GL_RGBA16F, GL_RGBA);
+  m_oitWeight = m_targetPool.AcquireFloat(width, height, GL_R16F, GL_RED);
+  if(!m_oitAccum || !m_oitWeight) {
+    ReleaseWeightedOitTargets();
+    return false;
+  }
+
+  GLint prevFramebuffer = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_oitAccum->m_framebuffer_id);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, m_oitAccum->GetTextureID(), 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+      GL_TEXTURE_2D, m_oitWeight->GetTextureID(), 0);
+  GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+  glDrawBuffers(2, drawBuffers);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+  if(status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: weighted oit framebuffer not ready: %d\n", status);
+    ReleaseWeightedOitTargets();
+    return false;
+  }
+  return true;
+}
+
+void Render::ReleaseWeightedOitTargets() {
+  m_targetPool.Release(m_oitAccum);
+  m_targetPool.Release(m_oitWeight);
+  m_oitAccum = NULL;
+  m_oitWeight = NULL;
+}
+
+void Render::ReleaseFrameTargets() {
+  m_targetPool.Release(m_overdrawColor);
+  m_targetPool.Release(m_renderColor);
+  m_targetPool.Release(m_renderDepth);
+  m_targetPool.Release(m_sliceLayersColor);
+  m_targetPool.Release(m_sliceLayersDepth);
+  m_overdrawColor = NULL;
+  m_renderColor = NULL;
+  m_renderDepth = NULL;
+  m_sliceLayersColor = NULL;
+  m_sliceLayersDepth = NULL;
+}
+
+bool Render::PrepareSliceLayers(int width, int height, int numLayers, bool tiled) {
+  if(!m_pSlicedLayersQuaxol || !m_pComposeLayers
+      || numLayers <= 0 || numLayers > c_maxSliceLayers)
+    return false;
+
+  if(tiled) {
+    // nothing is lost rendering each at the size it's shown
+    int tilesPerSide = (int)ceil(sqrt((double)numLayers));
+    width = (std::max)(1, width / tilesPerSide);
+    height = (std::max)(1, height / tilesPerSide);
+  }
+
+  GLint prevFramebuffer = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+
+  m_sliceLayersCount = 0;
+  m_sliceLayersColor = m_targetPool.AcquireArray(width, height, numLayers,
+      GL_SRGB_ALPHA, GL_RGBA, GL_UNSIGNED_BYTE);
+  m_sliceLayersDepth = m_targetPool.AcquireArray(width, height, numLayers,
+      GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+  if(!m_sliceLayersColor || !m_sliceLayersDepth) {
+    ReleaseFrameTargets();
+    return false;
+  }
+
+  // layered attachments, gl_Layer from the geometry shader picks one
+  glBindFramebuffer(GL_FRAMEBUFFER, m_sliceLayersColor->m_framebuffer_id);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      m_sliceLayersColor->GetTextureID(), 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      m_sliceLayersDepth->GetTextureID(), 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+  if(status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: slice layers framebuffer not ready: %d\n", status);
+    ReleaseFrameTargets();
+    return false;
+  }
+  m_sliceLayersCount = numLayers;
+
+  // once a frame, every camera and scene draws over it. clears every layer.
+  // no alpha so blended layers only cover where they have something
+  glBindFramebuffer(GL_FRAMEBUFFER, m_sliceLayersColor->m_framebuffer_id);
+  glClearColor(m_clearColor.x, m_clearColor.y, m_clearColor.z, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+
+  return !WasGLErrorPlusPrint();
+}
+
+void Render::RenderSliceLayers(Camera* pCamera, Scene* pScene, int numLayers) {
+  GPU_SCOPE("slice layers");
+  GLint prevFramebuffer = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_sliceLayersColor->m_framebuffer_id);
+  glViewport(0, 0, m_sliceLayersColor->m_width, m_sliceLayersColor->m_height);
+
+  // same as the slice pass in RenderScene
+  glDisable(GL_BLEND);
+  glEnable(GL_ALPHA_TEST);
+  glAlphaFunc(GL_GEQUAL, 0.2f);
+  glDepthFunc(GL_LESS);
+  glEnable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+
+  // as thick as RenderScene's sliceRange, centered in even steps from near to far
+  const float c_sliceHalfWidth = 0.05f;
+  float sliceRanges[c_maxSliceLayers * 4] = {};
+  for(int layer = 0; layer < numLayers; ++layer) {
+    float center = ((float)layer + 0.5f) / (float)numLayers;
+    sliceRanges[layer * 4 + 0] = center - c_sliceHalfWidth;
+    sliceRanges[layer * 4 + 1] = center + c_sliceHalfWidth;
+  }
+
+  m_pSlicedLayersQuaxol->StartUsing();
+  GLint hRanges = m_pSlicedLayersQuaxol->getHandle(Shader::USliceRanges);
+  if(hRanges != -1) {
+    glUniform4fv(hRanges, numLayers, sliceRanges);
+  }
+  GLint hLayers = m_pSlicedLayersQuaxol->getHandle(Shader::USliceLayers);
+  if(hLayers != -1) {
+    glUniform1i(hLayers, numLayers);
+  }
+  m_pSlicedLayersQuaxol->StopUsing();
+
+  pScene->RenderQuaxols(pCamera, m_pSlicedLayersQuaxol);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  WasGLErrorPlusPrint();
+}
+
+void Render::ComposeSliceLayers(Texture* pDestination, int numLayers, bool tiled) {
+  if(pDestination == NULL) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  } else {
+    glBindFramebuffer(GL_FRAMEBUFFER, pDestination->m_framebuffer_id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D, pDestination->m_texture_id, 0);
+  }
+  SetComposeViewport(pDestination);
+
+  m_pComposeLayers->StartUsing();
+  GLint hLayersTex = m_pComposeLayers->getHandle(Shader::UTexLayers);
+  if(hLayersTex != -1) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_sliceLayersColor->GetTextureID());
+    glUniform1i(hLayersTex, 0);
+  }
+  GLint hLayers = m_pComposeLayers->getHandle(Shader::USliceLayers);
+  if(hLayers != -1) {
+    glUniform1i(hLayers, numLayers);
+  }
+  GLint hBlend = m_pComposeLayers->getHandle(Shader::ULayerBlend);
+  if(hBlend != -1) {
+    glUniform1i(hBlend, tiled ? 0 : 1);
+  }
+
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+  glDisable(GL_ALPHA_TEST);
+  glDisable(GL_DEPTH_TEST);
+
+  DrawComposeVerts();
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  m_pComposeLayers->StopUsing();
+}
+
 void Render::RenderAllScenesPerCamera(
     Texture* pRenderColor, Texture* pRenderDepth) {
 
   WasGLErrorPlusPrint();
+  GPU_SCOPE("scene");
+  ++m_sceneRenders;
 
   Texture* pColorDestination = pRenderColor;
+  Texture* pDepthDestination = pRenderDepth;
+
+  // single pass stereo has the vertex shader clip each eye to its half
+  bool stereo = (Shader::GetStereoCamera() != NULL);
+
+  // a stack of w slices in place of the usual passes, for editing
+  static TweakVariable tweakSliceLayers("render.sliceLayers", 0);
+  static TweakVariable tweakSliceLayersBlend("render.sliceLayersBlend", false);
+  int numSliceLayers = tweakSliceLayers.AsInt();
+  bool tiledSliceLayers = !tweakSliceLayersBlend.AsBool();
+  bool sliceLayers = false;
+
   if(m_multiPass) {
     GLuint clearFlags = 0;
     if(pRenderColor) {
       // this happens when we switch to vr, as the vr rendertarget is different
       ResizeRenderTargets(pRenderColor->m_width, pRenderColor->m_height);
       WasGLErrorPlusPrint();
-    } else {
-      pRenderColor = m_renderColor;
-      if(!pRenderColor)
+      // scaled down, the eye target is only where the compose goes
+      if(IsRenderScaled()) {
+        pRenderColor = NULL;
+        pRenderDepth = NULL;
+      }
+    }
+    int renderWidth = ScaleRenderDimension(m_bufferWidth);
+    int renderHeight = ScaleRenderDimension(m_bufferHeight);
+
+    // the layers compose straight to the destination, none of the usual
+    // targets are needed, so they aren't taken from the pool
+    sliceLayers = !stereo && numSliceLayers > 0
+        && PrepareSliceLayers(renderWidth, renderHeight,
+            (std::min)(numSliceLayers, (int)c_maxSliceLayers), tiledSliceLayers);
+    numSliceLayers = m_sliceLayersCount;
+
+    if(!sliceLayers) {
+      m_overdrawColor = m_targetPool.AcquireColor(renderWidth, renderHeight);
+      if(pRenderColor == NULL) {
+        m_renderColor = m_targetPool.AcquireColor(renderWidth, renderHeight);
+        pRenderColor = m_renderColor;
+      }
+      if(pRenderDepth == NULL) {
+        m_renderDepth = m_targetPool.AcquireDepth(renderWidth, renderHeight);
+        pRenderDepth = m_renderDepth;
+      }
+      if(!m_overdrawColor || !pRenderColor || !pRenderDepth) {
+        ReleaseFrameTargets();
         return;
+      }
 
-      glBindFramebuffer(GL_FRAMEBUFFER, pRenderColor->m_framebuffer_id);
-      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-          GL_TEXTURE_2D, pRenderColor->m_texture_id, 0);
-      clearFlags |= GL_COLOR_BUFFER_BIT;
-      WasGLErrorPlusPrint();
-    }
+      if(m_renderColor) {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_renderColor->m_framebuffer_id);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, m_renderColor->m_texture_id, 0);
+        clearFlags |= GL_COLOR_BUFFER_BIT;
+        WasGLErrorPlusPrint();
+      }
 
-    // setup render depth if it wasn't passed in
-    if(pRenderDepth == NULL) {
-      pRenderDepth = m_renderDepth;
-      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-          GL_TEXTURE_2D, pRenderDepth->m_texture_id, 0);
-      clearFlags |= GL_DEPTH_BUFFER_BIT;
-      WasGLErrorPlusPrint();
-    }
+      // setup render depth if it wasn't passed in
+      if(m_renderDepth) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+            GL_TEXTURE_2D, m_renderDepth->m_texture_id, 0);
+        clearFlags |= GL_DEPTH_BUFFER_BIT;
+        WasGLErrorPlusPrint();
+      }
 
-    if(clearFlags != 0) {
-      glViewport(0, 0, pRenderDepth->m_width, pRenderDepth->m_height);
-      //glClearColor(1.0f, 0.5f, 0.0f, 1.0f);
-      glClearColor(m_clearColor.x, m_clearColor.y, m_clearColor.z, m_clearColor.w);
-      glClear(clearFlags);
-      WasGLErrorPlusPrint();
+      if(clearFlags != 0) {
+        glViewport(0, 0, pRenderDepth->m_width, pRenderDepth->m_height);
+        //glClearColor(1.0f, 0.5f, 0.0f, 1.0f);
+        glClearColor(m_clearColor.x, m_clearColor.y, m_clearColor.z, m_clearColor.w);
+        glClear(clearFlags);
+        WasGLErrorPlusPrint();
+      }
     }
   }
 
+  if(stereo) {
+    glEnable(GL_CLIP_DISTANCE0);
+  }
+
   for(const auto pCamera : m_cameras) {
+    Shader::UpdateCameraBlock(pCamera);
     for(auto pScene : m_scenes) {
-      RenderScene(pCamera, pScene, pRenderColor, pRenderDepth);
+      if(sliceLayers) {
+        RenderSliceLayers(pCamera, pScene, numSliceLayers);
+      } else {
+        RenderScene(pCamera, pScene, pRenderColor, pRenderDepth);
+      }
     }
   }
 
+  if(sliceLayers) {
+    GpuProfiler::PushScope("compose");
+    ComposeSliceLayers(pColorDestination, numSliceLayers, tiledSliceLayers);
+    GpuProfiler::PopScope("compose");
+    ReleaseFrameTargets();
+    // entities would be drawn across the tiles, so they're left out
+    ToggleAlphaDepthModes(m_alphaDepthMode);
+    return;
+  }
+
   if(m_multiPass) {
+    // compose covers the whole target and doesn't write a clip distance
+    if(stereo) {
+      glDisable(GL_CLIP_DISTANCE0);
+    }
+    GpuProfiler::PushScope("compose");
     RenderCompose(pColorDestination, pRenderColor, m_overdrawColor);
+    // scaled, the world's depth went to the pool's target and the
+    // destination's is still clear, the entities need it to sort against
+    if(m_renderDepth && m_renderColor && pColorDestination && pDepthDestination) {
+      BlitSceneDepth(pColorDestination, pDepthDestination);
+    }
+    GpuProfiler::PopScope("compose");
+    // nothing after the compose reads them, the next eye can have them
+    ReleaseFrameTargets();
+    if(stereo) {
+      glEnable(GL_CLIP_DISTANCE0);
+    }
 
     // restore previous settings
     ToggleAlphaDepthModes(m_alphaDepthMode);
 
+    GPU_SCOPE("dynamic entities");
     for(const auto pCamera : m_cameras) {
+      Shader::UpdateCameraBlock(pCamera);
       for(auto pScene : m_scenes) {
         pScene->RenderDynamicEntities(pCamera);
       }
     }
   }
+
+  if(stereo) {
+    glDisable(GL_CLIP_DISTANCE0);
+  }
 }
 
 void Render::ToggleAlphaDepthModes(EAlphaDepthModes mode) {
@@ -452,6 +1120,18 @@ void Render::ToggleAlphaDepthModes(EAlphaDepthModes mode) {
       glEnable(GL_DEPTH_TEST);
       //glDepthMask(GL_TRUE);
     } break;
+    case AlphaWeightedOit: {
+      modeName = "AlphaWeightedOit";
+      // RenderWeightedOit sets its own state, this is for everything else
+      glEnable(GL_BLEND);
+      glAlphaFunc(GL_ALWAYS, 0.0f);
+      glDisable(GL_ALPHA_TEST);
+
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+      glDepthFunc(GL_LESS);
+      glEnable(GL_DEPTH_TEST);
+    } break;
   }
 
   //printf("switched to %s\n", modeName.c_str());
@@ -469,6 +1149,8 @@ bool Render::InitializeComposeVerts() {
   return true;
 }
 
+// The sources may be smaller than the destination when the resolution is
+// scaled down, their linear filtering does the upscale.
 void Render::RenderCompose(Texture* pDestination,
     Texture* pRenderColor, Texture* pOverdrawSource) {
   if(pDestination == NULL) {
@@ -478,18 +1160,19 @@ void Render::RenderCompose(Texture* pDestination,
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
         GL_TEXTURE_2D, pDestination->m_texture_id, 0);
   }
+  SetComposeViewport(pDestination);
 
   m_pComposeRenderTargets->StartUsing();
 
   //GLint texCoordIndex = glGetAttribLocation(
   //    m_pComposeRenderTargets->getProgramId(), "vertCoord");
-  GLint hSolid = m_pComposeRenderTargets->getUniform("texSolid");
+  GLint hSolid = m_pComposeRenderTargets->getHandle(Shader::UTexSolid);
   if(hSolid != -1) {
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, pRenderColor->GetTextureID());
     glUniform1i(hSolid, 0);
   }
-  GLint hOverdraw = m_pComposeRenderTargets->getUniform("texOverdraw");
+  GLint hOverdraw = m_pComposeRenderTargets->getHandle(Shader::UTexOverdraw);
   if(hOverdraw != -1) {
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, pOverdrawSource->GetTextureID());
@@ -500,6 +1183,12 @@ void Render::RenderCompose(Texture* pDestination,
   glDisable(GL_BLEND);
   glDisable(GL_DEPTH_TEST);
 
+  DrawComposeVerts();
+
+  m_pComposeRenderTargets->StopUsing();
+}
+
+void Render::DrawComposeVerts() {
   glBegin(GL_TRIANGLES);
   for(int t = 0; t < 2; t++) {
     int v = t * 3;
@@ -511,8 +1200,54 @@ void Render::RenderCompose(Texture* pDestination,
     glVertex2f(                     m_composeVerts[v+2].x, m_composeVerts[v+2].y);
   }
   glEnd();
+}
 
-  m_pComposeRenderTargets->StopUsing();
+// pixels of the target's depth anything was drawn to, it's on its fbo
+static int CountDepthWritten(Texture* pColor, Texture* pDepth) {
+  std::vector<float> depth(pDepth->m_width * pDepth->m_height);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, pColor->m_framebuffer_id);
+  glReadPixels(0, 0, pDepth->m_width, pDepth->m_height,
+      GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  int written = 0;
+  for(float d : depth) {
+    if(d < 1.0f) ++written;
+  }
+  return written;
+}
+
+bool Render::RunScaledDepthTest(VRWrapper* pVR, Camera* pCamera) {
+  if(!m_multiPass || !pVR) return true;
+
+  const float scales[] = { 1.0f, 0.5f };
+  int written[2] = { 0, 0 };
+  int pixels = 0;
+  float savedScale = m_renderScale;
+  for(int s = 0; s < 2; s++) {
+    m_renderScale = scales[s];
+    Texture* renderColor = NULL;
+    Texture* renderDepth = NULL;
+    pVR->StartLeftEye(pCamera, &renderColor, &renderDepth);
+    if(!renderColor || !renderDepth) {
+      m_renderScale = savedScale;
+      printf("Scaled depth test has no eye targets\n");
+      return false;
+    }
+    RenderAllScenesPerCamera(renderColor, renderDepth);
+    written[s] = CountDepthWritten(renderColor, renderDepth);
+    pixels = renderDepth->m_width * renderDepth->m_height;
+    pVR->FinishLeftEye(pCamera, &renderColor, &renderDepth);
+  }
+  m_renderScale = savedScale;
+  WasGLErrorPlusPrint();
+
+  // nearest upscaling moves edges by a pixel or so, not whole regions
+  if(abs(written[0] - written[1]) > pixels / 20) {
+    printf("Scaled depth test: %d depth pixels unscaled, %d at half scale\n",
+        written[0], written[1]);
+    return false;
+  }
+  return true;
 }
 
 void Render::ToggleMultipassMode(bool multiPass, int width, int height) {
@@ -13,6 +13,7 @@
 
 #include "fourmath.h"
 #include "camera.h"
+#include "render_target_pool.h"
 #include "timer.h"
 
 namespace fd {
@@ -21,6 +22,7 @@ class Camera;
 class Scene;
 class Shader;
 class Texture;
+class VRWrapper;
 
 // Render should contain all the GL code
 // View will contain a specific render target and a camera
@@ -53,13 +55,48 @@ class Render {
 
   Shader* m_pOverdrawQuaxol;
   Shader* m_pSlicedQuaxol;
+  Shader* m_pSlicedOverdrawQuaxol; // Sliced, capturing OverdrawRainbow's verts
+  Shader* m_pOverdrawReplay; // draws what the above captured
   Shader* m_pComposeRenderTargets;
-
+  Shader* m_pWeightedOitQuaxol; // Quaxol into the oit targets
+  Shader* m_pWeightedOitOverdraw; // OverdrawRainbow into the oit targets
+  Shader* m_pWeightedOitResolve;
+  Shader* m_pSlicedLayersQuaxol; // Sliced into every layer of an array at once
+  Shader* m_pComposeLayers;
+
+  // Every target below comes out of m_targetPool and is only set between
+  // acquiring it and giving it back, within one RenderAllScenesPerCamera.
+  RenderTargetPool m_targetPool;
   // should roll this stuff into view?
   Texture* m_overdrawColor;
   Texture* m_overdrawDepth; // dunno why this is needed
   Texture* m_renderColor;
   Texture* m_renderDepth;
+  Texture* m_oitAccum; // its fbo is the one the oit pass renders to
+  Texture* m_oitWeight;
+  Texture* m_sliceLayersColor; // GL_TEXTURE_2D_ARRAY, its fbo is the layered one
+  Texture* m_sliceLayersDepth;
+  int m_sliceLayersCount; // layers the above were acquired with
+
+  // one m_pSlicedOverdrawQuaxol vertex as transform feedback writes it
+  struct SliceCaptureVert {
+    float position[4]; // clip space, projected
+    float color[4];
+    float clip; // gl_ClipDistance[0]
+  };
+  // render.singlePassSlice, only made once it's turned on
+  GLuint m_sliceFeedbackId;
+  GLuint m_sliceCaptureBufferId;
+  GLuint m_sliceCaptureVertArrayId;
+  GLsizeiptr m_sliceCaptureSize; // bytes
+
+  // Dynamic resolution. The multipass targets are m_renderScale of the
+  // output in each direction and the compose stretches them back up.
+  float m_renderScale;
+  int m_renderScaleCooldown; // frames before the scale can move again
+  int m_sceneRenders; // RenderAllScenesPerCamera calls, one per eye
+  int m_lastSceneRenders;
+  float m_lastEyeMs;
   
   // shouldn't be here..
   // should be in a scene or something?
@@ -68,6 +105,9 @@ class Render {
   double _frameTime;
   
 public:  
+  // geomSlicedLayers.glsl's arrays and max_vertices are sized for this
+  static const int c_maxSliceLayers = 8;
+
   Vec4f m_clearColor;
   bool m_multiPass;
   Vec4f m_sliceRange;
@@ -83,7 +123,18 @@ public:
   ~Render();
 
   bool Initialize(int width, int height);
+  // width and height are the output, the targets are scaled down from it
+  // and come from the pool as they're needed
   bool ResizeRenderTargets(int width, int height);
+  // after the frame's last render, lets the pool drop what went unused
+  void EndFrame();
+  const RenderTargetPool& GetTargetPool() const { return m_targetPool; }
+  // Once a frame, before rendering. Moves m_renderScale so the last gpu
+  // frame the profiler has would have fit render.dynamicResTargetMs.
+  void UpdateDynamicResolution();
+  float GetRenderScale() const { return m_renderScale; }
+  // gpu time of one RenderAllScenesPerCamera, so per eye in vr
+  float GetLastEyeMs() const { return m_lastEyeMs; }
   Shader* LoadShader(const char* shaderName, bool reload = false);
 
   void UpdateFrameTime();
@@ -99,6 +150,17 @@ public:
 
   void RenderAllScenesPerCamera(Texture* pRenderColor, Texture* pRenderDepth);
   void RenderScene(Camera* pCamera, Scene* pScene, Texture* pRenderColor, Texture* pRenderDepth);
+  bool RenderSlicedOverdraw(Camera* pCamera, Scene* pScene, const Vec4f& sliceRange);
+  // before the context goes
+  void ReleaseSliceCapture();
+  bool RenderWeightedOit(Camera* pCamera, Scene* pScene,
+      Shader* pAccumShader, Texture* pDepth);
+  // A stack of numLayers w slices evenly spread from wNear to wFar, all
+  // from one submission of the quaxols. Tiled they each render at the
+  // tile's size, blended at full size.
+  bool PrepareSliceLayers(int width, int height, int numLayers, bool tiled);
+  void RenderSliceLayers(Camera* pCamera, Scene* pScene, int numLayers);
+  void ComposeSliceLayers(Texture* pDestination, int numLayers, bool tiled);
 
   // Right now this is convenient, but separate calls are fine too.
   enum EAlphaDepthModes {
@@ -107,6 +169,7 @@ public:
     AlphaTestDepthOffSrcDest,
     AlphaTestDepthOnSrcDest,
     AlphaOffDepthOn,
+    AlphaWeightedOit, // quaxols only, everything else blends with depth on
     ENumAlphaDepthModes,
     EToggleModes
   };
@@ -120,14 +183,35 @@ public:
   };
   ComposeVert m_composeVerts[6];
   bool InitializeComposeVerts();
+  void DrawComposeVerts();
   void RenderCompose(Texture* pDestination, 
       Texture* pColorTarget, Texture* pOverdrawSource);
   void ToggleMultipassMode(bool multiPass, int width, int height);
 
   void SetIsUsingVR(bool usingVR);
 
+  // Renders the left eye unscaled and at half scale through the vr device,
+  // the null one on a build box, and checks the world's depth made it into
+  // the eye's depth both times, so entities still sort against it.
+  bool RunScaledDepthTest(VRWrapper* pVR, Camera* pCamera);
+
 protected:
   void UpdateViewHeightFromBuffer();
+  bool AcquireWeightedOitTargets(int width, int height);
+  void ReleaseWeightedOitTargets();
+  // the targets RenderAllScenesPerCamera took for its passes
+  void ReleaseFrameTargets();
+  // clears m_overdrawColor and leaves it bound for the overdraw to go over
+  void BindOverdrawTarget();
+  // room for maxVerts in the capture buffer, false if it couldn't be made
+  bool PrepareSliceCapture(int maxVerts);
+  int ScaleRenderDimension(int size) const;
+  // the multipass targets are smaller than the output
+  bool IsRenderScaled() const;
+  void SetComposeViewport(Texture* pDestination);
+  // the scaled scene's depth, stretched into the destination's, for the
+  // entities drawn after the compose
+  void BlitSceneDepth(Texture* pDestination, Texture* pDestinationDepth);
 
 };
 
@@ -3,7 +3,6 @@
 #include "../common/mesh.h"
 #include "../common/raycast_shape.h"
 #include "../common/components/animated_rotation.h"
-#include "../common/components/mesh_cleanup.h"
 #include "../common/components/physics_component.h"
 #include "../common/components/timed_death.h"
 #include "entity.h"
@@ -102,21 +101,33 @@ Entity* RenderHelper::PhysicsTess(Vec4f pos, const Mat4f* rotation, Vec4f color,
   return ent;
 }
 
+// One mesh per color, shared by every tess of that color so they batch
+// into a single instanced draw instead of each owning a copy. Their gpu
+// buffers hang off them, so ReleaseSharedMeshes has to run while there's
+// still a context, not in a static destructor.
+typedef std::vector<std::pair<Vec4f, std::unique_ptr<Mesh>>> ColoredMeshList;
+static ColoredMeshList g_tessMeshes;
+
+void RenderHelper::ReleaseSharedMeshes() {
+  g_tessMeshes.clear();
+}
+
 Entity* RenderHelper::RenderTess(Vec4f pos, const Mat4f* rotation, Vec4f color, float scale) {
   //SCOPE_TIME(); //"RenderHelper::RenderAxis");
-  static Mesh staticTesseract;
-  static bool setupAlready = false;
-  if(!setupAlready) {
-    staticTesseract.buildTesseract(1.0f, Vec4f(-0.5f, -0.5f, -0.5f, -0.5f)); // centered, size 1
-    setupAlready = true;
+  Mesh* pMeshToLoad = NULL;
+  for(auto& coloredMesh : g_tessMeshes) {
+    if(coloredMesh.first == color) {
+      pMeshToLoad = coloredMesh.second.get();
+      break;
+    }
+  }
+  if(!pMeshToLoad) {
+    std::unique_ptr<Mesh> tesseract(new Mesh());
+    tesseract->buildTesseract(1.0f, Vec4f(-0.5f, -0.5f, -0.5f, -0.5f)); // centered, size 1
+    tesseract->fillSolidColors(color);
+    pMeshToLoad = tesseract.get();
+    g_tessMeshes.emplace_back(color, std::move(tesseract));
   }
-
-  std::unique_ptr<Mesh> tesseract(new Mesh());
-  tesseract->merge(staticTesseract);  
-  // TODO: generalize this or make it fast enough to call like this
-  //tesseract->buildTesseract(1.0f, Vec4f(), Vec4f());
-  tesseract->fillSolidColors(color);
-  Mesh* pMeshToLoad = tesseract.get();
 
   Entity* pEntity = g_renderer.GetFirstScene()->AddEntity();
   pEntity->Initialize(pMeshToLoad, g_renderer.LoadShader("VolumeColor"), NULL);
@@ -125,10 +136,6 @@ Entity* RenderHelper::RenderTess(Vec4f pos, const Mat4f* rotation, Vec4f color,
     pEntity->m_orientation = *rotation;
   }
   pEntity->m_orientation = pEntity->m_orientation * scale;
-  pEntity->GetComponentBus().AddComponent(new MeshCleanupComponent(&(pEntity->m_pMesh)));
-  if(pEntity->m_pMesh) {
-    tesseract.release(); // as now the MeshCleanupComponent has it
-  }
   return pEntity;
 }
 
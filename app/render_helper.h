@@ -25,6 +25,9 @@ public:
   static Entity* RenderTess(Vec4f pos, const Mat4f* rotation = NULL, Vec4f color = Vec4f::s_ones, float scale = 1.0f);
   static void RenderAxis(Vec4f pos, const Mat4f* rotation = NULL, float scale = 20.0f, bool permanent = true);
   static void SpamAxes(Vec4f pos);
+
+  // the meshes RenderTess shares, entities using them can't draw after this
+  static void ReleaseSharedMeshes();
 };
 
 } //namespace fd
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <string.h>
+#include <GL/glew.h>
+#include "render_queue.h"
+
+#include "../common/camera.h"
+#include "../common/mesh.h"
+#include "../common/mesh_skinned.h"
+#include "../common/tweak.h"
+#include "entity.h"
+#include "glhelper.h"
+#include "meshbuffer.h"
+#include "shader.h"
+#include "texture.h"
+
+namespace fd {
+
+RenderQueue::Stats RenderQueue::s_frameStats = {};
+RenderQueue::Stats RenderQueue::s_lastFrameStats = {};
+
+RenderQueue::RenderQueue()
+    : m_instanceBufferId(0)
+{}
+
+RenderQueue::~RenderQueue() {
+  if(m_instanceBufferId != 0) {
+    glDeleteBuffers(1, &m_instanceBufferId);
+  }
+}
+
+void RenderQueue::Clear() {
+  m_items.resize(0);
+}
+
+// 4 bits pass | 12 shader | 12 texture | 16 mesh | 20 depth
+// The ids are gl names, which stay small. If one ever overflows its bits the
+// sort just groups a little worse, Execute compares the real pointers.
+unsigned long long RenderQueue::MakeSortKey(ERenderPass pass, GLuint shaderId,
+    GLuint textureId, GLuint meshId, float depth) {
+  const float c_maxSortDepth = 2000.0f;
+  const unsigned long long c_depthSteps = (1 << 20) - 1;
+  float depthFraction = (std::max)(0.0f, (std::min)(1.0f, depth / c_maxSortDepth));
+
+  unsigned long long key = 0;
+  key |= ((unsigned long long)pass & 0xf) << 60;
+  key |= ((unsigned long long)shaderId & 0xfff) << 48;
+  key |= ((unsigned long long)textureId & 0xfff) << 36;
+  key |= ((unsigned long long)meshId & 0xffff) << 20;
+  key |= (unsigned long long)(depthFraction * c_depthSteps); // front to back
+  return key;
+}
+
+void RenderQueue::Add(ERenderPass pass, Shader* pShader, Mesh* pMesh,
+    const TTextureList* pTextures, const Vec4f* pPosition,
+    const Mat4f* pOrientation, float depth) {
+  if(pShader == NULL || pMesh == NULL) return;
+
+  MeshBuffer* pBuffer = MeshBuffer::GetOrCreate(pMesh);
+  if(!pBuffer) return;
+
+  DrawItem item;
+  item.m_pShader = pShader;
+  item.m_pMesh = pMesh;
+  item.m_pBuffer = pBuffer;
+  item.m_pTextures = (pTextures && !pTextures->empty()) ? pTextures : NULL;
+  item.m_pPosition = pPosition;
+  item.m_pOrientation = pOrientation;
+  item.m_skinned = pMesh->hasSkinning();
+  GLuint textureId = item.m_pTextures ? item.m_pTextures->front()->GetTextureID() : 0;
+  item.m_sortKey = MakeSortKey(pass, pShader->getProgramId(), textureId,
+      pBuffer->m_vertArrayId, depth);
+  m_items.push_back(item);
+}
+
+void RenderQueue::AddEntity(ERenderPass pass, const Entity* pEntity,
+    const Camera* pCamera) {
+  float depth = (pEntity->m_position - pCamera->getRenderPos()).length();
+  Add(pass, pEntity->m_pShader, pEntity->m_pMesh, &pEntity->m_textures,
+      &pEntity->m_position, &pEntity->m_orientation, depth);
+}
+
+bool RenderQueue::SameTextures(const TTextureList* pLhs, const TTextureList* pRhs) {
+  if(pLhs == pRhs) return true;
+  if(!pLhs || !pRhs) return false;
+  return *pLhs == *pRhs;
+}
+
+static bool DrawItemKeyLess(const RenderQueue::DrawItem& lhs,
+    const RenderQueue::DrawItem& rhs) {
+  return lhs.m_sortKey < rhs.m_sortKey;
+}
+
+void RenderQueue::Execute(const Camera* pCamera) {
+  static TweakVariable tweakInstanceEntities("render.instanceEntities", true);
+
+  std::stable_sort(m_items.begin(), m_items.end(), DrawItemKeyLess);
+
+  Shader* pCurShader = NULL;
+  const TTextureList* pCurTextures = NULL;
+  MeshBuffer* pCurBuffer = NULL;
+
+  int numItems = (int)m_items.size();
+  s_frameStats.m_drawItems += numItems;
+  int runStart = 0;
+  while(runStart < numItems) {
+    const DrawItem& first = m_items[runStart];
+    int runEnd = runStart + 1;
+    while(runEnd < numItems
+        && m_items[runEnd].m_pShader == first.m_pShader
+        && m_items[runEnd].m_pBuffer == first.m_pBuffer
+        && SameTextures(m_items[runEnd].m_pTextures, first.m_pTextures)) {
+      ++runEnd;
+    }
+
+    if(first.m_pShader != pCurShader) {
+      if(pCurShader) pCurShader->StopUsing();
+      pCurShader = first.m_pShader;
+      pCurShader->StartUsing();
+      pCurShader->SetCameraParams(pCamera);
+      s_frameStats.m_shaderChanges++;
+    }
+    if(!SameTextures(first.m_pTextures, pCurTextures)) {
+      pCurTextures = first.m_pTextures;
+      if(pCurTextures) {
+        for(int unit = 0; unit < (int)pCurTextures->size(); ++unit) {
+          glActiveTexture(GL_TEXTURE0 + unit);
+          glBindTexture(GL_TEXTURE_2D, (*pCurTextures)[unit]->GetTextureID());
+        }
+        glActiveTexture(GL_TEXTURE0);
+      }
+      s_frameStats.m_textureChanges++;
+    }
+    if(first.m_pBuffer != pCurBuffer) {
+      pCurBuffer = first.m_pBuffer;
+      pCurBuffer->Bind();
+      s_frameStats.m_meshChanges++;
+    }
+
+    // skinned poses live on the mesh, and so on its buffer, so a whole run
+    // shares them and can still be instanced
+    if(first.m_skinned) {
+      const MeshSkinned* pSkinned = static_cast<const MeshSkinned*>(first.m_pMesh);
+      if(first.m_pBuffer->UpdateBones(pSkinned)) {
+        pCurShader->SetBoneTexture(first.m_pBuffer->m_bonesTextureId);
+      }
+    }
+
+    int runCount = runEnd - runStart;
+    if(tweakInstanceEntities.AsBool() && runCount > 1) {
+      DrawInstancedRun(&m_items[runStart], runCount);
+    } else {
+      for(int i = runStart; i < runEnd; ++i) {
+        const DrawItem& item = m_items[i];
+        pCurShader->SetPosition(item.m_pPosition);
+        pCurShader->SetOrientation(item.m_pOrientation);
+        item.m_pBuffer->DrawBound();
+        s_frameStats.m_drawCalls++;
+      }
+    }
+    runStart = runEnd;
+  }
+
+  if(pCurBuffer) MeshBuffer::Unbind();
+  if(pCurShader) pCurShader->StopUsing();
+}
+
+void RenderQueue::DrawInstancedRun(const DrawItem* pItems, int count) {
+  static std::vector<MeshBuffer::Instance> s_instances;
+  s_instances.resize(count);
+  for(int i = 0; i < count; ++i) {
+    MeshBuffer::Instance& instance = s_instances[i];
+    memcpy(instance.worldMatrix, pItems[i].m_pOrientation->raw(), sizeof(instance.worldMatrix));
+    memcpy(instance.worldPosition, pItems[i].m_pPosition->raw(), sizeof(instance.worldPosition));
+  }
+
+  if(m_instanceBufferId == 0) {
+    glGenBuffers(1, &m_instanceBufferId);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, m_instanceBufferId);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(MeshBuffer::Instance) * count,
+      &s_instances[0], GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  Shader* pShader = pItems[0].m_pShader;
+  pShader->SetInstanced(true);
+  pItems[0].m_pBuffer->DrawInstancedBound(m_instanceBufferId, count);
+  pShader->SetInstanced(false);
+
+  s_frameStats.m_drawCalls++;
+  s_frameStats.m_instancedDraws++;
+}
+
+void RenderQueue::EndFrame() {
+  s_lastFrameStats = s_frameStats;
+  memset(&s_frameStats, 0, sizeof(s_frameStats));
+}
+
+} // namespace fd
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+
+#include "../common/fourmath.h"
+
+namespace fd {
+
+class Camera;
+class Entity;
+class Mesh;
+class MeshBuffer;
+class Shader;
+class Texture;
+
+// Collects a frame's mesh draws, sorts them on a packed key of
+// (pass, shader, texture, mesh, depth) and runs them without re-setting
+// state that is already current. Consecutive draws of the same
+// shader/texture/mesh go out as one instanced draw.
+class RenderQueue {
+public:
+  enum ERenderPass {
+    PassGround,
+    PassEntities,
+    ENumRenderPasses,
+  };
+
+  typedef std::vector<Texture*> TTextureList;
+
+  struct DrawItem {
+    unsigned long long m_sortKey;
+    Shader* m_pShader; // not owned
+    Mesh* m_pMesh; // not owned
+    MeshBuffer* m_pBuffer; // owned by the mesh
+    const TTextureList* m_pTextures; // may be null
+    const Vec4f* m_pPosition;
+    const Mat4f* m_pOrientation;
+    bool m_skinned;
+  };
+  typedef std::vector<DrawItem> TDrawItemList;
+  TDrawItemList m_items;
+
+  struct Stats {
+    int m_drawItems;
+    int m_drawCalls;
+    int m_instancedDraws;
+    int m_shaderChanges;
+    int m_textureChanges;
+    int m_meshChanges;
+    int m_bricksDrawn; // quaxol bricks that survived view culling
+    int m_bricksOccluded; // and those that then failed the occlusion test
+    int m_occluderTris; // rasterized into the occlusion buffer
+  };
+  static Stats s_frameStats; // accumulates until EndFrame
+  static Stats s_lastFrameStats; // the last complete frame, for display
+
+  GLuint m_instanceBufferId;
+
+public:
+  RenderQueue();
+  ~RenderQueue();
+
+  void Clear();
+  void Add(ERenderPass pass, Shader* pShader, Mesh* pMesh,
+      const TTextureList* pTextures, const Vec4f* pPosition,
+      const Mat4f* pOrientation, float depth);
+  void AddEntity(ERenderPass pass, const Entity* pEntity, const Camera* pCamera);
+  void Execute(const Camera* pCamera);
+
+  static unsigned long long MakeSortKey(ERenderPass pass, GLuint shaderId,
+      GLuint textureId, GLuint meshId, float depth);
+  static void EndFrame();
+
+protected:
+  void DrawInstancedRun(const DrawItem* pItems, int count);
+  static bool SameTextures(const TTextureList* pLhs, const TTextureList* pRhs);
+};
+
+} // namespace fd
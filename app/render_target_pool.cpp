@@ -0,0 +1,199 @@
+#include "render_target_pool.h"
+
+#include <memory>
+#include <stdio.h>
+
+#include "glhelper.h"
+#include "texture.h"
+
+namespace fd {
+
+bool RenderTargetPool::Key::operator==(const Key& rhs) const {
+  return m_kind == rhs.m_kind
+      && m_internalFormat == rhs.m_internalFormat
+      && m_format == rhs.m_format
+      && m_type == rhs.m_type
+      && m_width == rhs.m_width
+      && m_height == rhs.m_height
+      && m_layers == rhs.m_layers;
+}
+
+RenderTargetPool::RenderTargetPool()
+    : m_frame(0)
+    , m_bytes(0)
+    , m_bytesInUse(0) {
+  m_frameStats = {};
+  m_lastFrameStats = {};
+}
+
+RenderTargetPool::~RenderTargetPool() {
+  Clear();
+}
+
+Texture* RenderTargetPool::AcquireColor(int width, int height) {
+  Key key = { KindColor, GL_SRGB_ALPHA, GL_RGBA, GL_UNSIGNED_BYTE,
+      width, height, 1 };
+  return Acquire(key);
+}
+
+Texture* RenderTargetPool::AcquireDepth(int width, int height) {
+  Key key = { KindDepth, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT,
+      GL_UNSIGNED_BYTE, width, height, 1 };
+  return Acquire(key);
+}
+
+Texture* RenderTargetPool::AcquireFloat(int width, int height,
+    GLenum internalFormat, GLenum format) {
+  Key key = { KindFloat, internalFormat, format, GL_FLOAT,
+      width, height, 1 };
+  return Acquire(key);
+}
+
+Texture* RenderTargetPool::AcquireArray(int width, int height, int layers,
+    GLenum internalFormat, GLenum format, GLenum type) {
+  Key key = { KindArray, internalFormat, format, type,
+      width, height, layers };
+  return Acquire(key);
+}
+
+Texture* RenderTargetPool::Acquire(const Key& key) {
+  if(key.m_width <= 0 || key.m_height <= 0 || key.m_layers <= 0)
+    return NULL;
+  ++m_frameStats.m_acquires;
+
+  Entry* pFound = NULL;
+  for(auto& entry : m_entries) {
+    if(!entry.m_inUse && entry.m_key == key) {
+      pFound = &entry;
+      break;
+    }
+  }
+  if(!pFound) {
+    Texture* pTarget = CreateTarget(key);
+    if(!pTarget)
+      return NULL;
+    Entry entry;
+    entry.m_key = key;
+    entry.m_pTarget = pTarget;
+    entry.m_bytes = EstimateBytes(key);
+    entry.m_inUse = false;
+    entry.m_lastUsedFrame = m_frame;
+    m_entries.push_back(entry);
+    m_bytes += entry.m_bytes;
+    ++m_frameStats.m_created;
+    pFound = &m_entries.back();
+  }
+
+  pFound->m_inUse = true;
+  pFound->m_lastUsedFrame = m_frame;
+  m_bytesInUse += pFound->m_bytes;
+  if(m_bytesInUse > m_frameStats.m_peakBytesInUse) {
+    m_frameStats.m_peakBytesInUse = m_bytesInUse;
+  }
+  return pFound->m_pTarget;
+}
+
+void RenderTargetPool::Release(Texture* pTarget) {
+  if(!pTarget)
+    return;
+  for(auto& entry : m_entries) {
+    if(entry.m_pTarget == pTarget) {
+      if(entry.m_inUse) {
+        entry.m_inUse = false;
+        m_bytesInUse -= entry.m_bytes;
+      }
+      return;
+    }
+  }
+  printf("RenderTargetPool was given back a target it didn't make\n");
+}
+
+Texture* RenderTargetPool::CreateTarget(const Key& key) {
+  std::unique_ptr<Texture> target(new Texture());
+  bool created = false;
+  switch(key.m_kind) {
+    case KindColor: {
+      created = target->CreateColorTarget(key.m_width, key.m_height);
+      if(created) {
+        glBindTexture(GL_TEXTURE_2D, target->GetTextureID());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+      }
+    } break;
+    case KindDepth: {
+      created = target->CreateDepthTarget(key.m_width, key.m_height);
+    } break;
+    case KindFloat: {
+      created = target->CreateFloatTarget(key.m_width, key.m_height,
+          key.m_internalFormat, key.m_format);
+    } break;
+    case KindArray: {
+      created = target->CreateArrayTarget(key.m_width, key.m_height,
+          key.m_layers, key.m_internalFormat, key.m_format, key.m_type);
+    } break;
+  }
+  if(!created || WasGLErrorPlusPrint()) {
+    printf("RenderTargetPool couldn't make a %dx%dx%d target of format 0x%x\n",
+        key.m_width, key.m_height, key.m_layers, key.m_internalFormat);
+    return NULL;
+  }
+  return target.release();
+}
+
+void RenderTargetPool::EndFrame() {
+  for(size_t e = 0; e < m_entries.size(); ) {
+    Entry& entry = m_entries[e];
+    if(entry.m_inUse) {
+      printf("RenderTargetPool target %dx%d was still out at the end of the frame\n",
+          entry.m_key.m_width, entry.m_key.m_height);
+      entry.m_inUse = false;
+      m_bytesInUse -= entry.m_bytes;
+    }
+    if(m_frame - entry.m_lastUsedFrame >= c_framesBeforeEvict) {
+      delete entry.m_pTarget;
+      m_bytes -= entry.m_bytes;
+      ++m_frameStats.m_evicted;
+      m_entries.erase(m_entries.begin() + e);
+    } else {
+      ++e;
+    }
+  }
+
+  m_frameStats.m_targets = (int)m_entries.size();
+  m_frameStats.m_bytes = m_bytes;
+  m_lastFrameStats = m_frameStats;
+  m_frameStats = {};
+  ++m_frame;
+}
+
+void RenderTargetPool::Clear() {
+  for(auto& entry : m_entries) {
+    if(entry.m_inUse) {
+      printf("RenderTargetPool cleared with a target still out\n");
+    }
+    delete entry.m_pTarget;
+  }
+  m_entries.clear();
+  m_bytes = 0;
+  m_bytesInUse = 0;
+}
+
+size_t RenderTargetPool::EstimateBytes(const Key& key) {
+  size_t bytesPerPixel = 4;
+  switch(key.m_internalFormat) {
+    case GL_R16F: bytesPerPixel = 2; break;
+    case GL_RG16F: bytesPerPixel = 4; break;
+    case GL_RGBA16F: bytesPerPixel = 8; break;
+    case GL_R32F: bytesPerPixel = 4; break;
+    case GL_RGBA32F: bytesPerPixel = 16; break;
+    // 24 bit depth is padded out to 32 everywhere that matters
+    case GL_DEPTH_COMPONENT24: bytesPerPixel = 4; break;
+    case GL_DEPTH_COMPONENT32F: bytesPerPixel = 4; break;
+    default: break; // the rgba8s and srgb ones
+  }
+  return bytesPerPixel * (size_t)key.m_width * (size_t)key.m_height
+      * (size_t)key.m_layers;
+}
+
+} // namespace fd
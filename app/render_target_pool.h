@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include <GL/glew.h>
+
+namespace fd {
+
+class Texture;
+
+// Render targets keyed by (kind, format, size, layers) and lent out for
+// part of a frame. A pass acquires what it needs and releases it as soon as
+// nothing later reads it, so the next pass, or the other eye, asking for
+// the same key gets the same texture back instead of one of its own.
+// Anything nobody has asked for in c_framesBeforeEvict frames is deleted
+// in EndFrame, so a pass that's turned off or a size the resolution scale
+// has moved away from gives its memory back.
+// A target's framebuffer keeps whatever its last user attached, so callers
+// set every attachment they draw with.
+class RenderTargetPool {
+public:
+  static const int c_framesBeforeEvict = 4;
+
+  enum ETargetKind {
+    KindColor, // srgb rgba8, linear filtered, it's what the compose upscales
+    KindDepth,
+    KindFloat,
+    KindArray, // GL_TEXTURE_2D_ARRAY
+  };
+
+  struct Key {
+    ETargetKind m_kind;
+    GLenum m_internalFormat;
+    GLenum m_format;
+    GLenum m_type;
+    int m_width;
+    int m_height;
+    int m_layers;
+
+    bool operator==(const Key& rhs) const;
+  };
+
+  struct Stats {
+    int m_acquires;
+    int m_created; // acquires nothing free could cover
+    int m_evicted;
+    int m_targets; // alive at the end of the frame
+    size_t m_bytes; // estimated from the formats, drivers may pad
+    size_t m_peakBytesInUse; // acquired at once
+  };
+  Stats m_frameStats; // accumulates until EndFrame
+  Stats m_lastFrameStats; // the last complete frame, for display
+
+  RenderTargetPool();
+  ~RenderTargetPool();
+
+  // NULL if it couldn't be made
+  Texture* AcquireColor(int width, int height);
+  Texture* AcquireDepth(int width, int height);
+  Texture* AcquireFloat(int width, int height,
+      GLenum internalFormat, GLenum format);
+  Texture* AcquireArray(int width, int height, int layers,
+      GLenum internalFormat, GLenum format, GLenum type);
+  // NULL is fine
+  void Release(Texture* pTarget);
+
+  void EndFrame();
+  // deletes every target, none can be out
+  void Clear();
+
+  static size_t EstimateBytes(const Key& key);
+
+protected:
+  struct Entry {
+    Key m_key;
+    Texture* m_pTarget;
+    size_t m_bytes;
+    bool m_inUse;
+    int m_lastUsedFrame;
+  };
+
+  Texture* Acquire(const Key& key);
+  Texture* CreateTarget(const Key& key);
+
+  std::vector<Entry> m_entries;
+  int m_frame;
+  size_t m_bytes;
+  size_t m_bytesInUse;
+};
+
+} // namespace fd
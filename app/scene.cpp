@@ -6,14 +6,20 @@
 #include "../common/camera.h"
 #include "../common/mesh.h"
 #include "../common/mesh_skinned.h"
+#include "../common/occlusion_buffer.h"
 #include "../common/physics.h"
 #include "../common/quaxol.h"
+#include "../common/quaxol_slicer.h"
+#include "../common/tweak.h"
+#include "../common/view_volume.h"
 #include "../common/components/physics_component.h"
 
 #include "entity.h"
 #include "glhelper.h"
 #include "meshbuffer.h"
+#include "quaxol_buffer.h"
 #include "render.h"
+#include "render_queue.h"
 #include "shader.h"
 #include "texture.h"
 
@@ -22,14 +28,19 @@ namespace fd {
 Scene::Scene()
   : m_pQuaxolShader(NULL)
   , m_pQuaxolMesh(NULL)
-  //, m_pQuaxolBuffer(NULL)
+  , m_pQuaxolBuffer(NULL)
+  , m_pQuaxolSlicer(NULL)
+  , m_pQuaxolSliceBuffer(NULL)
+  , m_pOcclusion(NULL)
+  , m_pRenderQueue(NULL)
   , m_pQuaxolChunk(NULL)
-  , m_pQuaxolAtlas(NULL)
+  , m_pQuaxolBlocks(NULL)
   , m_pGroundPlane(NULL)
 {
   BuildColorArray();
 
   m_pPhysics = new Physics();
+  m_pRenderQueue = new RenderQueue();
 
   m_componentBus.RegisterSignal(std::string("EntityDeleted"), this,
       &Scene::RemoveEntity);  // notification from entity that it is being deleted
@@ -39,7 +50,11 @@ Scene::Scene()
 }
 
 Scene::~Scene() {
-  //delete m_pQuaxolBuffer;
+  delete m_pRenderQueue;
+  delete m_pQuaxolBuffer;
+  delete m_pQuaxolSliceBuffer;
+  delete m_pQuaxolSlicer;
+  delete m_pOcclusion;
   delete m_pQuaxolChunk;
   delete m_pPhysics;
   delete m_pGroundPlane;
@@ -58,14 +73,16 @@ bool Scene::Initialize() {
     return false;
   }
 
-  m_pQuaxolAtlas = new Texture();
-  if(!m_pQuaxolAtlas->LoadFromFile("data/textures/atlas.png")) {
+  // the first 8x8 tiles of the 16x16 atlas, one per QuaxolVert::_uvInd
+  m_pQuaxolBlocks = new Texture();
+  if(!m_pQuaxolBlocks->LoadArrayFromAtlas("data/textures/atlas.png",
+      16 /*tilesPerSide*/, 8 /*layersPerRow*/, 64 /*numLayers*/)) {
     return false;
   }
 
   m_pQuaxolShader = new Shader();
   m_pQuaxolShader->AddDynamicMeshCommonSubShaders();
-  if(!m_pQuaxolShader->LoadFromFileDerivedNames("Rainbow")) {
+  if(!m_pQuaxolShader->LoadFromFileDerivedNames("Quaxol")) {
   //if(!m_pQuaxolShader->LoadFromFileDerivedNames("ColorBlendClipped")) {
     return false;
   }
@@ -75,6 +92,15 @@ bool Scene::Initialize() {
 
 void Scene::TakeLoadedChunk(QuaxolChunk* pChunk) {
   m_pQuaxolChunk = pChunk;
+  if(m_pQuaxolBuffer) {
+    m_pQuaxolBuffer->Invalidate();
+  }
+  if(m_pQuaxolSlicer) {
+    m_pQuaxolSlicer->Invalidate();
+  }
+  if(m_pQuaxolSliceBuffer) {
+    m_pQuaxolSliceBuffer->Invalidate();
+  }
   m_pPhysics->AddChunk(m_pQuaxolChunk);
 }
 
@@ -156,41 +182,15 @@ void RenderMesh(Camera* pCamera, Shader* pShader, Mesh* pMesh,
   if(pShader == NULL) return; // should go away when we sort
   if(pMesh == NULL) return; // should go away when we sort
 
+  MeshBuffer* pBuffer = MeshBuffer::GetOrCreate(pMesh);
+  if(!pBuffer) return;
+
   pShader->StartUsing();
   pShader->SetPosition(&position);
   pShader->SetOrientation(&orientation);
   pShader->SetCameraParams(pCamera);
-  GLuint colorHandle = pShader->GetColorHandle();
-
-  // this is getting ugly to look at in a hurry
-  // need to do buffers soon
-  int numTris = pMesh->getNumberTriangles();
-  int startTriangle = 0;
-  int endTriangle = numTris;
-  glBegin(GL_TRIANGLES);
-  Vec4f a, b, c;
-  Vec4f colorA, colorB, colorC;
-  //int colorIndex = 0;
-  for (int t = startTriangle; t < endTriangle && t < numTris; t++) {
-    pMesh->getTriangle(t, a, b, c);
-    if(colorHandle != -1) {
-      pMesh->getColors(t, colorA, colorB, colorC);
-      glVertexAttrib4fv(colorHandle, colorA.raw());
-    }
-    glVertex4fv(a.raw());
-    if(colorHandle != -1) {
-      glVertexAttrib4fv(colorHandle, colorB.raw());
-    }
-    glVertex4fv(b.raw());
-    if(colorHandle != -1) {
-      glVertexAttrib4fv(colorHandle, colorC.raw());
-    }
-    glVertex4fv(c.raw());
-    //if ((t+1) % 2 == 0) {
-    //  colorIndex = (colorIndex + 1) % colorArray.size();
-    //}
-  }
-  glEnd();
+  pBuffer->Draw();
+  RenderQueue::s_frameStats.m_drawCalls++;
   pShader->StopUsing();
 }
 
@@ -202,63 +202,29 @@ void RenderMeshSkinned(Camera* pCamera, Shader* pShader, Mesh* pMesh,
   MeshSkinned* skinnedMesh = dynamic_cast<MeshSkinned*>(pMesh);
   if(!skinnedMesh) return;
   //skinnedMesh->updateFullPoses(); // do on demand? or setup dirty system and do both?
-  
+
+  MeshBuffer* pBuffer = MeshBuffer::GetOrCreate(pMesh);
+  if(!pBuffer) return;
+
   pShader->StartUsing();
   pShader->SetPosition(&position);
   pShader->SetOrientation(&orientation);
   pShader->SetCameraParams(pCamera);
-  GLuint colorHandle = pShader->GetColorHandle();
-  
-  GLint boneIndexHandle = pShader->getAttrib("vertBoneIndex");
-  GLint boneRotations = pShader->getUniform("boneRotations");
-  GLint bonePositions = pShader->getUniform("bonePositions");
-  if(boneIndexHandle == -1 || boneRotations == -1 || bonePositions == -1) {
-    printf("RenderMeshSkinned problem with shader handles\n");
-  }
 
-  if(!skinnedMesh->_boneRotations.empty()) {
-    glUniformMatrix4fv(boneRotations, (::std::min)(20, (int)skinnedMesh->_boneRotations.size()), GL_FALSE, skinnedMesh->_boneRotations[0].raw()); // huh, this might not work actually, need to check we didn't pad
-  }
-  if(!skinnedMesh->_bonePositions.empty()) {
-    glUniform4fv(bonePositions, (::std::min)(20, (int)skinnedMesh->_bonePositions.size()), skinnedMesh->_bonePositions[0].raw()); // also might not work due to extra padding
+  if(pBuffer->UpdateBones(skinnedMesh)) {
+    pShader->SetBoneTexture(pBuffer->m_bonesTextureId);
   }
 
-  // wow ugly now need to do buffers
-  int numTris = pMesh->getNumberTriangles();
-  int startTriangle = 0;
-  int endTriangle = numTris;
-  glBegin(GL_TRIANGLES);
-  Vec4f a, b, c;
-  Vec4f colorA, colorB, colorC;
-  int aInd, bInd, cInd;
-  for (int t = startTriangle; t < endTriangle && t < numTris; t++) {
-    pMesh->getIndexedTriangle(t, aInd, bInd, cInd, a, b, c);
-    if(colorHandle != -1) {
-      pMesh->getColors(t, colorA, colorB, colorC);
-      glVertexAttrib4fv(colorHandle, colorA.raw());
-    }
-    glVertexAttribI1i(boneIndexHandle, *skinnedMesh->getBoneIndex(aInd));
-    glVertex4fv(a.raw());
-
-    if(colorHandle != -1) {
-      glVertexAttrib4fv(colorHandle, colorB.raw());
-    }
-    glVertexAttribI1i(boneIndexHandle, *skinnedMesh->getBoneIndex(bInd));
-    glVertex4fv(b.raw());
-
-    if(colorHandle != -1) {
-      glVertexAttrib4fv(colorHandle, colorC.raw());
-    }
-    glVertexAttribI1i(boneIndexHandle, *skinnedMesh->getBoneIndex(cInd));
-    glVertex4fv(c.raw());
-  }
-  glEnd();
+  // bone indices ride along in the mesh buffer
+  pBuffer->Draw();
+  RenderQueue::s_frameStats.m_drawCalls++;
   pShader->StopUsing();
 }
 
+static bool s_renderGroundPlane = false;
+
 void Scene::RenderGroundPlane(Camera* pCamera) {
-  static bool renderGroundPlane = false;
-  if(!renderGroundPlane)
+  if(!s_renderGroundPlane)
     return;
 
   static Mat4f groundOrientation = Mat4f().storeIdentity();
@@ -267,35 +233,43 @@ void Scene::RenderGroundPlane(Camera* pCamera) {
       groundPosition, groundOrientation);
 }
 
-// ugh this is all wrong, not going to be shader sorted, etc
-// but let's just do the stupid thing first
-// Also, shouldn't this be in a render class instead of scene?
-void Scene::RenderEverything(Camera* pCamera) {
-  RenderGroundPlane(pCamera);
+void Scene::QueueGroundPlane(Camera* pCamera) {
+  if(!s_renderGroundPlane)
+    return;
 
-  RenderDynamicEntities(pCamera);
+  static Mat4f groundOrientation = Mat4f().storeIdentity();
+  static Vec4f groundPosition = Vec4f().storeZero();
+  m_pRenderQueue->Add(RenderQueue::PassGround, m_pGroundShader, m_pGroundPlane,
+      NULL /*textures*/, &groundPosition, &groundOrientation, 0.0f /*depth*/);
+}
 
+void Scene::RenderEverything(Camera* pCamera) {
+  RenderQueued(pCamera);
   RenderQuaxols(pCamera, m_pQuaxolShader);
 }
 
+void Scene::RenderQueued(Camera* pCamera) {
+  m_pRenderQueue->Clear();
+  QueueGroundPlane(pCamera);
+  QueueDynamicEntities(pCamera);
+  m_pRenderQueue->Execute(pCamera);
+}
+
 // TODO: if this gets used more, will probably need split between alpha/non
 void Scene::RenderDynamicEntities(Camera* pCamera) {
+  m_pRenderQueue->Clear();
+  QueueDynamicEntities(pCamera);
+  m_pRenderQueue->Execute(pCamera);
+}
+
+void Scene::QueueDynamicEntities(Camera* pCamera) {
   for(const auto pEntity : m_dynamicEntities) {
-    if(pEntity->m_pMesh && pEntity->m_pMesh->hasSkinning()) {
-      //TODO: sort by shader transition
-      RenderMesh(pCamera, pEntity->m_pShader, pEntity->m_pMesh,
-          pEntity->m_position, pEntity->m_orientation);
-    } else {
-      RenderMeshSkinned(pCamera, pEntity->m_pShader, pEntity->m_pMesh,
-          pEntity->m_position, pEntity->m_orientation);
-    }
+    m_pRenderQueue->AddEntity(RenderQueue::PassEntities, pEntity, pCamera);
   }
-  //printf("dynamic entities took %f\n", dyn.GetElapsed());
 }
 
-void Scene::RenderQuaxolChunk(Camera* pCamera, Shader* pShader) {
-  if(!m_pQuaxolChunk) return;
-
+// shared setup for drawing chunk space geometry with the block textures
+void Scene::StartQuaxolShader(Camera* pCamera, Shader* pShader) {
   WasGLErrorPlusPrint();
 
   pShader->StartUsing();
@@ -306,75 +280,123 @@ void Scene::RenderQuaxolChunk(Camera* pCamera, Shader* pShader) {
 
   WasGLErrorPlusPrint();
 
-  if (m_pQuaxolAtlas) {
-    GLint hTex0 = pShader->getUniform("texDiffuse0");
-    if (hTex0 != -1) {
+  if (m_pQuaxolBlocks) {
+    GLint hBlocks = pShader->getHandle(Shader::UTexBlocks);
+    if (hBlocks != -1) {
       glActiveTexture(GL_TEXTURE0);
       WasGLErrorPlusPrint();
-      glBindTexture(GL_TEXTURE_2D, m_pQuaxolAtlas->GetTextureID());
+      glBindTexture(GL_TEXTURE_2D_ARRAY, m_pQuaxolBlocks->GetTextureID());
   //WasGLErrorPlusPrint();
   //    glUniform1i(hTex0, 0);
     }
   }
 
-  GLint hTexCoord = glGetAttribLocation(pShader->getProgramId(), "vertCoord");
-  //GLint hTexCoord = pShader->getAttrib("vertCoord");
-
   static Vec4f zero(0,0,0,0);
   pShader->SetPosition(&zero);
-  GLuint colorHandle = pShader->GetColorHandle();
-
-  glBegin(GL_TRIANGLES);
-
-  // TODO: use vbo, as we have already done the work to put things into
-  // a nice format.
-  IndexList& indices = m_pQuaxolChunk->m_indices;
-  VecList& verts = m_pQuaxolChunk->m_verts;
-  QVertList& packVerts = m_pQuaxolChunk->m_packVerts;
-  int numTris = (int)indices.size() / 3;
-  int currentIndex = 0;
-  for (int tri = 0; tri < numTris; ++tri) {
-
-    const QuaxolVert& vA = packVerts[indices[currentIndex]];
-    const Vec4f& a = verts[indices[currentIndex++]];
-    const QuaxolVert& vB = packVerts[indices[currentIndex]];
-    const Vec4f& b = verts[indices[currentIndex++]];
-    const QuaxolVert& vC = packVerts[indices[currentIndex]];
-    const Vec4f& c = verts[indices[currentIndex++]];
-
-    if (colorHandle != -1) {
-      float minW = (std::min)(a.w, (std::min)(b.w, c.w));
-      int colorIndex = ((int)abs(minW)) % m_colorArray.size();
-      glVertexAttrib4fv(colorHandle, m_colorArray[colorIndex].raw());
-    }
+}
 
-    if (hTexCoord != -1) {
-      const float invTexSteps = 1.0f / 16.0f;
-      int firstTriOffset = tri % 2;
-      glVertexAttrib2f(hTexCoord,
-          (float)((vA._uvInd % 8) + 0) * invTexSteps,
-          (float)((vA._uvInd / 8) + firstTriOffset) * invTexSteps);
-      glVertex4fv(a.raw());
-      glVertexAttrib2f(hTexCoord,
-          (float)((vB._uvInd % 8) + 1) * invTexSteps,
-          (float)((vB._uvInd / 8) + 0) * invTexSteps);
-      glVertex4fv(b.raw());
-      glVertexAttrib2f(hTexCoord,
-          (float)((vC._uvInd % 8) + firstTriOffset) * invTexSteps,
-          (float)((vC._uvInd / 8) + 1) * invTexSteps);
-      glVertex4fv(c.raw());
-    } else {
-      glVertex4fv(a.raw());
-      glVertex4fv(b.raw());
-      glVertex4fv(c.raw());
-    }
+void Scene::DrawQuaxolBricks(Camera* pCamera, QuaxolBuffer* pBuffer,
+    const OcclusionBuffer* pOcclusion) {
+  static TweakVariable tweakCullBricks("render.cullBricks", true);
+  ViewVolume view;
+  view.UpdateFromCamera(*pCamera);
+  // both eyes come out of this draw when doing single pass stereo
+  ViewVolume otherView;
+  const Camera* pStereoCamera = Shader::GetStereoCamera();
+  if(pStereoCamera) {
+    otherView.UpdateFromCamera(*pStereoCamera);
+  }
+  int bricksDrawn = 0;
+  if(tweakCullBricks.AsBool()) {
+    bricksDrawn = pBuffer->Draw(&view, pStereoCamera ? &otherView : NULL,
+        pOcclusion);
+  } else {
+    bricksDrawn = pBuffer->Draw();
+  }
+  RenderQueue::s_frameStats.m_drawCalls++;
+  RenderQueue::s_frameStats.m_bricksDrawn += bricksDrawn;
+  RenderQueue::s_frameStats.m_bricksOccluded += pBuffer->m_bricksOccluded;
+  WasGLErrorPlusPrint();
+}
+
+int Scene::UpdateQuaxolBuffer() {
+  if(!m_pQuaxolChunk) return 0;
+
+  if(!m_pQuaxolBuffer) {
+    m_pQuaxolBuffer = new QuaxolBuffer();
+  }
+  // only does work if the chunk was remeshed
+  m_pQuaxolBuffer->UpdateFromChunk(m_pQuaxolChunk, m_colorArray);
+  return m_pQuaxolBuffer->m_indexCount;
+}
+
+void Scene::RenderQuaxolChunk(Camera* pCamera, Shader* pShader,
+    GLuint feedbackId) {
+  if(!m_pQuaxolChunk) return;
+
+  StartQuaxolShader(pCamera, pShader);
+
+  UpdateQuaxolBuffer();
+
+  // the program can't change while capturing, so inside Start and Stop
+  if(feedbackId != 0) {
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedbackId);
+    glBeginTransformFeedback(GL_TRIANGLES);
+  }
+  DrawQuaxolBricks(pCamera, m_pQuaxolBuffer);
+  if(feedbackId != 0) {
+    glEndTransformFeedback();
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
   }
-  glEnd();
 
   pShader->StopUsing();
 
 }
 
+// sliceW is where the slice sits between wNear (0) and wFar (1),
+// the same units the Sliced shader's sliceRange uses
+void Scene::RenderQuaxolSlice(Camera* pCamera, Shader* pShader, float sliceW) {
+  if(!m_pQuaxolChunk) return;
+
+  // camera space w is row 3 of fourToThree * renderMatrix around renderPos,
+  // so in chunk space the slice is that row dotted with x
+  Mat4f toThree = pCamera->_fourToThree * pCamera->getRenderMatrix();
+  Vec4f normal = toThree[3];
+  float cameraW = pCamera->_wNear + (sliceW * (pCamera->_wFar - pCamera->_wNear));
+  float distance = normal.dot(pCamera->getRenderPos()) + cameraW;
+
+  if(!m_pQuaxolSlicer) {
+    m_pQuaxolSlicer = new QuaxolSlicer();
+  }
+  // only reslices if the plane moved or the chunk was remeshed
+  m_pQuaxolSlicer->Update(m_pQuaxolChunk, normal, distance);
+
+  StartQuaxolShader(pCamera, pShader);
+
+  if(!m_pQuaxolSliceBuffer) {
+    m_pQuaxolSliceBuffer = new QuaxolBuffer();
+  }
+  m_pQuaxolSliceBuffer->UpdateFromSlicer(m_pQuaxolSlicer, m_colorArray);
+
+  // The slice is drawn opaque and depth tested, so its nearest big bricks
+  // can hide the rest. Single pass stereo would need a buffer per eye.
+  static TweakVariable tweakOcclusionCull("render.occlusionCull", true);
+  static TweakVariable tweakOccluderTris("render.occluderTris", 4096);
+  OcclusionBuffer* pOcclusion = NULL;
+  if(tweakOcclusionCull.AsBool() && Shader::GetStereoCamera() == NULL) {
+    if(!m_pOcclusion) {
+      m_pOcclusion = new OcclusionBuffer();
+    }
+    m_pOcclusion->Update(*pCamera, *m_pQuaxolSlicer, tweakOccluderTris.AsInt());
+    RenderQueue::s_frameStats.m_occluderTris += m_pOcclusion->_lastOccluderTris;
+    pOcclusion = m_pOcclusion;
+  }
+
+  DrawQuaxolBricks(pCamera, m_pQuaxolSliceBuffer, pOcclusion);
+
+  pShader->StopUsing();
+}
+
 void Scene::RenderQuaxolsIndividually(Camera* pCamera, Shader* pShader) {
   if(!m_pQuaxolMesh) return;
 
@@ -387,7 +409,7 @@ void Scene::RenderQuaxolsIndividually(Camera* pCamera, Shader* pShader) {
   pShader->SetOrientation(&worldMatrix);
   WasGLErrorPlusPrint();
 
-  GLint hTex0 = pShader->getUniform("texDiffuse0");
+  GLint hTex0 = pShader->getHandle(Shader::UTexDiffuse0);
   WasGLErrorPlusPrint();
   if (hTex0 != -1) {
     SetTexture(0, hTex0);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <GL/glew.h>
 #include <vector>
 #include "../common/chunkloader.h"
 #include "../common/component.h"
@@ -11,11 +12,15 @@ class Camera;
 class Entity;
 class MeshBuffer;
 class Mesh;
+class OcclusionBuffer;
 class Physics;
+class QuaxolBuffer;
 class QuaxolChunk;
+class QuaxolSlicer;
 class Shader;
 class Texture;
 class Render;
+class RenderQueue;
 
 class Scene {
 protected:
@@ -40,11 +45,16 @@ public:
   // shaders should not be here really, turning this class into dumping grounds
   Shader* m_pQuaxolShader; //not owned
   Mesh* m_pQuaxolMesh; //not owned
-  Texture* m_pQuaxolAtlas;
+  Texture* m_pQuaxolBlocks; // GL_TEXTURE_2D_ARRAY, layer per QuaxolVert::_uvInd
 
   typedef std::vector<Texture*> TTextureList;
   TTextureList m_texList;
-  //MeshBuffer* m_pQuaxolBuffer; // owned
+  QuaxolBuffer* m_pQuaxolBuffer; // owned
+  QuaxolSlicer* m_pQuaxolSlicer; // owned, cpu cross section of the chunk
+  QuaxolBuffer* m_pQuaxolSliceBuffer; // owned, gpu copy of the slicer
+  OcclusionBuffer* m_pOcclusion; // owned, hi-z of the slice for culling it
+
+  RenderQueue* m_pRenderQueue; // owned
 
   QuaxolChunk* m_pQuaxolChunk;
 
@@ -59,12 +69,20 @@ public:
   void SetQuaxolAt(const QuaxolSpec& pos, bool present);
   void SetQuaxolAt(const QuaxolSpec& pos, bool present, int type);
   void RenderQuaxols(Camera* pCamera, Shader* pShader);
-  void RenderQuaxolChunk(Camera* pCamera, Shader* pShader);
+  // a nonzero feedbackId captures what the draw puts out, for that
+  // pShader has to have feedback varyings and room for UpdateQuaxolBuffer's
+  // count of verts per view
+  void RenderQuaxolChunk(Camera* pCamera, Shader* pShader,
+      GLuint feedbackId = 0);
+  // brings the chunk's buffer up to date, returns the most verts one view
+  // of RenderQuaxolChunk can draw
+  int UpdateQuaxolBuffer();
+  void RenderQuaxolSlice(Camera* pCamera, Shader* pShader, float sliceW);
   void RenderQuaxolsIndividually(Camera* pCamera, Shader* pShader); // deprecated
 
-  // ugh this is all wrong, not going to be shader sorted, etc
-  // but let's just do the stupid thing first
+  // ground and entities go through the sorted render queue, quaxols after
   void RenderEverything(Camera* pCamera);
+  void RenderQueued(Camera* pCamera); // just the queue part of the above
   void Step(float fDelta);
   
   // Let the scene do the allocation to allow for mem opt
@@ -74,14 +92,20 @@ public:
   void RemoveEntity(Entity* pEntity);
   void OnDeleteEntity(Entity* pEntity);
   void RenderDynamicEntities(Camera* pCamera);
+  void QueueDynamicEntities(Camera* pCamera);
 
   // Hacky garbage, should be on the mesh/quaxol
   void BuildColorArray();
   void AddTexture(Texture* pTex);
 
   void RenderGroundPlane(Camera* pCamera);
+  void QueueGroundPlane(Camera* pCamera);
 
 protected:
+  void StartQuaxolShader(Camera* pCamera, Shader* pShader);
+  void DrawQuaxolBricks(Camera* pCamera, QuaxolBuffer* pBuffer,
+      const OcclusionBuffer* pOcclusion = NULL);
+
   // horrible way to index textures
   // going to need a shader context or something soon
   void SetTexture(int index, int hTex);
@@ -3,6 +3,9 @@
 #include <Windows.h>
 #endif // WIN32
 
+#include <algorithm>
+#include <string.h>
+
 //
 // #define STB_DEFINE
 // #pragma warning(push)
@@ -16,12 +19,33 @@
 #include "shader.h"
 #include "../common/camera.h"
 #include "glhelper.h"
+#include "platform_interface.h"
 
 //#define SHADER_DEBUG_SPAM
 
 namespace fd {
 
 Shader::ShaderHash Shader::s_shaderhash;
+GLuint Shader::s_cameraBlockId = 0;
+const Camera* Shader::s_pStereoCamera = NULL;
+const Camera* Shader::s_pBlockCamera = NULL;
+bool Shader::s_useBinaryCache = true;
+std::string Shader::s_binaryCacheDir = "data/shadercache";
+int Shader::s_binaryCacheHits = 0;
+int Shader::s_binaryCacheMisses = 0;
+
+// bump when what FinishProgram sets up before linking changes, as that
+// isn't in the sources the key is made from
+static const uint32_t c_binaryCacheVersion = 3;
+static const uint32_t c_binaryCacheMagic = 0x62706466; // 'fdpb'
+
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+};
 
 Shader::~Shader() {
   RemoveFromShaderHash();
@@ -39,6 +63,8 @@ void Shader::Release() {
     m_programId = 0;
   }
   m_subShaderNames.resize(0);
+  m_subShaderSources.resize(0);
+  std::fill(m_handles, m_handles + ENumShaderHandles, -1);
   //if(m_uniforms) {
   //  handle_hash_destroy(m_uniforms);
   //  m_uniforms = NULL;
@@ -55,36 +81,53 @@ Shader::Shader()
     //, m_attribs(NULL)
     //, m_uniforms(NULL)
 {
+  std::fill(m_handles, m_handles + ENumShaderHandles, -1);
   s_test_shader_refs++;
 }
 
-// apparently the right way to do most of these in GL is to make a
-// shared uniform buffer
-// look like 56 floats would apply so far
-// doing things so inefficiently already that much more refactoring necessary
-void Shader::InitCameraParamHandles() {
+const char* Shader::s_handleNames[ENumShaderHandles] = {
+  // attribs
+  "vertPosition",
+  "vertColor",
+  "vertCoord",
+  "vertBoneIndex",
+  "vertPacked",
+
+  // uniforms, per object
+  "worldMatrix",
+  "worldPosition",
+  "texDiffuse0",
+  "texBlocks",
+  "instanced",
+
+  // uniforms, skinning, per object
+  "texBones",
+
+  // uniforms, per pass
+  "sliceRange",
+  "texDepth",
+  "texSolid",
+  "texOverdraw",
+  "texOitAccum",
+  "texOitWeight",
+  "sliceRanges",
+  "sliceLayers",
+  "texLayers",
+  "layerBlend",
+
+  // uniforms, ui only
+  "projectionMatrix",
+};
+
+void Shader::InitHandles() {
   assert(m_programId != 0);
 
-  // per vertex
-  m_handles[AVertPosition] = getAttrib("vertPosition");
-  m_handles[AVertColor] = getAttrib("vertColor");
-  m_handles[AVertBoneIndex] = getAttrib("vertBoneIndex");
-
-  // per object
-  m_handles[UWorldMatrix] = getUniform("worldMatrix");
-  m_handles[UWorldPosition] = getUniform("worldPosition");
-  m_handles[UTexDiffuse0] = getUniform("texDiffuse0");
-
-  // skinning, per object
-  m_handles[UBoneRotations] = getUniform("boneRotations");
-  m_handles[UBonePositions] = getUniform("bonePositions");
-
-  // camera
-  m_handles[UCameraPosition] = getUniform("cameraPosition");
-  m_handles[UCameraMatrix] = getUniform("cameraMatrix");
-  m_handles[UProjectionMatrix] = getUniform("projectionMatrix");
-  m_handles[UFourToThree] = getUniform("fourToThree");
-  m_handles[UWPlaneNearFar] = getUniform("wPlaneNearFar");
+  for(int h = 0; h < ENumAttribHandles; h++) {
+    m_handles[h] = getAttrib(s_handleNames[h]);
+  }
+  for(int h = ENumAttribHandles; h < ENumShaderHandles; h++) {
+    m_handles[h] = getUniform(s_handleNames[h]);
+  }
 }
 
 void Shader::SetOrientation(const Mat4f* pOrientation) const {
@@ -95,28 +138,77 @@ void Shader::SetPosition(const Vec4f* pPosition) const {
   glUniform4fv(m_handles[UWorldPosition], 1, pPosition->raw());
 }
 
+void Shader::SetInstanced(bool instanced) const {
+  glUniform1i(m_handles[UInstanced], instanced ? 1 : 0);
+}
+
+void Shader::SetBoneTexture(GLuint textureId) const {
+  if(m_handles[UTexBones] == -1)
+    return;
+  glActiveTexture(GL_TEXTURE0 + c_boneTextureUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, textureId);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(m_handles[UTexBones], c_boneTextureUnit);
+}
+
 void Shader::SetCameraParams(const Camera* pCamera) const {
+  assert(pCamera != NULL && pCamera == s_pBlockCamera);
+  (void)pCamera;
+}
+
+void Shader::UpdateCameraBlock(const Camera* pCamera) {
   assert(pCamera != NULL);
 
-  // This global state with using is error prone
-  //StartUsing();
-  glUniform4fv(m_handles[UCameraPosition], 1,
-      pCamera->getRenderPos().raw());
-  glUniformMatrix4fv(m_handles[UCameraMatrix], 1, GL_TRUE,
-      pCamera->getRenderMatrix().raw());
-  // Sure is weird that this one isn't transposed...
-  // Thinking we are doing inconsistent row/col in the projection creation
-  glUniformMatrix4fv(m_handles[UProjectionMatrix], 1, GL_FALSE,
-      pCamera->_zProjectionMatrix.raw());
-
-  // This isn't even used so far..
-  glUniformMatrix4fv(m_handles[UFourToThree], 1, GL_TRUE,
-      pCamera->_fourToThree.raw());
-  // As the calculation of wNear/wFar is happening manually
-  // Dunno if these param packing things are worthwhile
+  CameraBlock block;
+  const Camera* eyes[2] = { pCamera,
+      (s_pStereoCamera != NULL) ? s_pStereoCamera : pCamera };
+  for(int eye = 0; eye < 2; eye++) {
+    memcpy(block.cameraMatrix[eye], eyes[eye]->getRenderMatrix().raw(),
+        sizeof(block.cameraMatrix[eye]));
+    // Sure is weird that this one isn't transposed...
+    // Thinking we are doing inconsistent row/col in the projection creation
+    memcpy(block.projectionMatrix[eye], eyes[eye]->_zProjectionMatrix.raw(),
+        sizeof(block.projectionMatrix[eye]));
+    memcpy(block.cameraPosition[eye], eyes[eye]->getRenderPos().raw(),
+        sizeof(block.cameraPosition[eye]));
+  }
+  memcpy(block.fourToThree, pCamera->_fourToThree.raw(),
+      sizeof(block.fourToThree));
   Vec4f wPlaneNearFar(pCamera->_wNear, pCamera->_wFar, pCamera->_wScreenSizeRatio, 0.0f);
-  glUniform4fv(m_handles[UWPlaneNearFar], 1, wPlaneNearFar.raw());
-  //StopUsing();
+  memcpy(block.wPlaneNearFar, wPlaneNearFar.raw(),
+      sizeof(block.wPlaneNearFar));
+  Vec4f stereo((s_pStereoCamera != NULL) ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f);
+  memcpy(block.stereo, stereo.raw(), sizeof(block.stereo));
+
+  s_pBlockCamera = pCamera;
+  static CameraBlock s_lastBlock;
+  if(s_cameraBlockId == 0) {
+    glGenBuffers(1, &s_cameraBlockId);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_cameraBlockId);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), &block, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, c_cameraBlockBinding, s_cameraBlockId);
+  } else if(memcmp(&block, &s_lastBlock, sizeof(CameraBlock)) != 0) {
+    glBindBuffer(GL_UNIFORM_BUFFER, s_cameraBlockId);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  } else {
+    return;
+  }
+  s_lastBlock = block;
+  WasGLErrorPlusPrint();
+}
+
+void Shader::ReleaseCameraBlock() {
+  if(s_cameraBlockId != 0) {
+    glDeleteBuffers(1, &s_cameraBlockId);
+    s_cameraBlockId = 0;
+  }
+  s_pBlockCamera = NULL;
+}
+
+void Shader::SetStereoCamera(const Camera* pRightCamera) {
+  s_pStereoCamera = pRightCamera;
 }
 
 GLint Shader::GetColorHandle() const {
@@ -197,32 +289,217 @@ bool Shader::FinishProgram(const char* refName) {
     return false;
   }
 
+  uint64_t cacheKey = GetBinaryCacheKey();
+  if(s_useBinaryCache && LoadProgramBinary(programId, cacheKey)) {
+    s_binaryCacheHits++;
+  } else {
+    if(!CompileAndLink(programId, refName)) {
+      glDeleteProgram(programId);
+      return false;
+    }
+    s_binaryCacheMisses++;
+    if(s_useBinaryCache) {
+      SaveProgramBinary(programId, cacheKey);
+    }
+  }
+
+  // not part of the binary, so after either path
+  // only programs linked with cvCommonTransform have the block
+  GLuint cameraBlockIndex = glGetUniformBlockIndex(programId, "CameraBlock");
+  if(cameraBlockIndex != GL_INVALID_INDEX) {
+    glUniformBlockBinding(programId, cameraBlockIndex, c_cameraBlockBinding);
+  }
+
+  m_programId = programId;
+  //m_attribs = handle_hash_create();
+  //m_uniforms = handle_hash_create();
+
+  StartUsing();
+  InitHandles();
+  StopUsing();
+
+  return true;
+}
+
+bool Shader::CompileAndLink(GLuint programId, const char* refName) {
+  for(size_t sub = m_subShaders.size(); sub < m_subShaderSources.size(); sub++) {
+    const char* filename = m_subShaderNames[sub].first.c_str();
+    GLuint shaderId = glCreateShader(m_subShaderNames[sub].second);
+    if(shaderId == 0)
+      return false;
+
+    const char* bufferString = m_subShaderSources[sub].c_str();
+    glShaderSource(shaderId, 1, (const GLchar**)&(bufferString), NULL);
+    glCompileShader(shaderId);
+
+    if(!CheckGLShaderCompileStatus(shaderId, filename)) {
+      glDeleteShader(shaderId);
+      return false;
+    }
+    m_subShaders.push_back(shaderId);
+  }
+
   for (auto shaderId : m_subShaders) {
     glAttachShader(programId, shaderId);
   }
 
+  // harmless for names the shader doesn't declare
+  glBindAttribLocation(programId, ALocVertPosition, "vertPosition");
+  glBindAttribLocation(programId, ALocVertColor, "vertColor");
+  glBindAttribLocation(programId, ALocVertCoord, "vertCoord");
+  glBindAttribLocation(programId, ALocVertBoneIndex, "vertBoneIndex");
+  glBindAttribLocation(programId, ALocVertPacked, "vertPacked");
+  glBindAttribLocation(programId, ALocInstWorldPosition, "instWorldPosition");
+  glBindAttribLocation(programId, ALocInstWorldMatrix, "instWorldMatrix");
+  glBindAttribLocation(programId, ALocVertClip, "vertClip");
+
+  if(!m_feedbackVaryings.empty()) {
+    std::vector<const char*> varyingNames;
+    for(const auto& varying : m_feedbackVaryings) {
+      varyingNames.push_back(varying.c_str());
+    }
+    glTransformFeedbackVaryings(programId, (GLsizei)varyingNames.size(),
+        &varyingNames[0], GL_INTERLEAVED_ATTRIBS);
+  }
+
+  if(GLEW_ARB_get_program_binary) {
+    glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
   glLinkProgram(programId);
 
   for (auto shaderId : m_subShaders) {
     glDetachShader(programId, shaderId);
   }
 
-  if(!CheckGLShaderLinkStatus(programId, refName)) {
-    glDeleteProgram(programId);
-    return false;
+  return CheckGLShaderLinkStatus(programId, refName);
+}
+
+// the same gl build, vendor and card, as binaries don't travel
+const std::string& Shader::GetDriverString() {
+  static std::string driver;
+  if(driver.empty()) {
+    const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for(auto name : names) {
+      const char* value = (const char*)glGetString(name);
+      driver += (value) ? value : "?";
+      driver += '|';
+    }
   }
+  return driver;
+}
 
-  m_programId = programId;
-  //m_attribs = handle_hash_create();
-  //m_uniforms = handle_hash_create();
+// 64 bit fnv-1a, sources are small and this is once per program
+uint64_t Shader::HashBinaryCacheKey(const std::string& driver,
+    const TSubShaderNames& names, const TSubShaderSources& sources,
+    const TFeedbackVaryings& varyings) {
+  uint64_t hash = 14695981039346656037ULL;
+  auto hashBytes = [&hash](const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t b = 0; b < size; b++) {
+      hash ^= bytes[b];
+      hash *= 1099511628211ULL;
+    }
+  };
+  hashBytes(&c_binaryCacheVersion, sizeof(c_binaryCacheVersion));
+  hashBytes(driver.data(), driver.size());
+  for(size_t sub = 0; sub < sources.size(); sub++) {
+    GLenum type = names[sub].second;
+    hashBytes(&type, sizeof(type));
+    uint64_t length = sources[sub].size();
+    hashBytes(&length, sizeof(length));
+    hashBytes(sources[sub].data(), sources[sub].size());
+  }
+  for(const auto& varying : varyings) {
+    // the terminator keeps "ab","c" from matching "a","bc"
+    hashBytes(varying.c_str(), varying.size() + 1);
+  }
+  return hash;
+}
 
-  StartUsing();
-  InitCameraParamHandles();
-  StopUsing();
+uint64_t Shader::GetBinaryCacheKey() const {
+  return HashBinaryCacheKey(GetDriverString(),
+      m_subShaderNames, m_subShaderSources, m_feedbackVaryings);
+}
+
+std::string Shader::GetBinaryCacheFileName(uint64_t cacheKey) const {
+  char keyString[32];
+  snprintf(keyString, sizeof(keyString), "%016llx",
+      (unsigned long long)cacheKey);
+  return s_binaryCacheDir + "/" + keyString + ".bin";
+}
 
+bool Shader::LoadProgramBinary(GLuint programId, uint64_t cacheKey) const {
+  if(!GLEW_ARB_get_program_binary)
+    return false;
+
+  std::string fileName = GetBinaryCacheFileName(cacheKey);
+  std::vector<unsigned char> buffer;
+  if(!fd_file_to_vec(fileName.c_str(), buffer)
+      || buffer.size() < sizeof(ProgramBinaryHeader)) {
+    return false;
+  }
+  ProgramBinaryHeader header;
+  memcpy(&header, &buffer[0], sizeof(header));
+  if(header.magic != c_binaryCacheMagic
+      || header.version != c_binaryCacheVersion
+      || header.key != cacheKey
+      || header.length != buffer.size() - sizeof(header)) {
+    return false;
+  }
+
+  glProgramBinary(programId, header.format,
+      &buffer[sizeof(header)], header.length);
+  GLint linkSuccess = GL_FALSE;
+  glGetProgramiv(programId, GL_LINK_STATUS, &linkSuccess);
+  if(linkSuccess != GL_TRUE) {
+    // the driver can still refuse, e.g. after an update that kept the string
+    printf("Stale program binary %s, compiling\n", fileName.c_str());
+    glGetError(); // glProgramBinary may have flagged one
+    return false;
+  }
   return true;
 }
 
+void Shader::SaveProgramBinary(GLuint programId, uint64_t cacheKey) const {
+  if(!GLEW_ARB_get_program_binary)
+    return;
+
+  GLint length = 0;
+  glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+  if(length <= 0)
+    return;
+
+  std::vector<unsigned char> buffer(sizeof(ProgramBinaryHeader) + length);
+  GLenum format = 0;
+  GLsizei written = 0;
+  glGetProgramBinary(programId, length, &written, &format,
+      &buffer[sizeof(ProgramBinaryHeader)]);
+  if(WasGLErrorPlusPrint() || written != length)
+    return;
+
+  ProgramBinaryHeader header;
+  header.magic = c_binaryCacheMagic;
+  header.version = c_binaryCacheVersion;
+  header.key = cacheKey;
+  header.format = format;
+  header.length = (uint32_t)length;
+  memcpy(&buffer[0], &header, sizeof(header));
+
+  std::string fileName = GetBinaryCacheFileName(cacheKey);
+  if(!Platform::MakeDirectory(s_binaryCacheDir.c_str())
+      || !fd_file_write_vec(fileName.c_str(), buffer)) {
+    printf("Couldn't write program binary %s\n", fileName.c_str());
+  }
+}
+
+void Shader::PrintBinaryCacheStats() {
+  printf("Program binary cache: %d loaded, %d compiled%s\n",
+      s_binaryCacheHits, s_binaryCacheMisses,
+      (!s_useBinaryCache) ? " (disabled)"
+          : (GLEW_ARB_get_program_binary ? "" : " (unsupported)"));
+}
+
 bool Shader::LoadFromFile(const char* refName,
     const char* vertexFile, const char* pixelFile) {
   if(!AddSubShader(vertexFile, GL_VERTEX_SHADER))
@@ -282,6 +559,11 @@ bool Shader::AddDynamicMeshCommonSubShaders() {
   return AddSubShader("data/cvCommonTransform.glsl", GL_VERTEX_SHADER);
 }
 
+void Shader::SetFeedbackVaryings(const char* const* names, int numNames) {
+  m_feedbackVaryings.assign(names, names + numNames);
+}
+
+// compiling waits for FinishProgram, which can skip it
 bool Shader::AddSubShader(const char* filename, GLenum shaderType) {
   std::string buffer;
   if(!fd_file_to_string(filename, buffer))
@@ -290,21 +572,7 @@ bool Shader::AddSubShader(const char* filename, GLenum shaderType) {
     return false;
   }
 
-  GLuint shaderId = glCreateShader(shaderType);
-  if(shaderId == 0)
-    return false;
-
-  const char* bufferString = buffer.c_str();
-  glShaderSource(shaderId, 1, (const GLchar**)&(bufferString), NULL);
-  // glShaderSource(shaderId, 1, (const GLchar* const*)&(bufferString), NULL);
-  glCompileShader(shaderId);
-
-  if(!CheckGLShaderCompileStatus(shaderId, filename)) {
-    glDeleteShader(shaderId);
-    return false;
-  }
-
-  m_subShaders.push_back(shaderId);
+  m_subShaderSources.push_back(buffer);
   m_subShaderNames.push_back(std::make_pair(std::string(filename), shaderType));
 
   return true;
@@ -497,6 +765,40 @@ bool Shader::RunTests() {
   //assert(Shader::s_test_shader_refs == startingShaderRefs);
   //shader_hash_destroy(pTestHash);
 
+  // a handle added to the enum without a name would be silently null here
+  for(int h = 0; h < ENumShaderHandles; h++) {
+    if(s_handleNames[h] == NULL) {
+      printf("Shader handle %d has no name\n", h);
+      return false;
+    }
+  }
+
+  // the binary cache key has to move with any source, varying or driver change
+  TSubShaderNames names;
+  names.push_back(std::make_pair(std::string("v"), (GLenum)GL_VERTEX_SHADER));
+  names.push_back(std::make_pair(std::string("f"), (GLenum)GL_FRAGMENT_SHADER));
+  TSubShaderSources sources;
+  sources.push_back("void main() {}");
+  sources.push_back("void main() {}");
+  TFeedbackVaryings varyings;
+  uint64_t key = HashBinaryCacheKey("driver", names, sources, varyings);
+  if(key != HashBinaryCacheKey("driver", names, sources, varyings)
+      || key == HashBinaryCacheKey("driver2", names, sources, varyings)) {
+    printf("Shader binary cache key ignores the driver\n");
+    return false;
+  }
+  varyings.push_back("captured");
+  if(key == HashBinaryCacheKey("driver", names, sources, varyings)) {
+    printf("Shader binary cache key ignores the feedback varyings\n");
+    return false;
+  }
+  varyings.clear();
+  sources[1] += " ";
+  if(key == HashBinaryCacheKey("driver", names, sources, varyings)) {
+    printf("Shader binary cache key ignores the source\n");
+    return false;
+  }
+
   return true;
 }
 
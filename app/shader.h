@@ -6,6 +6,7 @@
 
 //#include "../stb/stb.h"
 #include <GL/glew.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -31,6 +32,13 @@ namespace fd {
 
     typedef std::vector<std::pair<std::string, GLenum>> TSubShaderNames;
     TSubShaderNames m_subShaderNames;
+    // read by AddSubShader, only compiled if the binary cache misses
+    typedef std::vector<std::string> TSubShaderSources;
+    TSubShaderSources m_subShaderSources;
+    // captured interleaved in this order by transform feedback, kept
+    // through Reload
+    typedef std::vector<std::string> TFeedbackVaryings;
+    TFeedbackVaryings m_feedbackVaryings;
 
     GLuint m_programId;
     GLenum m_shaderType;
@@ -41,48 +49,117 @@ namespace fd {
     typedef std::unordered_map<std::string, Shader*> ShaderHash;
     static ShaderHash s_shaderhash;
 
+    static GLuint s_cameraBlockId;
+    static const Camera* s_pStereoCamera; // right eye, not owned
+    static const Camera* s_pBlockCamera; // last UpdateCameraBlock, not owned
+
+    static int s_binaryCacheHits;
+    static int s_binaryCacheMisses;
+
   public:
-    // because msvc can't do constexpr quite right, must update cpp
-    // names if you change these in InitCameraParamHandles
+    // Every handle the render code wants, looked up once at link time so
+    // nothing per frame goes through the driver's string lookups.
+    // because msvc can't do constexpr quite right, must update the names
+    // in s_handleNames in the cpp if you change these
     enum shaderHandleEnum {
       // attribs
       AVertPosition,
       AVertColor,
+      AVertCoord,
       AVertBoneIndex,
+      AVertPacked,
+      ENumAttribHandles,
 
       // uniforms, per object
-      UWorldMatrix,
+      UWorldMatrix = ENumAttribHandles,
       UWorldPosition,
       UTexDiffuse0,
+      UTexBlocks,
+      UInstanced,
 
       // uniforms, skinning, per object
-      UBoneRotations,
-      UBonePositions,
-
-      // uniforms, camera
-      UCameraPosition,
-      UCameraMatrix,
+      UTexBones,
+
+      // uniforms, per pass
+      USliceRange,
+      UTexDepth,
+      UTexSolid,
+      UTexOverdraw,
+      UTexOitAccum,
+      UTexOitWeight,
+      USliceRanges,
+      USliceLayers,
+      UTexLayers,
+      ULayerBlend,
+
+      // uniforms, ui only, everything else gets it from the CameraBlock
       UProjectionMatrix,
-      UFourToThree,
-      UWPlaneNearFar,
 
       // accounting
-      ENumCameraShaderHandles,
+      ENumShaderHandles,
+    };
+    GLint m_handles[ENumShaderHandles];
+    static const char* s_handleNames[ENumShaderHandles];
+
+    // std140 mirror of CameraBlock in cvCommonTransform.glsl, shared by
+    // every program through one uniform buffer instead of per program uniforms.
+    // Eye 1 only matters for single pass stereo, see SetStereoCamera.
+    struct CameraBlock {
+      float cameraMatrix[2][16]; // row_major in the shader
+      float projectionMatrix[2][16];
+      float fourToThree[16]; // row_major in the shader
+      float cameraPosition[2][4];
+      float wPlaneNearFar[4]; // wNear in x, wFar in y, wFarToNearSizeRatio in z
+      float stereo[4]; // 1 in x when both eyes go side by side
+    };
+    static const GLuint c_cameraBlockBinding = 0;
+
+    // Attribute slots are bound before linking so a single VAO works with
+    // any of the shaders instead of needing one per program.
+    enum attribLocationEnum {
+      ALocVertPosition = 0, // has to stay 0 for the glVertex* paths
+      ALocVertColor,
+      ALocVertCoord,
+      ALocVertBoneIndex,
+      ALocVertPacked, // a QuaxolVert as is, glVertexAttribIPointer
+      ALocInstWorldPosition, // per instance, see MeshBuffer::DrawInstanced
+      ALocInstWorldMatrix, // a mat4 eats 4 slots
+      ALocInstWorldMatrixEnd = ALocInstWorldMatrix + 3,
+      ALocVertClip, // a gl_ClipDistance[0] that came out of transform feedback
+
+      ENumAttribLocations,
     };
-    GLint m_handles[ENumCameraShaderHandles];
 
   public:
     Shader();
     ~Shader();
 
-    void InitCameraParamHandles();
-    void SetCameraParams(const Camera* pCamera) const; // const but gl side effects...
+    void InitHandles();
+    // Render fills the camera block once per view, this only asserts the
+    // draw is for the camera it was filled with
+    void SetCameraParams(const Camera* pCamera) const;
+    // once per camera or eye, from Render, skips the upload if nothing changed
+    static void UpdateCameraBlock(const Camera* pCamera);
+    static void ReleaseCameraBlock();
+    // Non-null turns on single pass stereo: the camera block gets this as
+    // the right eye and every draw is instanced once per eye so the vertex
+    // shader can pick one. Needs a double wide target and GL_CLIP_DISTANCE0.
+    static void SetStereoCamera(const Camera* pRightCamera);
+    static const Camera* GetStereoCamera() { return s_pStereoCamera; }
+    static int GetViewCount() { return (s_pStereoCamera != NULL) ? 2 : 1; }
     void SetOrientation(const Mat4f* pOrientation) const;
     void SetPosition(const Vec4f* pPosition) const;
+    void SetInstanced(bool instanced) const; // world transform from attribs instead
+    // a MeshBuffer's m_bonesTextureId, on a unit of its own so it doesn't
+    // fight the queue's per entity textures
+    void SetBoneTexture(GLuint textureId) const;
+    static const int c_boneTextureUnit = 7;
     GLint GetColorHandle() const;
 
     bool AddDynamicMeshCommonSubShaders();
     bool AddSubShader(const char* filename, GLenum shaderType);
+    // before LoadFromFile, as they have to be set before linking
+    void SetFeedbackVaryings(const char* const* names, int numNames);
     bool LoadFromFileDerivedNames(const char* refName);
     bool LoadFromFile(const char* refName, const char* vertexFile, const char* pixelFile);
     void Release();
@@ -95,12 +172,20 @@ namespace fd {
     GLint getProgramId() const { return m_programId; }
     GLint getAttrib(const char* name) const;
     GLint getUniform(const char* name) const;
+    // -1 if the shader doesn't use it, same as the gl calls
+    GLint getHandle(shaderHandleEnum handle) const { return m_handles[handle]; }
 
     static bool CheckGLShaderCompileStatus(
         GLuint shaderId, const char* filename);
     static bool CheckGLShaderLinkStatus(
         GLuint programId, const char* refName);
 
+    // Linked programs are kept on disk keyed by their source and the driver,
+    // so startup and shader cycling skip the compile when nothing changed.
+    static bool s_useBinaryCache;
+    static std::string s_binaryCacheDir;
+    static void PrintBinaryCacheStats();
+
     static void ClearShaderHash();
     static Shader* GetShaderByRefName(const std::string& refName);
     //static Shader* GetShaderByRefName(const char* refName);
@@ -108,6 +193,15 @@ namespace fd {
 
   protected:
     bool FinishProgram(const char* refName);
+    bool CompileAndLink(GLuint programId, const char* refName);
+    uint64_t GetBinaryCacheKey() const;
+    std::string GetBinaryCacheFileName(uint64_t cacheKey) const;
+    bool LoadProgramBinary(GLuint programId, uint64_t cacheKey) const;
+    void SaveProgramBinary(GLuint programId, uint64_t cacheKey) const;
+    static const std::string& GetDriverString();
+    static uint64_t HashBinaryCacheKey(const std::string& driver,
+        const TSubShaderNames& names, const TSubShaderSources& sources,
+        const TFeedbackVaryings& varyings);
     void AddToShaderHash();
     void RemoveFromShaderHash();
 
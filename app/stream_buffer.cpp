@@ -0,0 +1,155 @@
+#include "stream_buffer.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "glhelper.h"
+
+namespace fd {
+
+// a second is long enough that it's a hang, not a slow frame
+static const GLuint64 c_fenceTimeoutNs = 1000000000;
+
+StreamBuffer::StreamBuffer()
+    : m_bufferId(0)
+    , m_sectionSize(0)
+    , m_section(0)
+    , m_cursor(0)
+    , m_mapped(NULL)
+    , m_stalls(0) {
+  for (int s = 0; s < c_numSections; s++) {
+    m_fences[s] = NULL;
+  }
+}
+
+StreamBuffer::~StreamBuffer() {
+  Release();
+}
+
+bool StreamBuffer::Initialize(GLsizeiptr sectionSize) {
+  Release();
+  return CreateStorage(sectionSize);
+}
+
+void StreamBuffer::Release() {
+  DeleteStorage();
+  for (int s = 0; s < c_numSections; s++) {
+    if (m_fences[s]) {
+      glDeleteSync(m_fences[s]);
+      m_fences[s] = NULL;
+    }
+  }
+}
+
+bool StreamBuffer::CreateStorage(GLsizeiptr sectionSize) {
+  GLsizeiptr totalSize = sectionSize * c_numSections;
+  glGenBuffers(1, &m_bufferId);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_bufferId);
+  if (GLEW_ARB_buffer_storage) {
+    const GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, NULL, flags);
+    m_mapped = (unsigned char*)glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, totalSize, flags);
+    if (!m_mapped) {
+      printf("StreamBuffer couldn't map %d bytes persistently\n", (int)totalSize);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+      glDeleteBuffers(1, &m_bufferId);
+      m_bufferId = 0;
+      return false;
+    }
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  m_sectionSize = sectionSize;
+  m_cursor = m_section * m_sectionSize;
+  return !WasGLErrorPlusPrint();
+}
+
+void StreamBuffer::DeleteStorage() {
+  if (m_bufferId == 0) return;
+  if (m_mapped) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_bufferId);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_mapped = NULL;
+  }
+  // draws already queued keep the old storage alive until they're done
+  glDeleteBuffers(1, &m_bufferId);
+  m_bufferId = 0;
+}
+
+void StreamBuffer::NextFrame() {
+  if (m_bufferId == 0) return;
+
+  if (m_fences[m_section]) {
+    glDeleteSync(m_fences[m_section]);
+  }
+  m_fences[m_section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  m_section = (m_section + 1) % c_numSections;
+  m_cursor = m_section * m_sectionSize;
+  GLsync fence = m_fences[m_section];
+  if (!fence) return;
+
+  GLenum result = glClientWaitSync(fence, 0, 0);
+  if (result == GL_TIMEOUT_EXPIRED) {
+    ++m_stalls;
+    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, c_fenceTimeoutNs);
+    if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED) {
+      printf("StreamBuffer gave up waiting on the gpu\n");
+    }
+  }
+  glDeleteSync(fence);
+  m_fences[m_section] = NULL;
+}
+
+bool StreamBuffer::Reserve(GLsizeiptr size) {
+  if (m_bufferId != 0 && GetUsed() + size <= m_sectionSize) {
+    return false;
+  }
+  // the old storage is still being drawn from this frame and the ones in
+  // flight, so start over in a new buffer rather than wait on any of it
+  GLsizeiptr newSize = (std::max)(m_sectionSize * 2, GetUsed() + size);
+  DeleteStorage();
+  for (int s = 0; s < c_numSections; s++) {
+    if (m_fences[s]) {
+      glDeleteSync(m_fences[s]);
+      m_fences[s] = NULL;
+    }
+  }
+  printf("StreamBuffer growing to %d bytes a section\n", (int)newSize);
+  m_section = 0;
+  return CreateStorage(newSize);
+}
+
+GLintptr StreamBuffer::Write(const void* data, GLsizeiptr size, GLsizeiptr alignment) {
+  GLintptr offset = ((m_cursor + alignment - 1) / alignment) * alignment;
+  GLintptr sectionEnd = (m_section + 1) * m_sectionSize;
+  if (m_bufferId == 0 || offset + size > sectionEnd) {
+    return -1;
+  }
+
+  if (m_mapped) {
+    memcpy(m_mapped + offset, data, size);
+  } else {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_bufferId);
+    void* pRange = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if (pRange) {
+      memcpy(pRange, data, size);
+      glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (!pRange) {
+      return -1;
+    }
+  }
+  m_cursor = offset + size;
+  return offset;
+}
+
+} // namespace fd
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <GL/glew.h>
+
+namespace fd {
+
+// A buffer that gets fresh contents every frame without being respecified.
+// It's split into c_numSections, one per frame in flight, and each section
+// is fenced when the frame moves past it, so the cpu only waits if the gpu
+// has fallen a whole ring behind. With ARB_buffer_storage it's mapped once,
+// persistent and coherent, otherwise each write maps just its own range
+// unsynchronized, which the fences keep safe all the same.
+// Everything goes through GL_COPY_WRITE_BUFFER so no vao's element binding
+// gets stepped on, callers bind GetBufferId() wherever they draw from it.
+class StreamBuffer {
+public:
+  static const int c_numSections = 3;
+
+  StreamBuffer();
+  ~StreamBuffer();
+
+  bool Initialize(GLsizeiptr sectionSize);
+  void Release();
+
+  // done with the current section, moves on to the next, waiting for the
+  // gpu if it's still reading it
+  void NextFrame();
+  // makes sure this much more fits in the current section. If it grows,
+  // the buffer is replaced and returns true, so anything pointing at the
+  // old id (vao attribs) needs setting up again.
+  bool Reserve(GLsizeiptr size);
+  // copies in at the next multiple of alignment from the buffer's start,
+  // returns that offset, or -1 if it didn't fit
+  GLintptr Write(const void* data, GLsizeiptr size, GLsizeiptr alignment);
+
+  GLuint GetBufferId() const { return m_bufferId; }
+  GLsizeiptr GetSectionSize() const { return m_sectionSize; }
+  bool IsPersistent() const { return m_mapped != NULL; }
+  // bytes written into the current section so far
+  GLsizeiptr GetUsed() const { return m_cursor - (m_section * m_sectionSize); }
+  // times NextFrame had to wait on the gpu
+  int GetStalls() const { return m_stalls; }
+
+protected:
+  bool CreateStorage(GLsizeiptr sectionSize);
+  void DeleteStorage();
+
+  GLuint m_bufferId;
+  GLsizeiptr m_sectionSize;
+  int m_section;
+  GLintptr m_cursor; // from the start of the whole buffer
+  unsigned char* m_mapped; // persistent mapping, NULL if there isn't one
+  GLsync m_fences[c_numSections];
+  int m_stalls;
+};
+
+} // namespace fd
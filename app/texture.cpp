@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <string.h>
+
 #include "glhelper.h"
 #include "texture.h"
 #include "../common/fourmath.h"
@@ -34,28 +37,7 @@ namespace fd {
     m_width = static_cast<GLsizei>(width);
     m_height = static_cast<GLsizei>(height);
 
-    m_format = 0;
-    m_internal_format = 0;
-
-    switch (channels) {
-    case 1:
-      m_format = GL_LUMINANCE;
-      m_internal_format = m_format;
-      break;
-    case 2:
-      m_format = GL_LUMINANCE_ALPHA;
-      m_internal_format = m_format;
-      break;
-    case 3:
-      m_format = GL_RGB;
-      m_internal_format = GL_SRGB;
-      break;
-    case 4:
-      m_format = GL_RGBA;
-      m_internal_format = GL_SRGB_ALPHA;
-      break;
-    default:
-      printf("Texture had unexpected number of channels: %d\n", channels);
+    if (!SetFormatFromChannels(channels)) {
       stbi_image_free(data);
       return false;
     }
@@ -94,6 +76,168 @@ namespace fd {
     return true;
   }
 
+  bool Texture::LoadArrayFromAtlas(const char* filename, int tilesPerSide,
+      int layersPerRow, int numLayers) {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    unsigned char* data = stbi_load(filename, &width, &height, &channels, 0);
+
+    if (data == NULL) {
+      return false;
+    }
+
+    int layerRows = (numLayers + layersPerRow - 1) / layersPerRow;
+    if (tilesPerSide <= 0 || layersPerRow > tilesPerSide || layerRows > tilesPerSide
+        || (width % tilesPerSide) != 0 || (height % tilesPerSide) != 0) {
+      printf("Atlas %s %dx%d doesn't fit %d layers of a %d tile grid\n",
+          filename, width, height, numLayers, tilesPerSide);
+      stbi_image_free(data);
+      return false;
+    }
+
+    if (!SetFormatFromChannels(channels)) {
+      stbi_image_free(data);
+      return false;
+    }
+    m_width = static_cast<GLsizei>(width / tilesPerSide);
+    m_height = static_cast<GLsizei>(height / tilesPerSide);
+
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture_id);
+    // unsized like the 2d atlas got from gluBuild2DMipmaps, so it looks the same
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0 /* level */, m_format,
+        m_width, m_height, numLayers, 0 /* border */,
+        m_format, GL_UNSIGNED_BYTE, NULL);
+
+    // pick each tile straight out of the decoded atlas
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+    for (int layer = 0; layer < numLayers; layer++) {
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS, (layer % layersPerRow) * m_width);
+      glPixelStorei(GL_UNPACK_SKIP_ROWS, (layer / layersPerRow) * m_height);
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0 /* level */, 0, 0, layer,
+          m_width, m_height, 1, m_format, GL_UNSIGNED_BYTE, data);
+    }
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    stbi_image_free(data);
+
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (WasGLErrorPlusPrint()) {
+      glDeleteTextures(1, &m_texture_id);
+      m_texture_id = -1;
+      return false;
+    }
+
+    AddToTextureCache(this);
+    return true;
+  }
+
+  bool Texture::SetFormatFromChannels(int channels) {
+    m_format = 0;
+    m_internal_format = 0;
+
+    switch (channels) {
+    case 1:
+      m_format = GL_LUMINANCE;
+      m_internal_format = m_format;
+      break;
+    case 2:
+      m_format = GL_LUMINANCE_ALPHA;
+      m_internal_format = m_format;
+      break;
+    case 3:
+      m_format = GL_RGB;
+      m_internal_format = GL_SRGB;
+      break;
+    case 4:
+      m_format = GL_RGBA;
+      m_internal_format = GL_SRGB_ALPHA;
+      break;
+    default:
+      printf("Texture had unexpected number of channels: %d\n", channels);
+      return false;
+    }
+    return true;
+  }
+
+  bool Texture::CreateFromLevels(int width, int height, int channels,
+      const TLevelList& levels, GLuint pixelBuffer) {
+    if (levels.empty() || !SetFormatFromChannels(channels)) {
+      return false;
+    }
+    m_width = static_cast<GLsizei>(width);
+    m_height = static_cast<GLsizei>(height);
+
+    size_t totalSize = 0;
+    for (const auto& level : levels) {
+      totalSize += level.size();
+    }
+
+    // copy everything into the pbo in one go, the driver can then take
+    // its time getting it over while the next image gets decoded
+    const unsigned char* pixelBase = NULL;
+    if (pixelBuffer != 0) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+      // orphans whatever the last texture was still using
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+      unsigned char* mapped = (unsigned char*)glMapBufferRange(
+          GL_PIXEL_UNPACK_BUFFER, 0, totalSize,
+          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      if (mapped) {
+        size_t offset = 0;
+        for (const auto& level : levels) {
+          memcpy(mapped + offset, level.data(), level.size());
+          offset += level.size();
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      } else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pixelBuffer = 0;
+      }
+    }
+
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_texture_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // small mips of rgb aren't 4 byte rows
+    size_t offset = 0;
+    for (size_t l = 0; l < levels.size(); l++) {
+      int levelWidth = (std::max)(1, width >> (int)l);
+      int levelHeight = (std::max)(1, height >> (int)l);
+      const GLvoid* pixels = (pixelBuffer != 0)
+          ? (const GLvoid*)(pixelBase + offset) : levels[l].data();
+      // channels as the internal format, same as gluBuild2DMipmaps gave
+      glTexImage2D(GL_TEXTURE_2D, (GLint)l, channels,
+          levelWidth, levelHeight, 0 /* border */,
+          m_format, GL_UNSIGNED_BYTE, pixels);
+      offset += levels[l].size();
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (pixelBuffer != 0) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    if (WasGLErrorPlusPrint()) {
+      glDeleteTextures(1, &m_texture_id);
+      m_texture_id = -1;
+      return false;
+    }
+
+    AddToTextureCache(this);
+    return true;
+  }
+
   bool Texture::CreateColorTarget(int sizeX, int sizeY) {
     glGenTextures(1, &m_texture_id);
     glBindTexture(GL_TEXTURE_2D, m_texture_id);
@@ -137,6 +281,51 @@ namespace fd {
     return !WasGLErrorPlusPrint();
   }
 
+  bool Texture::CreateFloatTarget(int sizeX, int sizeY,
+      GLenum internalFormat, GLenum format) {
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_texture_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    m_width = sizeX;
+    m_height = sizeY;
+    m_format = format;
+    m_internal_format = internalFormat;
+
+    glTexImage2D(GL_TEXTURE_2D, 0 /* level */,
+          m_internal_format, m_width, m_height, 0 /* border */,
+          m_format, GL_FLOAT, NULL /*data*/);
+    glGenFramebuffers(1, &m_framebuffer_id);
+
+    return !WasGLErrorPlusPrint();
+  }
+
+  bool Texture::CreateArrayTarget(int sizeX, int sizeY, int layers,
+      GLenum internalFormat, GLenum format, GLenum type) {
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture_id);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    m_width = sizeX;
+    m_height = sizeY;
+    m_format = format;
+    m_internal_format = internalFormat;
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0 /* level */,
+          m_internal_format, m_width, m_height, layers, 0 /* border */,
+          m_format, type, NULL /*data*/);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glGenFramebuffers(1, &m_framebuffer_id);
+
+    return !WasGLErrorPlusPrint();
+  }
+
   bool Texture::CreateFrameBuffer() { //int sizeX, int sizeY) {
     glGenFramebuffers(1, &m_framebuffer_id);
     return !WasGLErrorPlusPrint();
@@ -9,6 +9,7 @@ namespace fd {
 
   class Texture;
   typedef std::vector<Texture*> TTextureList;
+  typedef std::vector<std::vector<unsigned char>> TLevelList;
   typedef std::set<Texture*> TTextureSet;
 
   class Texture {
@@ -28,8 +29,23 @@ namespace fd {
     ~Texture();
 
     bool LoadFromFile(const char* filename);
+    // Cuts a grid atlas into a GL_TEXTURE_2D_ARRAY, one layer per tile so
+    // each gets its own mips and nothing bleeds over from the neighbours.
+    // Layer n is column n % layersPerRow, row n / layersPerRow.
+    bool LoadArrayFromAtlas(const char* filename, int tilesPerSide,
+        int layersPerRow, int numLayers);
+    // Already decoded, level 0 first and each one half the last, tightly
+    // packed. Staged through pixelBuffer unless it's 0. See TextureLoader.
+    bool CreateFromLevels(int width, int height, int channels,
+        const TLevelList& levels, GLuint pixelBuffer);
     bool CreateColorTarget(int sizeX, int sizeY);
     bool CreateDepthTarget(int sizeX, int sizeY);
+    // linear, unclamped, for targets that accumulate
+    bool CreateFloatTarget(int sizeX, int sizeY, GLenum internalFormat, GLenum format);
+    // GL_TEXTURE_2D_ARRAY, attach with glFramebufferTexture so gl_Layer
+    // can pick which layer each primitive lands in
+    bool CreateArrayTarget(int sizeX, int sizeY, int layers,
+        GLenum internalFormat, GLenum format, GLenum type);
     bool CreateFrameBuffer();
     bool CreateRenderBuffers(int sizeX, int sizeY);
     void Release();
@@ -41,6 +57,7 @@ namespace fd {
 
   protected:
     static void AddToTextureCache(Texture* pTexture);
+    bool SetFormatFromChannels(int channels);
   };
 
 }; // namespace fd
@@ -0,0 +1,192 @@
+#include "texture_loader.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "glhelper.h"
+#include "../common/timer.h"
+#include "../common/worker_pool.h"
+#include "../stb/stb_image.h" // implementation is in texture.cpp
+
+namespace fd {
+
+bool TextureLoader::DecodeFile(Image& image) {
+  Timer decodeTimer;
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  unsigned char* data = stbi_load(
+      image.m_filename.c_str(), &width, &height, &channels, 0);
+  if (data == NULL) {
+    return false;
+  }
+  image.m_width = width;
+  image.m_height = height;
+  image.m_channels = channels;
+  image.m_levels.resize(1);
+  image.m_levels[0].assign(data, data + (width * height * channels));
+  stbi_image_free(data);
+  image.m_decodeTime = decodeTimer.GetElapsed();
+
+  Timer mipTimer;
+  BuildMips(image);
+  image.m_mipTime = mipTimer.GetElapsed();
+  return true;
+}
+
+void TextureLoader::BuildMips(Image& image) {
+  image.m_levels.resize(1);
+  int channels = image.m_channels;
+  int width = image.m_width;
+  int height = image.m_height;
+  while (width > 1 || height > 1) {
+    int nextWidth = (std::max)(1, width / 2);
+    int nextHeight = (std::max)(1, height / 2);
+    image.m_levels.push_back(
+        std::vector<unsigned char>(nextWidth * nextHeight * channels));
+    // after the push_back, as it can move the earlier levels
+    const unsigned char* src = image.m_levels[image.m_levels.size() - 2].data();
+    unsigned char* dest = image.m_levels.back().data();
+
+    // odd sizes just clamp, the last row or column gets counted twice
+    for (int y = 0; y < nextHeight; y++) {
+      int y0 = (std::min)(y * 2, height - 1);
+      int y1 = (std::min)(y * 2 + 1, height - 1);
+      for (int x = 0; x < nextWidth; x++) {
+        int x0 = (std::min)(x * 2, width - 1);
+        int x1 = (std::min)(x * 2 + 1, width - 1);
+        for (int c = 0; c < channels; c++) {
+          int sum = src[(y0 * width + x0) * channels + c]
+              + src[(y0 * width + x1) * channels + c]
+              + src[(y1 * width + x0) * channels + c]
+              + src[(y1 * width + x1) * channels + c];
+          dest[(y * nextWidth + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+        }
+      }
+    }
+    width = nextWidth;
+    height = nextHeight;
+  }
+}
+
+bool TextureLoader::LoadFiles(const std::vector<std::string>& fileNames,
+    TTextureList& outTextures) {
+  Timer wallTimer;
+  int numFiles = (int)fileNames.size();
+  outTextures.assign(numFiles, NULL);
+  if (numFiles == 0) return true;
+
+  std::vector<Image> images(numFiles);
+  for (int f = 0; f < numFiles; f++) {
+    images[f].m_filename = fileNames[f];
+  }
+
+  // workers decode a file per job, the finished list is what this thread
+  // uploads as they come in
+  std::mutex finishedMutex;
+  std::condition_variable finishedCondition;
+  std::vector<std::pair<int, bool>> finished;
+
+  WorkerPool& workers = WorkerPool::GetShared();
+  workers.Start(numFiles, [&](int f) {
+    bool decoded = DecodeFile(images[f]);
+    std::lock_guard<std::mutex> lock(finishedMutex);
+    finished.push_back(std::make_pair(f, decoded));
+    finishedCondition.notify_one();
+  });
+  if (workers.GetNumWorkers() == 0) {
+    // a single core, decode it all here and then upload
+    workers.Finish();
+  }
+
+  GLuint pixelBuffer = 0;
+  glGenBuffers(1, &pixelBuffer);
+  WasGLErrorPlusPrint();
+
+  bool success = true;
+  double uploadTime = 0.0;
+  for (int uploaded = 0; uploaded < numFiles; uploaded++) {
+    std::pair<int, bool> done;
+    {
+      std::unique_lock<std::mutex> lock(finishedMutex);
+      finishedCondition.wait(lock, [&]() { return !finished.empty(); });
+      done = finished.front();
+      finished.erase(finished.begin());
+    }
+    Image& image = images[done.first];
+    if (!done.second) {
+      printf("Couldn't decode texture %s\n", image.m_filename.c_str());
+      success = false;
+      continue;
+    }
+
+    Timer uploadTimer;
+    std::unique_ptr<Texture> texture(new Texture());
+    if (texture->CreateFromLevels(image.m_width, image.m_height,
+        image.m_channels, image.m_levels, pixelBuffer)) {
+      outTextures[done.first] = texture.release();
+    } else {
+      printf("Couldn't upload texture %s\n", image.m_filename.c_str());
+      success = false;
+    }
+    uploadTime += uploadTimer.GetElapsed();
+    // the upload has its own copy now
+    TLevelList().swap(image.m_levels);
+  }
+
+  workers.Finish();
+  glDeleteBuffers(1, &pixelBuffer);
+
+  // the startup breakdown, compare wall against the serial sum
+  double decodeTime = 0.0;
+  double mipTime = 0.0;
+  for (const auto& image : images) {
+    printf("  %s %dx%dx%d decode %.1fms mips %.1fms\n",
+        image.m_filename.c_str(), image.m_width, image.m_height,
+        image.m_channels, image.m_decodeTime * 1000.0, image.m_mipTime * 1000.0);
+    decodeTime += image.m_decodeTime;
+    mipTime += image.m_mipTime;
+  }
+  printf("Loaded %d textures on %d workers in %.1fms: decode %.1fms"
+      " + mips %.1fms on workers, upload %.1fms here\n",
+      numFiles, workers.GetNumWorkers(), wallTimer.GetElapsed() * 1000.0,
+      decodeTime * 1000.0, mipTime * 1000.0, uploadTime * 1000.0);
+
+  return success;
+}
+
+bool TextureLoader::RunTests() {
+  // 3x2 rgb, odd on purpose
+  Image image;
+  image.m_width = 3;
+  image.m_height = 2;
+  image.m_channels = 3;
+  image.m_levels.resize(1);
+  const unsigned char pixels[] = {
+    0, 0, 0,    4, 8, 12,     100, 100, 100,
+    8, 16, 24,  12, 24, 36,   100, 100, 100,
+  };
+  image.m_levels[0].assign(pixels, pixels + sizeof(pixels));
+  BuildMips(image);
+
+  if (image.m_levels.size() != 2 || image.m_levels[1].size() != 3) {
+    printf("TextureLoader mip chain is the wrong shape: %d levels\n",
+        (int)image.m_levels.size());
+    return false;
+  }
+  // average of the top left 2x2
+  if (image.m_levels[1][0] != 6 || image.m_levels[1][1] != 12
+      || image.m_levels[1][2] != 18) {
+    printf("TextureLoader mip average is off: %d %d %d\n",
+        image.m_levels[1][0], image.m_levels[1][1], image.m_levels[1][2]);
+    return false;
+  }
+  return true;
+}
+
+} // namespace fd
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "texture.h"
+
+namespace fd {
+
+// Loads a batch of image files at once. Decoding and the mip chain happen on
+// the shared WorkerPool's threads, and each image is uploaded through a pixel buffer object
+// on the calling thread, which has to own the gl context, as soon as it's
+// ready instead of after the rest.
+class TextureLoader {
+public:
+  struct Image {
+    std::string m_filename;
+    int m_width;
+    int m_height;
+    int m_channels;
+    TLevelList m_levels; // level 0 first, down to 1x1
+    double m_decodeTime; // seconds, on the worker
+    double m_mipTime;
+
+    Image() : m_width(0), m_height(0), m_channels(0)
+        , m_decodeTime(0.0), m_mipTime(0.0) {}
+  };
+
+  // outTextures gets one entry per file name, NULL where it failed.
+  // They go in the texture cache like LoadFromFile's do.
+  // Returns false if any failed.
+  static bool LoadFiles(const std::vector<std::string>& fileNames,
+      TTextureList& outTextures);
+
+  // box filters level 0 down to 1x1, like gluBuild2DMipmaps
+  static void BuildMips(Image& image);
+
+  static bool RunTests();
+
+protected:
+  static bool DecodeFile(Image& image);
+};
+
+} // namespace fd
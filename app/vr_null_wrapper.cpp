@@ -0,0 +1,408 @@
+// A headset that isn't there. Renders each eye offscreen at whatever size
+// it's told, follows a scripted head pose, and runs frames against a fake
+// display clock so missed compositor deadlines can be counted on a build box
+// without any vr runtime installed.
+#include "vr_wrapper.h"
+
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+#include "glhelper.h"
+#include "texture.h"
+#ifdef WIN32
+#include "win32_platform.h"
+#else
+#include "linux_platform.h"
+#endif
+#include "../common/camera.h"
+#include "../common/fourmath.h"
+#include "../common/misc_defs.h"
+#include "../common/timer.h"
+#include "../common/tweak.h"
+
+namespace fd {
+
+class NullVRWrapper : public VRWrapper {
+public:
+  struct PoseKey {
+    float m_time;
+    float m_yaw; // degrees
+    float m_pitch;
+    float m_roll;
+    float m_position[3];
+  };
+  typedef std::vector<PoseKey> PoseTrack;
+
+  NullVRSettings m_settings;
+  PlatformWindow* m_pWindow;
+  Texture* m_eyeColor[2]; // owned, each has its own fbo with m_eyeDepth on it
+  Texture* m_eyeDepth[2];
+  PoseTrack m_poseTrack;
+  Pose4f m_hmdPose;
+
+  // the simulated display, vsync n happens at n / refresh since m_clock started
+  Timer m_clock;
+  double m_vsyncInterval;
+  long long m_targetVsync; // the refresh the current frame is aiming for
+  double m_frameStart;
+  double m_lastReport;
+  FrameStats m_stats;
+
+  NullVRWrapper(const NullVRSettings& settings)
+    : m_settings(settings)
+    , m_pWindow(NULL)
+    , m_vsyncInterval(1.0 / 90.0)
+    , m_targetVsync(0)
+    , m_frameStart(0.0)
+    , m_lastReport(0.0) {
+    m_eyeColor[0] = m_eyeColor[1] = NULL;
+    m_eyeDepth[0] = m_eyeDepth[1] = NULL;
+    m_hmdPose.storeIdentity();
+  }
+
+  virtual ~NullVRWrapper() {
+    PrintStats();
+    for(int eye = 0; eye < 2; eye++) {
+      DEL_NULL(m_eyeColor[eye]);
+      DEL_NULL(m_eyeDepth[eye]);
+    }
+  }
+
+  virtual bool Initialize() {
+    if(m_settings.m_eyeWidth <= 0 || m_settings.m_eyeHeight <= 0
+        || m_settings.m_refreshRate <= 0.0f) {
+      printf("null vr: bad settings %dx%d @ %f\n", m_settings.m_eyeWidth,
+          m_settings.m_eyeHeight, m_settings.m_refreshRate);
+      return false;
+    }
+    m_vsyncInterval = 1.0 / (double)m_settings.m_refreshRate;
+    if(!m_settings.m_poseTrackFile.empty()
+        && !LoadPoseTrack(m_settings.m_poseTrackFile.c_str())) {
+      return false;
+    }
+    s_Initialized = true;
+    return true;
+  }
+
+  // The gl context doesn't exist yet at CreateNullVR time.
+  virtual bool InitializeWindow(PlatformWindow* pWindow, float pixelScale) {
+    m_pWindow = pWindow;
+    for(int eye = 0; eye < 2; eye++) {
+      if(!CreateEyeTarget(eye)) {
+        return false;
+      }
+    }
+    printf("null vr: %dx%d per eye at %.1fhz, %s pose track\n",
+        m_settings.m_eyeWidth, m_settings.m_eyeHeight,
+        m_settings.m_refreshRate,
+        m_poseTrack.empty() ? "built in" : m_settings.m_poseTrackFile.c_str());
+    m_clock.Start();
+    return true;
+  }
+
+  bool CreateEyeTarget(int eye) {
+    std::unique_ptr<Texture> color(new Texture());
+    if(!color->CreateColorTarget(m_settings.m_eyeWidth, m_settings.m_eyeHeight))
+      return false;
+    std::unique_ptr<Texture> depth(new Texture());
+    if(!depth->CreateDepthTarget(m_settings.m_eyeWidth, m_settings.m_eyeHeight))
+      return false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, color->m_framebuffer_id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D, color->GetTextureID(), 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_TEXTURE_2D, depth->GetTextureID(), 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+      printf("null vr: eye %d framebuffer not ready: %d\n", eye, status);
+      return false;
+    }
+
+    m_eyeColor[eye] = color.release();
+    m_eyeDepth[eye] = depth.release();
+    return !WasGLErrorPlusPrint();
+  }
+
+  bool LoadPoseTrack(const char* fileName) {
+    FILE* file = fopen(fileName, "r");
+    if(!file) {
+      printf("null vr: couldn't open pose track %s\n", fileName);
+      return false;
+    }
+    char line[256];
+    int lineNumber = 0;
+    while(fgets(line, sizeof(line), file)) {
+      lineNumber++;
+      if(line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+      PoseKey key;
+      if(sscanf(line, "%f %f %f %f %f %f %f", &key.m_time,
+          &key.m_yaw, &key.m_pitch, &key.m_roll, &key.m_position[0],
+          &key.m_position[1], &key.m_position[2]) != 7) {
+        printf("null vr: %s:%d wants \"time yaw pitch roll x y z\"\n",
+            fileName, lineNumber);
+        continue;
+      }
+      if(!m_poseTrack.empty() && key.m_time <= m_poseTrack.back().m_time) {
+        printf("null vr: %s:%d time doesn't increase\n", fileName, lineNumber);
+        continue;
+      }
+      m_poseTrack.push_back(key);
+    }
+    fclose(file);
+    if(m_poseTrack.empty()) {
+      printf("null vr: no poses in %s\n", fileName);
+      return false;
+    }
+    return true;
+  }
+
+  // looped, lerped between keys
+  PoseKey SamplePoseTrack(double time) const {
+    PoseKey out;
+    if(m_poseTrack.empty()) {
+      // a slow look around so the view actually changes
+      double t = time * 2.0 * PI;
+      out.m_time = (float)time;
+      out.m_yaw = 35.0f * (float)sin(t / 9.0);
+      out.m_pitch = 12.0f * (float)sin(t / 5.5);
+      out.m_roll = 0.0f;
+      out.m_position[0] = 0.0f;
+      out.m_position[1] = 0.02f * (float)sin(t / 3.0);
+      out.m_position[2] = 0.0f;
+      return out;
+    }
+    const PoseKey& last = m_poseTrack.back();
+    if(m_poseTrack.size() == 1 || last.m_time <= 0.0f) {
+      return last;
+    }
+    float loopTime = (float)fmod(time, (double)last.m_time);
+    size_t next = 1;
+    while(next < m_poseTrack.size() - 1 && m_poseTrack[next].m_time < loopTime) {
+      next++;
+    }
+    const PoseKey& a = m_poseTrack[next - 1];
+    const PoseKey& b = m_poseTrack[next];
+    float t = (loopTime - a.m_time) / (b.m_time - a.m_time);
+    t = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+    out.m_time = loopTime;
+    out.m_yaw = a.m_yaw + (b.m_yaw - a.m_yaw) * t;
+    out.m_pitch = a.m_pitch + (b.m_pitch - a.m_pitch) * t;
+    out.m_roll = a.m_roll + (b.m_roll - a.m_roll) * t;
+    for(int i = 0; i < 3; i++) {
+      out.m_position[i] = a.m_position[i] + (b.m_position[i] - a.m_position[i]) * t;
+    }
+    return out;
+  }
+
+  void UpdateHeadPose(double displayTime) {
+    PoseKey key = SamplePoseTrack(displayTime);
+    const float toRadians = (float)PI / 180.0f;
+    Mat4f yaw;
+    Mat4f pitch;
+    Mat4f roll;
+    yaw.storeRotation(key.m_yaw * toRadians, 0, 2);
+    pitch.storeRotation(key.m_pitch * toRadians, 1, 2);
+    roll.storeRotation(key.m_roll * toRadians, 0, 1);
+    m_hmdPose.rotation = yaw * pitch * roll;
+    m_hmdPose.position = Vec4f(
+        key.m_position[0], key.m_position[1], key.m_position[2], 0.0f);
+  }
+
+  // same composition as the openvr one, the eye is just half the ipd over
+  void UpdateCameraRenderMatrix(int eye, Camera* pCamera) {
+    Pose4f matEyeToHead;
+    matEyeToHead.storeIdentity();
+    matEyeToHead.position.x = (eye == 0 ? -0.5f : 0.5f) * m_settings.m_ipd;
+    Pose4f matRoomCameraEye = matEyeToHead * m_hmdPose;
+    pCamera->UpdateRenderMatrix(&matRoomCameraEye);
+    pCamera->SetZProjection(m_settings.m_eyeWidth, m_settings.m_eyeHeight,
+        pCamera->_zFov, pCamera->_zNear, pCamera->_zFar);
+  }
+
+  virtual void StartFrame() {
+    double now = m_clock.GetElapsed();
+    if(m_targetVsync == 0) {
+      m_targetVsync = (long long)(now / m_vsyncInterval) + 1;
+    }
+    m_frameStart = now;
+    // like a real runtime, predict the pose for when this frame is shown
+    UpdateHeadPose(m_targetVsync * m_vsyncInterval);
+  }
+
+  void StartEye(int eye, Camera* pCamera,
+      Texture** outRenderColor, Texture** outRenderDepth) {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_eyeColor[eye]->m_framebuffer_id);
+    glViewport(0, 0, m_settings.m_eyeWidth, m_settings.m_eyeHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    UpdateCameraRenderMatrix(eye, pCamera);
+    if(outRenderColor) {
+      *outRenderColor = m_eyeColor[eye];
+    }
+    if(outRenderDepth) {
+      *outRenderDepth = m_eyeDepth[eye];
+    }
+    WasGLErrorPlusPrint();
+  }
+
+  virtual void StartLeftEye(
+    Camera* pCamera, Texture** outRenderColor, Texture** outRenderDepth) {
+    StartEye(0, pCamera, outRenderColor, outRenderDepth);
+  }
+
+  virtual void FinishLeftEye(
+    Camera* pCamera, Texture** outRenderColor, Texture** outRenderDepth) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  virtual void StartRightEye(
+    Camera* pCamera, Texture** outRenderColor, Texture** outRenderDepth) {
+    StartEye(1, pCamera, outRenderColor, outRenderDepth);
+  }
+
+  virtual void FinishRightEye(
+    Camera* pCamera, Texture** outRenderColor, Texture** outRenderDepth) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  virtual bool StartStereo(Camera* pLeftCamera, Camera* pRightCamera,
+    Texture** outRenderColor, Texture** outRenderDepth) {
+    if(!m_stereoColor && !CreateStereoTargets(
+        m_settings.m_eyeWidth, m_settings.m_eyeHeight)) {
+      return false;
+    }
+    pRightCamera->CopyViewFrom(*pLeftCamera);
+    UpdateCameraRenderMatrix(0, pLeftCamera);
+    UpdateCameraRenderMatrix(1, pRightCamera);
+
+    BindStereoTargets(outRenderColor, outRenderDepth);
+    return true;
+  }
+
+  virtual void FinishStereo(Camera* pLeftCamera, Camera* pRightCamera) {
+    ResolveStereoTargets(m_eyeColor[0]->m_framebuffer_id,
+        m_eyeColor[1]->m_framebuffer_id);
+  }
+
+  virtual void FinishFrame() {
+    // stand in for the compositor, show both eyes in the window
+    if(m_pWindow) {
+      int windowWidth;
+      int windowHeight;
+      m_pWindow->GetWidthHeight(&windowWidth, &windowHeight);
+      int halfWidth = windowWidth / 2;
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+      for(int eye = 0; eye < 2; eye++) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_eyeColor[eye]->m_framebuffer_id);
+        glBlitFramebuffer(0, 0, m_settings.m_eyeWidth, m_settings.m_eyeHeight,
+            eye * halfWidth, 0, (eye + 1) * halfWidth, windowHeight,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
+      }
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+      glViewport(0, 0, windowWidth, windowHeight);
+    }
+    WasGLErrorPlusPrint();
+
+    // without this only the cpu side would ever be late
+    static TweakVariable tweakWaitForGpu("vr.null.waitForGpu", true);
+    if(tweakWaitForGpu.AsBool()) {
+      glFinish();
+    }
+
+    double now = m_clock.GetElapsed();
+    double frameTime = now - m_frameStart;
+    double margin = m_settings.m_compositorMargin;
+    long long shownVsync = m_targetVsync;
+    if(now > shownVsync * m_vsyncInterval - margin) {
+      // late, the display repeats the old frame until the next one we make
+      shownVsync = (long long)ceil((now + margin) / m_vsyncInterval);
+      m_stats.m_missedFrames++;
+      m_stats.m_missedVsyncs += (int)(shownVsync - m_targetVsync);
+    }
+    m_stats.m_frames++;
+    m_stats.m_totalFrameTime += frameTime;
+    if(frameTime > m_stats.m_worstFrameTime) {
+      m_stats.m_worstFrameTime = frameTime;
+    }
+
+    // the compositor holds the app until the frame is on screen
+    double wait = shownVsync * m_vsyncInterval - m_clock.GetElapsed();
+    if(wait > 0.0) {
+      Platform::ThreadSleep((unsigned long)(wait * 1000.0));
+    }
+    m_targetVsync = shownVsync + 1;
+
+    if(now - m_lastReport > 5.0) {
+      PrintStats();
+      m_lastReport = now;
+    }
+  }
+
+  void PrintStats() const {
+    if(m_stats.m_frames == 0) return;
+    printf("null vr: %d frames, %d missed (%.1f%%), %d vsyncs dropped,"
+        " avg %.2fms worst %.2fms, budget %.2fms\n",
+        m_stats.m_frames, m_stats.m_missedFrames,
+        100.0 * m_stats.m_missedFrames / m_stats.m_frames,
+        m_stats.m_missedVsyncs,
+        1000.0 * m_stats.m_totalFrameTime / m_stats.m_frames,
+        1000.0 * m_stats.m_worstFrameTime,
+        1000.0 * (m_vsyncInterval - m_settings.m_compositorMargin));
+  }
+
+  virtual bool GetFrameStats(FrameStats& outStats) const {
+    outStats = m_stats;
+    return true;
+  }
+
+  virtual std::string GetDeviceName() { return std::string("null"); }
+  virtual bool GetIsDebugDevice() { return true; }
+
+  virtual void SetIsUsingVR(bool usingVR) {
+    if (!s_Initialized) return;
+    if (s_UsingVR == usingVR) return;
+
+    if (s_UsingVR) {
+      s_UsingVR = false;
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      if(m_pWindow) {
+        int restoreWidth;
+        int restoreHeight;
+        m_pWindow->GetWidthHeight(&restoreWidth, &restoreHeight);
+        glViewport(0, 0, restoreWidth, restoreHeight);
+      }
+    }
+    else {
+      s_UsingVR = true;
+    }
+  }
+
+  virtual bool GetPerEyeRenderSize(int& width, int& height) const {
+    width = m_settings.m_eyeWidth;
+    height = m_settings.m_eyeHeight;
+    return true;
+  }
+
+  virtual bool GetTotalRenderSize(int& width, int& height) const {
+    width = m_settings.m_eyeWidth * 2;
+    height = m_settings.m_eyeHeight;
+    return true;
+  }
+
+  ALIGNED_ALLOC_NEW_DEL_OVERRIDE
+};
+
+VRWrapper* VRWrapper::CreateNullVR(const NullVRSettings& settings) {
+  std::unique_ptr<NullVRWrapper> vrWrapper(new NullVRWrapper(settings));
+
+  if(!vrWrapper->Initialize()) {
+    return NULL;
+  }
+
+  return vrWrapper.release();
+}
+
+} // namespace fd
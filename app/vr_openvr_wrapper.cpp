@@ -4,6 +4,7 @@
 
 #include <openvr.h>
 #include <memory>
+#include <string.h>
 
 #include "texture.h"
 
@@ -17,7 +18,9 @@
 #include "shader.h"
 #include "win32_platform.h"
 #include "../common/camera.h"
+#include "../common/fd_simple_file.h"
 #include "../common/fourmath.h"
+#include "../common/timer.h"
 #include "../common/tweak.h"
 
 // hmm not great
@@ -101,6 +104,12 @@ namespace fd {
         delete model;
       }
       m_vecRenderModels.clear();
+      for (auto& pending : m_pendingRenderModels) {
+        if (pending.m_pModel) {
+          vr::VRRenderModels()->FreeRenderModel(pending.m_pModel);
+        }
+      }
+      m_pendingRenderModels.clear();
       delete m_lensShader;
 
       if(m_glIDVertBuffer) {
@@ -140,23 +149,37 @@ namespace fd {
       Vec2f texCoordGreen;
       Vec2f texCoordBlue;
     };
+
+    static constexpr const char* c_distortionCacheDir = "data/vrcache";
+    static const uint32_t c_distortionCacheMagic = 0x64766466; // 'fdvd'
+    // bump if VertexDataLens or the grid layout changes
+    static const uint32_t c_distortionCacheVersion = 1;
+
+    struct DistortionCacheHeader {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t key;
+      uint32_t numVerts;
+      uint32_t pad;
+    };
     
+    static const int c_lensGridSegments = 43;
+
     // Pulled nearly directly from openvr sample
-    void SetupDistortion()
+    // ComputeDistortion goes back to the runtime for every vertex, which was
+    // most of the startup, so that part comes from ComputeDistortionVerts
+    // only when the disk cache misses.
+    void ComputeDistortionVerts(std::vector<VertexDataLens>& vVerts)
     {
-      if (!m_HMD)
-        return;
-      WasGLErrorPlusPrint();
-
-      GLushort m_iLensGridSegmentCountH = 43;
-      GLushort m_iLensGridSegmentCountV = 43;
+      GLushort m_iLensGridSegmentCountH = c_lensGridSegments;
+      GLushort m_iLensGridSegmentCountV = c_lensGridSegments;
 
       float w = (float)(1.0 / float(m_iLensGridSegmentCountH - 1));
       float h = (float)(1.0 / float(m_iLensGridSegmentCountV - 1));
 
       float u, v = 0;
 
-      std::vector<VertexDataLens> vVerts(0);
+      vVerts.resize(0);
       VertexDataLens vert;
 
       //left eye distortion verts
@@ -196,6 +219,97 @@ namespace fd {
           vVerts.push_back(vert);
         }
       }
+    }
+
+    // Lens calibration is per unit, not just per model, so the serial
+    // goes in the key alongside the model and eye size.
+    std::string GetDistortionCacheKey() {
+      char size[64];
+      snprintf(size, sizeof(size), "|%ux%u|%d", m_eyeRenderWidth,
+          m_eyeRenderHeight, c_lensGridSegments);
+      return GetTrackedDeviceString(m_HMD, vr::k_unTrackedDeviceIndex_Hmd,
+          vr::Prop_ModelNumber_String) + "|"
+          + GetTrackedDeviceString(m_HMD, vr::k_unTrackedDeviceIndex_Hmd,
+          vr::Prop_SerialNumber_String) + size;
+    }
+
+    static uint64_t HashDistortionCacheKey(const std::string& key) {
+      uint64_t hash = 14695981039346656037ULL;
+      for (size_t c = 0; c < key.size(); c++) {
+        hash ^= (unsigned char)key[c];
+        hash *= 1099511628211ULL;
+      }
+      return hash;
+    }
+
+    std::string GetDistortionCacheFileName(uint64_t cacheKey) {
+      char keyString[32];
+      snprintf(keyString, sizeof(keyString), "%016llx",
+          (unsigned long long)cacheKey);
+      return std::string(c_distortionCacheDir) + "/distortion_" + keyString + ".bin";
+    }
+
+    bool LoadDistortionCache(uint64_t cacheKey, std::vector<VertexDataLens>& vVerts) {
+      std::string fileName = GetDistortionCacheFileName(cacheKey);
+      std::vector<unsigned char> buffer;
+      if (!fd_file_to_vec(fileName.c_str(), buffer)
+          || buffer.size() < sizeof(DistortionCacheHeader)) {
+        return false;
+      }
+      DistortionCacheHeader header;
+      memcpy(&header, &buffer[0], sizeof(header));
+      size_t expectedVerts = 2 * c_lensGridSegments * c_lensGridSegments;
+      if (header.magic != c_distortionCacheMagic
+          || header.version != c_distortionCacheVersion
+          || header.key != cacheKey
+          || header.numVerts != expectedVerts
+          || buffer.size() != sizeof(header) + expectedVerts * sizeof(VertexDataLens)) {
+        printf("Stale distortion cache %s, recomputing\n", fileName.c_str());
+        return false;
+      }
+      vVerts.resize(expectedVerts);
+      memcpy(&vVerts[0], &buffer[sizeof(header)], expectedVerts * sizeof(VertexDataLens));
+      return true;
+    }
+
+    void SaveDistortionCache(uint64_t cacheKey, const std::vector<VertexDataLens>& vVerts) {
+      DistortionCacheHeader header = {};
+      header.magic = c_distortionCacheMagic;
+      header.version = c_distortionCacheVersion;
+      header.key = cacheKey;
+      header.numVerts = (uint32_t)vVerts.size();
+      std::vector<unsigned char> buffer(sizeof(header) + vVerts.size() * sizeof(VertexDataLens));
+      memcpy(&buffer[0], &header, sizeof(header));
+      memcpy(&buffer[sizeof(header)], &vVerts[0], vVerts.size() * sizeof(VertexDataLens));
+
+      std::string fileName = GetDistortionCacheFileName(cacheKey);
+      if (!Platform::MakeDirectory(c_distortionCacheDir)
+          || !fd_file_write_vec(fileName.c_str(), buffer)) {
+        printf("Couldn't write distortion cache %s\n", fileName.c_str());
+      }
+    }
+
+    void SetupDistortion()
+    {
+      if (!m_HMD)
+        return;
+      WasGLErrorPlusPrint();
+
+      GLushort m_iLensGridSegmentCountH = c_lensGridSegments;
+      GLushort m_iLensGridSegmentCountV = c_lensGridSegments;
+
+      std::vector<VertexDataLens> vVerts;
+      std::string cacheKeyString = GetDistortionCacheKey();
+      uint64_t cacheKey = HashDistortionCacheKey(cacheKeyString);
+      if (LoadDistortionCache(cacheKey, vVerts)) {
+        printf("Distortion mesh loaded from cache for %s\n", cacheKeyString.c_str());
+      } else {
+        Timer computeTimer;
+        ComputeDistortionVerts(vVerts);
+        printf("Distortion mesh computed in %.1fms for %s\n",
+            computeTimer.GetElapsed() * 1000.0, cacheKeyString.c_str());
+        SaveDistortionCache(cacheKey, vVerts);
+      }
 
       std::vector<GLushort> vIndices;
       GLushort a, b, c, d;
@@ -356,63 +470,99 @@ namespace fd {
     CGLRenderModel* m_rTrackedDeviceToRenderModel[vr::k_unMaxTrackedDeviceCount];
     bool m_rbShowTrackedDevice[vr::k_unMaxTrackedDeviceCount];
 
-    CGLRenderModel* FindOrLoadRenderModel(const char *pchRenderModelName) {
+    // Render models and their textures come off the runtime's own loader
+    // threads. They're polled once a frame rather than waited on, so a
+    // device turning up mid game shows its model a few frames late instead
+    // of stalling the frame and the compositor submit behind it.
+    struct PendingRenderModel {
+      std::string m_name;
+      vr::RenderModel_t* m_pModel = NULL; // once the geometry is in
+      std::vector<vr::TrackedDeviceIndex_t> m_devices; // waiting on it
+    };
+    std::vector<PendingRenderModel> m_pendingRenderModels;
+
+    CGLRenderModel* FindRenderModel(const char *pchRenderModelName) {
       for(auto model : m_vecRenderModels) {
         if (!_stricmp(model->GetName().c_str(), pchRenderModelName))
           return model;
       }
+      return NULL;
+    }
 
-
-      CGLRenderModel *pRenderModel = NULL;
-      vr::RenderModel_t *pModel;
-      vr::EVRRenderModelError error;
-      while (1)
-      {
-        error = vr::VRRenderModels()->LoadRenderModel_Async(pchRenderModelName, &pModel);
-        if (error != vr::VRRenderModelError_Loading)
-          break;
-
-        Platform::ThreadSleep(1);
+    void QueueRenderModel(const char *pchRenderModelName,
+        vr::TrackedDeviceIndex_t unTrackedDeviceIndex) {
+      for (auto& pending : m_pendingRenderModels) {
+        if (!_stricmp(pending.m_name.c_str(), pchRenderModelName)) {
+          pending.m_devices.push_back(unTrackedDeviceIndex);
+          return;
+        }
       }
+      PendingRenderModel pending;
+      pending.m_name = pchRenderModelName;
+      pending.m_devices.push_back(unTrackedDeviceIndex);
+      m_pendingRenderModels.push_back(pending);
+    }
 
-      if (error != vr::VRRenderModelError_None)
+    // true once it's done with, loaded or not
+    bool StepRenderModelLoad(PendingRenderModel& pending) {
+      vr::EVRRenderModelError error;
+      if (!pending.m_pModel)
       {
-        printf("Unable to load render model %s - %s\n", pchRenderModelName, vr::VRRenderModels()->GetRenderModelErrorNameFromEnum(error));
-        return NULL; // move on to the next tracked device
+        error = vr::VRRenderModels()->LoadRenderModel_Async(pending.m_name.c_str(), &pending.m_pModel);
+        if (error == vr::VRRenderModelError_Loading)
+        {
+          pending.m_pModel = NULL;
+          return false;
+        }
+        if (error != vr::VRRenderModelError_None)
+        {
+          printf("Unable to load render model %s - %s\n", pending.m_name.c_str(), vr::VRRenderModels()->GetRenderModelErrorNameFromEnum(error));
+          pending.m_pModel = NULL;
+          return true;
+        }
       }
 
-      vr::RenderModel_TextureMap_t *pTexture;
-      while (1)
-      {
-        error = vr::VRRenderModels()->LoadTexture_Async(pModel->diffuseTextureId, &pTexture);
-        if (error != vr::VRRenderModelError_Loading)
-          break;
-
-        Platform::ThreadSleep(1);
-      }
+      vr::RenderModel_TextureMap_t *pTexture = NULL;
+      error = vr::VRRenderModels()->LoadTexture_Async(pending.m_pModel->diffuseTextureId, &pTexture);
+      if (error == vr::VRRenderModelError_Loading)
+        return false;
 
       if (error != vr::VRRenderModelError_None)
       {
-        printf("Unable to load render texture id:%d for render model %s\n", pModel->diffuseTextureId, pchRenderModelName);
-        vr::VRRenderModels()->FreeRenderModel(pModel);
-        return NULL; // move on to the next tracked device
+        printf("Unable to load render texture id:%d for render model %s\n", pending.m_pModel->diffuseTextureId, pending.m_name.c_str());
+        vr::VRRenderModels()->FreeRenderModel(pending.m_pModel);
+        pending.m_pModel = NULL;
+        return true;
       }
 
-      pRenderModel = new CGLRenderModel(pchRenderModelName);
-      if (!pRenderModel->BInit(*pModel, *pTexture))
+      CGLRenderModel* pRenderModel = new CGLRenderModel(pending.m_name);
+      if (!pRenderModel->BInit(*pending.m_pModel, *pTexture))
       {
-        printf("Unable to create GL model from render model %s\n", pchRenderModelName);
+        printf("Unable to create GL model from render model %s\n", pending.m_name.c_str());
         delete pRenderModel;
-        pRenderModel = NULL;
       }
       else
       {
         m_vecRenderModels.push_back(pRenderModel);
+        for (auto device : pending.m_devices) {
+          m_rTrackedDeviceToRenderModel[device] = pRenderModel;
+          m_rbShowTrackedDevice[device] = true;
+        }
       }
-      vr::VRRenderModels()->FreeRenderModel(pModel);
+      vr::VRRenderModels()->FreeRenderModel(pending.m_pModel);
       vr::VRRenderModels()->FreeTexture(pTexture);
+      pending.m_pModel = NULL;
+      return true;
+    }
 
-      return pRenderModel;
+    // at most one gl upload a frame, the rest just check in with the runtime
+    void PollRenderModels() {
+      for (size_t p = 0; p < m_pendingRenderModels.size(); p++) {
+        if (StepRenderModelLoad(m_pendingRenderModels[p])) {
+          m_pendingRenderModels.erase(m_pendingRenderModels.begin() + p);
+          break;
+        }
+      }
     }
 
     std::string GetTrackedDeviceString(
@@ -443,6 +593,7 @@ namespace fd {
       while (m_HMD->PollNextEvent(&event, sizeof(event))) {
         ProcessVREvent(frameTime, event, input_handler);
       }
+      PollRenderModels();
 
       // Process SteamVR controller state
       for (vr::TrackedDeviceIndex_t unDevice = 0; unDevice < vr::k_unMaxTrackedDeviceCount; unDevice++) {
@@ -490,16 +641,14 @@ namespace fd {
       if (unTrackedDeviceIndex >= vr::k_unMaxTrackedDeviceCount)
         return;
 
-      // try to find a model we've already set up
+      // try to find a model we've already set up, otherwise it gets one
+      // once PollRenderModels has it loaded
       std::string sRenderModelName = GetTrackedDeviceString(m_HMD, unTrackedDeviceIndex,
           vr::Prop_RenderModelName_String);
-      CGLRenderModel *pRenderModel = FindOrLoadRenderModel(sRenderModelName.c_str());
+      CGLRenderModel *pRenderModel = FindRenderModel(sRenderModelName.c_str());
       if (!pRenderModel)
       {
-        std::string sTrackingSystemName = GetTrackedDeviceString(m_HMD, unTrackedDeviceIndex, 
-            vr::Prop_TrackingSystemName_String);
-        printf("Unable to load render model for tracked device %d (%s.%s)",
-            unTrackedDeviceIndex, sTrackingSystemName.c_str(), sRenderModelName.c_str());
+        QueueRenderModel(sRenderModelName.c_str(), unTrackedDeviceIndex);
       }
       else
       {
@@ -1020,6 +1169,38 @@ namespace fd {
       FinishEye(eye, outRenderColor, outRenderDepth);
     }
 
+    virtual bool StartStereo(Camera* pLeftCamera, Camera* pRightCamera,
+      Texture** outRenderColor, Texture** outRenderDepth) {
+      if(!m_stereoColor
+          && !CreateStereoTargets(m_eyeRenderWidth, m_eyeRenderHeight)) {
+        return false;
+      }
+      vr::Hmd_Eye leftEye = m_flippedEyes ? vr::Eye_Right : vr::Eye_Left;
+      vr::Hmd_Eye rightEye = m_flippedEyes ? vr::Eye_Left : vr::Eye_Right;
+
+      pRightCamera->CopyViewFrom(*pLeftCamera);
+      UpdateCameraRenderMatrix(leftEye, pLeftCamera);
+      UpdateCameraRenderMatrix(rightEye, pRightCamera);
+
+      BindStereoTargets(outRenderColor, outRenderDepth);
+      return true;
+    }
+
+    virtual void FinishStereo(Camera* pLeftCamera, Camera* pRightCamera) {
+      ResolveStereoTargets(m_eye[vr::Eye_Left].m_framebuffer->m_framebuffer_id,
+          m_eye[vr::Eye_Right].m_framebuffer->m_framebuffer_id);
+
+      // the eye targets have no scene depth, so controllers just go on top
+      for(int e = 0; e < 2; e++) {
+        vr::Hmd_Eye eye = (vr::Hmd_Eye)e;
+        glBindFramebuffer(GL_FRAMEBUFFER, m_eye[eye].m_framebuffer->m_framebuffer_id);
+        glViewport(0, 0, m_eyeRenderWidth, m_eyeRenderHeight);
+        DrawControllerModels(eye);
+        FinishEye(eye, NULL, NULL);
+      }
+      WasGLErrorPlusPrint();
+    }
+
     virtual void FinishFrame() {
       WasGLErrorPlusPrint();
 
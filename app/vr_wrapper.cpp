@@ -1,5 +1,11 @@
 #include "vr_wrapper.h"
 
+#include <memory>
+#include <stdio.h>
+#include "../common/misc_defs.h"
+#include "glhelper.h"
+#include "texture.h"
+
 namespace fd {
 
 bool VRWrapper::s_Initialized = false;
@@ -8,6 +14,73 @@ bool VRWrapper::s_UsingVR = false;
 float VRWrapper::s_screenSaverMoveThreshold = 0.00003f;
 float VRWrapper::s_screenSaverRotateThreshold = 0.0001f;
 
+bool VRWrapper::CreateStereoTargets(int eyeWidth, int eyeHeight) {
+  ReleaseStereoTargets();
+
+  std::unique_ptr<Texture> stereoColor(new Texture());
+  if(!stereoColor->CreateColorTarget(eyeWidth * 2, eyeHeight))
+    return false;
+  std::unique_ptr<Texture> stereoDepth(new Texture());
+  if(!stereoDepth->CreateDepthTarget(eyeWidth * 2, eyeHeight))
+    return false;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, stereoColor->m_framebuffer_id);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, stereoColor->GetTextureID(), 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_TEXTURE_2D, stereoDepth->GetTextureID(), 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if(status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: stereo framebuffer not ready: %d\n", status);
+    return false;
+  }
+
+  m_stereoColor = stereoColor.release();
+  m_stereoDepth = stereoDepth.release();
+  m_stereoEyeWidth = eyeWidth;
+  m_stereoEyeHeight = eyeHeight;
+  return !WasGLErrorPlusPrint();
+}
+
+void VRWrapper::BindStereoTargets(
+    Texture** outRenderColor, Texture** outRenderDepth) {
+  glBindFramebuffer(GL_FRAMEBUFFER, m_stereoColor->m_framebuffer_id);
+  glViewport(0, 0, m_stereoEyeWidth * 2, m_stereoEyeHeight);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  WasGLErrorPlusPrint();
+
+  if(outRenderColor) {
+    *outRenderColor = m_stereoColor;
+  }
+  if(outRenderDepth) {
+    *outRenderDepth = m_stereoDepth;
+  }
+}
+
+void VRWrapper::ResolveStereoTargets(
+    GLuint leftFramebuffer, GLuint rightFramebuffer) {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_stereoColor->m_framebuffer_id);
+  GLuint eyeFramebuffers[2] = { leftFramebuffer, rightFramebuffer };
+  for(int eye = 0; eye < 2; eye++) {
+    int srcX = eye * m_stereoEyeWidth;
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, eyeFramebuffers[eye]);
+    glBlitFramebuffer(srcX, 0, srcX + m_stereoEyeWidth, m_stereoEyeHeight,
+        0, 0, m_stereoEyeWidth, m_stereoEyeHeight,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  WasGLErrorPlusPrint();
+}
+
+void VRWrapper::ReleaseStereoTargets() {
+  DEL_NULL(m_stereoColor);
+  DEL_NULL(m_stereoDepth);
+  m_stereoEyeWidth = 0;
+  m_stereoEyeHeight = 0;
+}
+
 #if !defined(FD_VR_USE_OCULUS) && !defined(FD_VR_USE_OPENVR)
 
 VRWrapper* VRWrapper::CreateVR() {
@@ -7,6 +7,7 @@
 //#define FD_VR_USE_OPENVR
 
 #include <string>
+#include <GL/glew.h>
 #include "platform_interface.h"
 #include "../common/fourmath.h"
 
@@ -24,6 +25,31 @@ public:
   static VRWrapper* CreateVR();
   static bool IsUsingVR() { return s_UsingVR; }
 
+  // No headset at all, renders to offscreen eyes on a simulated display
+  // clock so stereo frame pacing can be benchmarked on any box.
+  // See vr_null_wrapper.cpp.
+  struct NullVRSettings {
+    int m_eyeWidth = 1080;
+    int m_eyeHeight = 1200;
+    float m_refreshRate = 90.0f;
+    float m_compositorMargin = 0.002f; // seconds before vsync a frame is late
+    float m_ipd = 0.064f;
+    // lines of "time yaw pitch roll x y z", degrees, looped
+    // empty gets a built in look around
+    std::string m_poseTrackFile;
+  };
+  static VRWrapper* CreateNullVR(const NullVRSettings& settings);
+
+  struct FrameStats {
+    int m_frames = 0;
+    int m_missedFrames = 0; // frames that weren't done by their deadline
+    int m_missedVsyncs = 0; // display refreshes that repeated an old frame
+    double m_totalFrameTime = 0.0;
+    double m_worstFrameTime = 0.0;
+  };
+  // only filled by backends that track their own deadline
+  virtual bool GetFrameStats(FrameStats& outStats) const { return false; }
+
   // so with glfw, ovr must happen first, then glfw, then ovr window
   virtual bool InitializeWindow(PlatformWindow* pWindow, float pixelScale) { return false; }
 
@@ -38,6 +64,14 @@ public:
     Camera* pCamera, Texture** outRenderColor, Texture** outRenderDepth) {}
   virtual void FinishFrame() {}
 
+  // Single pass stereo, both eyes side by side in one double wide target
+  // that a single RenderAllScenesPerCamera fills. pRightCamera gets a copy
+  // of the view with the right eye applied. Returns false if the backend
+  // can't, then the per eye calls above are the way.
+  virtual bool StartStereo(Camera* pLeftCamera, Camera* pRightCamera,
+    Texture** outRenderColor, Texture** outRenderDepth) { return false; }
+  virtual void FinishStereo(Camera* pLeftCamera, Camera* pRightCamera) {}
+
   virtual void HandleInput(float frameTime, InputHandler* inputHandler) {}
 
   virtual std::string GetDeviceName() { return std::string(""); }
@@ -56,7 +90,7 @@ public:
 
   virtual void SetDebugHeadOrientation(const Mat4f* matrix) {}
 
-  virtual ~VRWrapper() {}
+  virtual ~VRWrapper() { ReleaseStereoTargets(); }
 
 public:
   // nothing like late am deadline coding to add public vars
@@ -71,8 +105,23 @@ protected:
   static bool s_UsingVR;
 
 
-  VRWrapper() {} // prevent direct construction
+  VRWrapper() // prevent direct construction
+    : m_stereoColor(NULL)
+    , m_stereoDepth(NULL)
+    , m_stereoEyeWidth(0)
+    , m_stereoEyeHeight(0) {}
   virtual bool Initialize() = 0;
+
+  // shared bits for backends doing StartStereo
+  Texture* m_stereoColor; // owned, eyes side by side
+  Texture* m_stereoDepth; // owned
+  int m_stereoEyeWidth;
+  int m_stereoEyeHeight;
+  bool CreateStereoTargets(int eyeWidth, int eyeHeight);
+  void BindStereoTargets(Texture** outRenderColor, Texture** outRenderDepth);
+  // copies each half into the eye's framebuffer
+  void ResolveStereoTargets(GLuint leftFramebuffer, GLuint rightFramebuffer);
+  void ReleaseStereoTargets();
 };
 
 }; // namespace fd
@@ -252,6 +252,11 @@ void Platform::ThreadSleep(unsigned long milliseconds) {
   ::Sleep(milliseconds);
 }
 
+bool Platform::MakeDirectory(const char* path) {
+  return (::CreateDirectoryA(path, NULL) != 0)
+      || (::GetLastError() == ERROR_ALREADY_EXISTS);
+}
+
 } // namespace fd
 
 #endif //WIN32
@@ -106,6 +106,26 @@ void Camera::MarkStartingPosition() {
   _startingCameraCopy->_velocity = _velocity;
 }
 
+void Camera::CopyViewFrom(const Camera& source) {
+  _cameraMatrix = source._cameraMatrix;
+  _cameraPos = source._cameraPos;
+  _renderMatrix = source._renderMatrix;
+  _renderPos = source._renderPos;
+  _screenBounds = source._screenBounds;
+  _zProjectionMatrix = source._zProjectionMatrix;
+  _fourToThree = source._fourToThree;
+  _zNear = source._zNear;
+  _zFar = source._zFar;
+  _zFov = source._zFov;
+  _wNear = source._wNear;
+  _wFar = source._wFar;
+  _wScreenSizeRatio = source._wScreenSizeRatio;
+  _wProjectionEnabled = source._wProjectionEnabled;
+  _movement = source._movement;
+  _yawPitchTrans = source._yawPitchTrans;
+  _yawTrans = source._yawTrans;
+}
+
 void Camera::setMovementMode(MovementMode mode) {
   _movement = mode;
   if(_movement != MovementMode::WALK) {
@@ -75,6 +75,8 @@ public:
   }
 
   void MarkStartingPosition();
+  // everything rendering needs, so a second camera can stand in for an eye
+  void CopyViewFrom(const Camera& source);
   void RestartGameState();
 
   void ApplyOrbitInput(float radians, Direction direction);
@@ -62,6 +62,7 @@ void Mesh::getColors(int index, Vec4f& a, Vec4f& b, Vec4f& c) {
 
 // seriously wasteful for our currently only usecase
 void Mesh::fillSolidColors(Vec4f& color) {
+  markDirty();
   _colors.resize(0);
   _colors.reserve(_verts.size());
   _colors.insert(_colors.begin(), _verts.size(), color);
@@ -82,6 +83,7 @@ void Mesh::printIt() {
 }
 
 void Mesh::populateVerts(const Vec4f& min, const Vec4f& max, int dim) {
+  markDirty();
   assert(dim <= 4 && dim >= 2);
   int numVerts = 1 << dim;
   _verts.resize(0);
@@ -102,6 +104,7 @@ void Mesh::populateVerts(const Vec4f& min, const Vec4f& max, int dim) {
 }
 
 void Mesh::populateVerts(float size, int dim, const Vec4f& offset, const Vec4f& numberedSkewStep) {
+  markDirty();
   assert(dim <= 4 && dim >= 2);
   int numVerts = 1 << dim;
   _verts.resize(0);
@@ -130,6 +133,7 @@ void Mesh::addQuad(int a, int b, int c, int d) {
 }
 
 void Mesh::addTri(int a, int b, int c, IndexList& indices) {
+  markDirty();
   indices.push_back(a);
   indices.push_back(b);
   indices.push_back(c);
@@ -248,6 +252,7 @@ void Mesh::buildTesseract(float size, Vec4f offset, Vec4f step) {
 }
 
 void Mesh::buildFourTetrad(float size, Vec4f offset) {
+  markDirty();
   int numVerts = 5;
   _verts.resize(0);
   _verts.reserve(numVerts);
@@ -285,6 +290,7 @@ void Mesh::buildFourTetrad(float size, Vec4f offset) {
 }
 
 void Mesh::buildSphere(float size, Vec4f offset) {
+  markDirty();
   Vec4f localOffset(size, size, size, 0.0f);
   localOffset *= -0.5f; // this makes the first cube centered on the origin
   buildCube(size, offset + localOffset);
@@ -299,6 +305,7 @@ void Mesh::buildSphere(float size, Vec4f offset) {
 }
 
 void Mesh::tesselateByThree() {
+  markDirty();
   size_t numOldTris = _indices.size() / 3; // index list for triangles
   assert(numOldTris * 3 == _indices.size()); // if it's not an index list, like a strip, will have 67% of getting caught here :)
 
@@ -340,6 +347,7 @@ void Mesh::tesselateByThree() {
 }
 
 void Mesh::tesselateBySix() {
+  markDirty();
   size_t numOldTris = _indices.size() / 3; // index list for triangles
   assert(numOldTris * 3 == _indices.size()); // if it's not an index list, like a strip, will have 67% of getting caught here :)
 
@@ -679,6 +687,7 @@ void Mesh::buildShapes(VecList& verts, IndexList& indices, Shapes& outShapes) {
 // More intelligent projections that don't make tons of cubes will require
 // a 4d approach to rendering which would do the equivalent of interior surface removal.
 void Mesh::projectIntoFour(float insideDist, Vec4f numberedSkewStep) {
+  markDirty();
   Vec4f shift(0, 0, 0, insideDist);
   VecList fourVerts;
   fourVerts.resize(_verts.size());
@@ -749,6 +758,7 @@ void Mesh::projectIntoFour(float insideDist, Vec4f numberedSkewStep) {
 }
 
 void Mesh::merge(const Mesh& other) {
+  markDirty();
   int prevIndexCount = (int)_indices.size();
   int prevVertCount = (int)_verts.size();
   std::copy(other._indices.begin(), other._indices.end(), std::back_inserter(_indices));
@@ -761,6 +771,7 @@ void Mesh::merge(const Mesh& other) {
 
 // Essentially build a centered circle, in the plane made by right and up, as a fan.
 void Mesh::buildCircle(float radius, Vec4f center, Vec4f right, Vec4f up, int faceCount) {
+  markDirty();
   assert(faceCount >= 3);
   right.storeNormalized();
   up.storeNormalized();
@@ -868,6 +879,7 @@ void Mesh::build16cell(float radius, Vec4f offset) {
 }
 
 void Mesh::addPolyVerts(float radius, Vec4f center, Vec4f normalRight, Vec4f normalUp, int faceCount) {
+  markDirty();
   assert(faceCount >= 3);
 
   _verts.reserve(_verts.size() + faceCount);
@@ -1238,6 +1250,7 @@ void Mesh::buildGeneralizedTesseract(float size, const Vec4f& start) {
 }
 
 void Mesh::clearCurrent() {
+  markDirty();
   _verts.resize(0);
   _indices.resize(0);
 }
@@ -1284,6 +1297,7 @@ void Mesh::buildGeneralized16cell(float radius, Vec4f offset) {
 }
 
 void Mesh::build120cell(float radius, Vec4f offset) {
+  markDirty();
 
   // Don't think this worked
   //buildPolytope(radius, offset, 5 /*vertsPerPoly*/, 3 /*polysPerCellVert*/,
@@ -1354,6 +1368,8 @@ public:
     if(!graph || !mesh || graph->faces.empty())
       return false;
 
+    mesh->markDirty();
+
     Mesh::VecList& _verts = mesh->_verts;
     Mesh::IndexList& _indices = mesh->_indices;
 
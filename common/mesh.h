@@ -16,6 +16,13 @@ public:
   MeshConverter() {}
 };
 
+// Renderer side data hung off a mesh so it lives and dies with it.
+// Common doesn't know about gl, so this is all it gets to see.
+class MeshRenderData {
+public:
+  virtual ~MeshRenderData() {}
+};
+
 // Windings are a mess and should be considered meaningless.
 class Mesh {
 public:
@@ -27,8 +34,13 @@ public:
   IndexList _indices;
   VecList _colors;
 
-  Mesh() {}
-  virtual ~Mesh() {} // sorry, per MeshSkinned. 2nd subclass forces refactor to components
+  MeshRenderData* _renderData; // owned, filled in lazily by the renderer
+  int _version; // bumped by anything touching verts/indices/colors
+
+  Mesh() : _renderData(NULL), _version(0) {}
+  virtual ~Mesh() { delete _renderData; } // sorry, per MeshSkinned. 2nd subclass forces refactor to components
+
+  void markDirty() { _version++; }
 
   int getNumberTriangles() {
     return (int)_indices.size() / 3;
@@ -85,7 +97,7 @@ public:
   void tesselateByThree();
   void tesselateBySix();
 
-  virtual bool hasSkinning() { return false; } // temporary until we actually use buffers
+  virtual bool hasSkinning() { return false; }
   
 private:
   void populateVerts(float size, int dim, const Vec4f& offset, const Vec4f& numberedSkewStep);
@@ -99,6 +111,9 @@ private:
   int addUniqueVert(const Vec4f& vert); // wow this is slow and inaccurate
   void addPolyVerts(float radius, Vec4f center, Vec4f right, Vec4f up, int faceCount);
 
+  Mesh(const Mesh&); // not copyable, would double delete _renderData
+  Mesh& operator=(const Mesh&);
+
   typedef std::pair<int, int> Edge;
   typedef std::vector<Edge> Edges;
   typedef std::map<int64, int> TriHash;
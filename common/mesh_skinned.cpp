@@ -192,7 +192,7 @@ void MeshSkinned::fillBonesWithTesseracts(float segmentLength) {
       _vertBoneIndices.push_back(bone);
     }
   }
-
+  markDirty();
 }
 
 // recursively updates parents first,
@@ -232,6 +232,7 @@ void MeshSkinned::updateFullPoses() {
   for(int i = 0; i < (int)_bones.size(); i++) {
     updateBoneRecursive(i, dirtyCounter);
   }
+  _poseVersion++;
 }
 
 void MeshSkinned::clearCurrent() {
@@ -13,7 +13,7 @@ namespace fd {
   // the vertex shader uses the vertex bone index to look up the bone transform
   // uses the bone transfrom to convert bone space position into object space
   // uses the object transform to convert object space into projection space as usual
-  // before putting the bone transformations into the shader arrays, they must be converted from heirarchical form to absolute form by transforming by parent
+  // before putting the bone transformations into the bone buffer texture, they must be converted from heirarchical form to absolute form by transforming by parent
 
   class MeshSkinned : public Mesh {
   public:
@@ -36,9 +36,10 @@ namespace fd {
     typedef std::vector<Bone, Eigen::aligned_allocator<Bone> > VecBones;
     VecBones _bones;
 
-    typedef std::vector<unsigned char> BoneIndexList;
+    // 16 bit so a skeleton isn't capped at 256 bones
+    typedef std::vector<unsigned short> BoneIndexList;
     BoneIndexList _vertBoneIndices;
-    const unsigned char* getBoneIndex(int vertex) const { return &_vertBoneIndices[vertex]; }
+    const unsigned short* getBoneIndex(int vertex) const { return &_vertBoneIndices[vertex]; }
 
     // this structure is more closely aligned with how the renderer will need it
     typedef std::vector<Vec4f> VecBonePositions;
@@ -46,6 +47,8 @@ namespace fd {
     // these are the full concatenated poses that map from local bone space to final object space
     VecBonePositions _bonePositions; 
     VecBoneRotations _boneRotations;
+    // bumped by updateFullPoses, the renderer only re-uploads when it moves
+    int _poseVersion = 0;
 
     void buildCactusDancer();
     void buildTilt();
@@ -55,6 +58,7 @@ namespace fd {
     void updateFullPoses();
 
     virtual void clearCurrent();
+    virtual bool hasSkinning() { return true; }
 
   protected:
     void updateBoneRecursive(int index, char dirtyCounter);
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include "occlusion_buffer.h"
+
+#include "camera.h"
+#include "quaxol_slicer.h"
+#include "timer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FD_OCCLUSION_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace fd {
+
+// anything with clip w under this is treated as behind the camera
+static const float c_minClipW = 0.001f;
+// a brick's own tris interpolate to about its bounds' depth, keep it visible
+static const float c_depthBias = 0.000001f;
+
+OcclusionBuffer::OcclusionBuffer()
+    : _lastOccluderTris(0)
+    , _lastUpdateMs(0.0)
+    , _pPool(&WorkerPool::GetShared())
+{
+  _toThree.storeIdentity();
+  _position.storeZero();
+  _projection.storeIdentity();
+  _depth.assign(c_width * c_height, 1.0f);
+
+  int width = c_width;
+  int height = c_height;
+  while(true) {
+    _levels.push_back(std::vector<float>(width * height, 1.0f));
+    _levelWidths.push_back(width);
+    _levelHeights.push_back(height);
+    if(width == 1 && height == 1) break;
+    width = (std::max)(1, width / 2);
+    height = (std::max)(1, height / 2);
+  }
+}
+
+OcclusionBuffer::~OcclusionBuffer() {
+}
+
+bool OcclusionBuffer::ProjectPoint(const Vec4f& world, float* outPixel) const {
+  // getCenteredThreeSpace, no w scaling, then w is forced to 1 for the projection
+  Vec4f three = _toThree.transform(world - _position);
+  // projection is uploaded untransposed, so its rows act as columns here
+  Vec4f clip = _projection[0] * three.x + _projection[1] * three.y
+      + _projection[2] * three.z + _projection[3];
+  if(clip.w < c_minClipW) {
+    return false;
+  }
+  float invW = 1.0f / clip.w;
+  outPixel[0] = ((clip.x * invW) * 0.5f + 0.5f) * (float)c_width;
+  outPixel[1] = ((clip.y * invW) * 0.5f + 0.5f) * (float)c_height;
+  outPixel[2] = clip.z * invW;
+  return true;
+}
+
+bool OcclusionBuffer::ProjectBox(const Vec4f& minCorner, const Vec4f& maxCorner,
+    ScreenRect& outRect) const {
+  for(int corner = 0; corner < 16; ++corner) {
+    Vec4f world(
+        (corner & 1) ? maxCorner.x : minCorner.x,
+        (corner & 2) ? maxCorner.y : minCorner.y,
+        (corner & 4) ? maxCorner.z : minCorner.z,
+        (corner & 8) ? maxCorner.w : minCorner.w);
+    float pixel[3];
+    if(!ProjectPoint(world, pixel)) {
+      return false;
+    }
+    if(corner == 0) {
+      outRect._minX = outRect._maxX = pixel[0];
+      outRect._minY = outRect._maxY = pixel[1];
+      outRect._nearDepth = pixel[2];
+    } else {
+      outRect._minX = (std::min)(outRect._minX, pixel[0]);
+      outRect._maxX = (std::max)(outRect._maxX, pixel[0]);
+      outRect._minY = (std::min)(outRect._minY, pixel[1]);
+      outRect._maxY = (std::max)(outRect._maxY, pixel[1]);
+      outRect._nearDepth = (std::min)(outRect._nearDepth, pixel[2]);
+    }
+  }
+  return true;
+}
+
+void OcclusionBuffer::AddOccluderTri(const Vec4f& a, const Vec4f& b, const Vec4f& c) {
+  float v[3][3];
+  // clipping isn't worth it, dropping an occluder only loses culling
+  if(!ProjectPoint(a, v[0]) || !ProjectPoint(b, v[1]) || !ProjectPoint(c, v[2])) {
+    return;
+  }
+
+  float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1])
+      - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+  if(fabs(area) < 0.0001f) {
+    return;
+  }
+  // no backface culling in 4d, just flip to the winding the edges expect
+  if(area < 0.0f) {
+    for(int i = 0; i < 3; ++i) {
+      std::swap(v[1][i], v[2][i]);
+    }
+    area = -area;
+  }
+
+  ScreenTri tri;
+  float minX = v[0][0], maxX = v[0][0], minY = v[0][1], maxY = v[0][1];
+  for(int i = 1; i < 3; ++i) {
+    minX = (std::min)(minX, v[i][0]);
+    maxX = (std::max)(maxX, v[i][0]);
+    minY = (std::min)(minY, v[i][1]);
+    maxY = (std::max)(maxY, v[i][1]);
+  }
+  // pixel centers are at +0.5
+  tri._minX = (std::max)(0, (int)ceilf(minX - 0.5f));
+  tri._maxX = (std::min)(c_width - 1, (int)floorf(maxX - 0.5f));
+  tri._minY = (std::max)(0, (int)ceilf(minY - 0.5f));
+  tri._maxY = (std::min)(c_height - 1, (int)floorf(maxY - 0.5f));
+  if(tri._minX > tri._maxX || tri._minY > tri._maxY) {
+    return;
+  }
+
+  // edge i is opposite vert i, so it's also vert i's barycentric weight
+  float invArea = 1.0f / area;
+  tri._depthA = tri._depthB = tri._depthC = 0.0f;
+  for(int i = 0; i < 3; ++i) {
+    const float* p0 = v[(i + 1) % 3];
+    const float* p1 = v[(i + 2) % 3];
+    tri._edgeA[i] = p0[1] - p1[1];
+    tri._edgeB[i] = p1[0] - p0[0];
+    tri._edgeC[i] = (p0[0] * p1[1]) - (p0[1] * p1[0]);
+    tri._depthA += tri._edgeA[i] * v[i][2] * invArea;
+    tri._depthB += tri._edgeB[i] * v[i][2] * invArea;
+    tri._depthC += tri._edgeC[i] * v[i][2] * invArea;
+  }
+  _tris.push_back(tri);
+}
+
+void OcclusionBuffer::Update(const Camera& camera, const QuaxolSlicer& slicer,
+    int maxOccluderTris) {
+  Timer updateTimer;
+  _toThree = camera._fourToThree * camera.getRenderMatrix();
+  _position = camera.getRenderPos();
+  _projection = camera._zProjectionMatrix;
+
+  // nearest first, big enough to matter
+  static std::vector<std::pair<float, int> > s_candidates;
+  s_candidates.resize(0);
+  for(int b = 0; b < (int)slicer._bricks.size(); ++b) {
+    const QuaxolSlicer::Brick& brick = slicer._bricks[b];
+    if(brick._indices.empty()) continue;
+    ScreenRect rect;
+    if(!ProjectBox(brick._min, brick._max, rect)) continue;
+    float minX = (std::max)(rect._minX, 0.0f);
+    float maxX = (std::min)(rect._maxX, (float)c_width);
+    float minY = (std::max)(rect._minY, 0.0f);
+    float maxY = (std::min)(rect._maxY, (float)c_height);
+    if(minX >= maxX || minY >= maxY) continue;
+    if((maxX - minX) * (maxY - minY) < (float)c_minOccluderPixels) continue;
+    s_candidates.push_back(std::make_pair(rect._nearDepth, b));
+  }
+  std::sort(s_candidates.begin(), s_candidates.end());
+
+  _tris.resize(0);
+  int occluderTris = 0;
+  for(const auto& candidate : s_candidates) {
+    const QuaxolSlicer::Brick& brick = slicer._bricks[candidate.second];
+    int brickTris = (int)brick._indices.size() / 3;
+    if(occluderTris + brickTris > maxOccluderTris) break;
+    for(int t = 0; t < brickTris; ++t) {
+      AddOccluderTri(brick._verts[brick._indices[t * 3 + 0]]._position,
+          brick._verts[brick._indices[t * 3 + 1]]._position,
+          brick._verts[brick._indices[t * 3 + 2]]._position);
+    }
+    occluderTris += brickTris;
+  }
+  _lastOccluderTris = occluderTris;
+
+  Rasterize();
+  BuildHiZ();
+  _lastUpdateMs = updateTimer.GetElapsed() * 1000.0;
+}
+
+void OcclusionBuffer::Rasterize() {
+  _pPool->Run(c_numBands, [this](int band) { RasterizeBand(band); });
+}
+
+// each band owns its rows of _depth outright, so no locking in here
+void OcclusionBuffer::RasterizeBand(int band) {
+  int bandMinY = band * c_bandHeight;
+  int bandMaxY = bandMinY + c_bandHeight - 1;
+  std::fill(_depth.begin() + (bandMinY * c_width),
+      _depth.begin() + ((bandMaxY + 1) * c_width), 1.0f);
+
+  for(const auto& tri : _tris) {
+    int minY = (std::max)(tri._minY, bandMinY);
+    int maxY = (std::min)(tri._maxY, bandMaxY);
+    if(minY > maxY) continue;
+
+#ifdef FD_OCCLUSION_SSE
+    // quads of pixels, starting on a multiple of 4 so the loads line up with rows
+    int startX = tri._minX & ~3;
+    const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 edgeA[3];
+    for(int e = 0; e < 3; ++e) {
+      edgeA[e] = _mm_set1_ps(tri._edgeA[e]);
+    }
+    const __m128 depthA = _mm_set1_ps(tri._depthA);
+    for(int y = minY; y <= maxY; ++y) {
+      float centerY = (float)y + 0.5f;
+      __m128 edgeRow[3];
+      for(int e = 0; e < 3; ++e) {
+        edgeRow[e] = _mm_set1_ps((tri._edgeB[e] * centerY) + tri._edgeC[e]);
+      }
+      __m128 depthRow = _mm_set1_ps((tri._depthB * centerY) + tri._depthC);
+      float* pRow = &_depth[y * c_width];
+      for(int x = startX; x <= tri._maxX; x += 4) {
+        __m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+        __m128 inside = _mm_cmpge_ps(
+            _mm_add_ps(_mm_mul_ps(edgeA[0], centerX), edgeRow[0]), zero);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(
+            _mm_add_ps(_mm_mul_ps(edgeA[1], centerX), edgeRow[1]), zero));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(
+            _mm_add_ps(_mm_mul_ps(edgeA[2], centerX), edgeRow[2]), zero));
+        if(_mm_movemask_ps(inside) == 0) continue;
+        __m128 depth = _mm_add_ps(_mm_mul_ps(depthA, centerX), depthRow);
+        __m128 old = _mm_loadu_ps(pRow + x);
+        __m128 nearer = _mm_min_ps(old, depth);
+        _mm_storeu_ps(pRow + x,
+            _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+      }
+    }
+#else
+    for(int y = minY; y <= maxY; ++y) {
+      float centerY = (float)y + 0.5f;
+      float* pRow = &_depth[y * c_width];
+      for(int x = tri._minX; x <= tri._maxX; ++x) {
+        float centerX = (float)x + 0.5f;
+        bool inside = true;
+        for(int e = 0; e < 3 && inside; ++e) {
+          inside = (tri._edgeA[e] * centerX + tri._edgeB[e] * centerY
+              + tri._edgeC[e]) >= 0.0f;
+        }
+        if(!inside) continue;
+        float depth = tri._depthA * centerX + tri._depthB * centerY + tri._depthC;
+        pRow[x] = (std::min)(pRow[x], depth);
+      }
+    }
+#endif
+  }
+}
+
+void OcclusionBuffer::BuildHiZ() {
+  // Coverage is only sampled at pixel centers, so a pixel on an occluder's
+  // silhouette may be only partly covered. Taking the max with the
+  // neighbours pushes those back to whatever is behind the edge.
+  std::vector<float>& base = _levels[0];
+  for(int y = 0; y < c_height; ++y) {
+    int y0 = (std::max)(y - 1, 0);
+    int y1 = (std::min)(y + 1, c_height - 1);
+    for(int x = 0; x < c_width; ++x) {
+      int x0 = (std::max)(x - 1, 0);
+      int x1 = (std::min)(x + 1, c_width - 1);
+      float farthest = _depth[y * c_width + x];
+      for(int ny = y0; ny <= y1; ++ny) {
+        for(int nx = x0; nx <= x1; ++nx) {
+          farthest = (std::max)(farthest, _depth[ny * c_width + nx]);
+        }
+      }
+      base[y * c_width + x] = farthest;
+    }
+  }
+
+  for(size_t level = 1; level < _levels.size(); ++level) {
+    const std::vector<float>& src = _levels[level - 1];
+    int srcWidth = _levelWidths[level - 1];
+    int srcHeight = _levelHeights[level - 1];
+    std::vector<float>& dest = _levels[level];
+    int width = _levelWidths[level];
+    int height = _levelHeights[level];
+    for(int y = 0; y < height; ++y) {
+      int sy0 = (std::min)(y * 2, srcHeight - 1);
+      int sy1 = (std::min)(y * 2 + 1, srcHeight - 1);
+      for(int x = 0; x < width; ++x) {
+        int sx0 = (std::min)(x * 2, srcWidth - 1);
+        int sx1 = (std::min)(x * 2 + 1, srcWidth - 1);
+        dest[y * width + x] = (std::max)(
+            (std::max)(src[sy0 * srcWidth + sx0], src[sy0 * srcWidth + sx1]),
+            (std::max)(src[sy1 * srcWidth + sx0], src[sy1 * srcWidth + sx1]));
+      }
+    }
+  }
+}
+
+bool OcclusionBuffer::IsBoxVisible(const Vec4f& minCorner, const Vec4f& maxCorner) const {
+  ScreenRect rect;
+  if(!ProjectBox(minCorner, maxCorner, rect)) {
+    return true; // straddles the camera
+  }
+  int minX = (std::max)(0, (int)floorf(rect._minX));
+  int maxX = (std::min)(c_width - 1, (int)floorf(rect._maxX));
+  int minY = (std::max)(0, (int)floorf(rect._minY));
+  int maxY = (std::min)(c_height - 1, (int)floorf(rect._maxY));
+  if(minX > maxX || minY > maxY) {
+    return true; // off screen, that's the view volume's call
+  }
+
+  // coarsest level where the rect still spans a couple of texels
+  int level = 0;
+  while(level + 1 < (int)_levels.size()
+      && ((maxX - minX) >> level) > 2 && ((maxY - minY) >> level) > 2) {
+    ++level;
+  }
+  const std::vector<float>& hiZ = _levels[level];
+  int width = _levelWidths[level];
+  for(int y = minY >> level; y <= (maxY >> level); ++y) {
+    for(int x = minX >> level; x <= (maxX >> level); ++x) {
+      if(rect._nearDepth <= hiZ[y * width + x] + c_depthBias) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void OcclusionBuffer::RunTests() {
+  Camera camera;
+  camera.SetZProjection(100, 100, 90.0f /*fov*/, 0.1f, 1000.0f);
+  camera.SetWProjection(-10.0f, 10.0f, 1.0f);
+  camera.UpdateRenderMatrix(NULL /*lookOffset*/, NULL /*posOffset*/);
+
+  // a wall across the middle of the view, looking down -z
+  QuaxolSlicer slicer;
+  slicer._bricks.resize(1);
+  QuaxolSlicer::Brick& wall = slicer._bricks[0];
+  const float corners[4][2] = { {-8, -8}, {8, -8}, {8, 8}, {-8, 8} };
+  for(int c = 0; c < 4; ++c) {
+    QuaxolSlicer::SliceVert vert;
+    vert._position = Vec4f(corners[c][0], corners[c][1], -10.0f, 0.0f);
+    vert._u = vert._v = 0.0f;
+    vert._uvInd = 0;
+    vert._colorW = 0.0f;
+    wall._verts.push_back(vert);
+  }
+  const int indices[] = { 0, 1, 2, 0, 2, 3 };
+  wall._indices.assign(indices, indices + 6);
+  wall._min = Vec4f(-8.0f, -8.0f, -10.0f, 0.0f);
+  wall._max = Vec4f(8.0f, 8.0f, -10.0f, 0.0f);
+
+  OcclusionBuffer occlusion;
+  occlusion.Update(camera, slicer, 1000 /*maxOccluderTris*/);
+  assert(occlusion._lastOccluderTris == 2);
+
+  Vec4f half(1.0f, 1.0f, 1.0f, 1.0f);
+  Vec4f behindWall(0.0f, 0.0f, -30.0f, 0.0f);
+  assert(!occlusion.IsBoxVisible(behindWall - half, behindWall + half));
+  Vec4f inFront(0.0f, 0.0f, -5.0f, 0.0f);
+  assert(occlusion.IsBoxVisible(inFront - half, inFront + half));
+  // far enough over that it's past the wall's edge on screen
+  Vec4f pastEdge(45.0f, 0.0f, -50.0f, 0.0f);
+  assert(occlusion.IsBoxVisible(pastEdge - half, pastEdge + half));
+  // the wall itself never hides itself
+  assert(occlusion.IsBoxVisible(wall._min, wall._max));
+}
+
+} // namespace fd
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include "fourmath.h"
+#include "worker_pool.h"
+
+namespace fd {
+
+class Camera;
+class QuaxolSlicer;
+
+// Low res cpu depth buffer for skipping slice bricks hidden behind nearer
+// ones. The biggest, nearest bricks of a QuaxolSlicer are rasterized as
+// occluders through the same transform vertSliced.glsl uses
+// (getCenteredThreeSpace then the projection), split into row bands across
+// the shared WorkerPool, four pixels at a time where there's SSE. A max
+// pyramid over that is the hi-z that brick bounds get tested against.
+// Only valid for opaque depth tested passes, blended ones see through.
+class OcclusionBuffer {
+public:
+  static const int c_width = 256;
+  static const int c_height = 128;
+  static const int c_bandHeight = 16; // rows per worker job
+  static const int c_numBands = c_height / c_bandHeight;
+  // bricks covering fewer pixels than this don't hide enough to be worth it
+  static const int c_minOccluderPixels = 64;
+
+  OcclusionBuffer();
+  ~OcclusionBuffer();
+
+  // rasterizes the nearest big bricks, up to maxOccluderTris, and builds the hi-z
+  void Update(const Camera& camera, const QuaxolSlicer& slicer, int maxOccluderTris);
+  // false only if every pixel the box could touch has something nearer
+  bool IsBoxVisible(const Vec4f& minCorner, const Vec4f& maxCorner) const;
+
+  int _lastOccluderTris;
+  double _lastUpdateMs;
+
+  static void RunTests();
+
+  ALIGNED_ALLOC_NEW_DEL_OVERRIDE
+
+protected:
+  struct ScreenTri {
+    float _edgeA[3]; // edge functions, e = a*x + b*y + c, all >= 0 inside
+    float _edgeB[3];
+    float _edgeC[3];
+    float _depthA; // ndc depth plane, z = a*x + b*y + c
+    float _depthB;
+    float _depthC;
+    int _minX, _maxX, _minY, _maxY; // inclusive pixel bounds
+  };
+  typedef std::vector<ScreenTri> ScreenTriList;
+
+  struct ScreenRect {
+    float _minX, _maxX, _minY, _maxY; // pixels
+    float _nearDepth;
+  };
+
+  // false if the point is behind the near plane
+  bool ProjectPoint(const Vec4f& world, float* outPixel) const;
+  // false if any corner is behind the near plane, the box can't be judged
+  bool ProjectBox(const Vec4f& minCorner, const Vec4f& maxCorner,
+      ScreenRect& outRect) const;
+  void AddOccluderTri(const Vec4f& a, const Vec4f& b, const Vec4f& c);
+
+  void Rasterize();
+  void RasterizeBand(int band);
+  void BuildHiZ();
+
+  // same meaning as in ViewVolume
+  Mat4f _toThree;
+  Vec4f _position;
+  Mat4f _projection;
+
+  ScreenTriList _tris;
+  std::vector<float> _depth; // c_width * c_height, ndc z, cleared to 1
+  // _levels[0] is _depth dilated by a pixel, each next level is the max of 2x2
+  std::vector<std::vector<float> > _levels;
+  std::vector<int> _levelWidths;
+  std::vector<int> _levelHeights;
+
+  WorkerPool* _pPool; // WorkerPool::GetShared, not owned
+};
+
+} // namespace fd
@@ -9,7 +9,8 @@
 namespace fd {
 
 QuaxolChunk::QuaxolChunk(Vec4f position, Vec4f blockSize)
-    : m_position(position)
+    : m_renderVersion(0)
+    , m_position(position)
     , m_blockSize(blockSize)
     , m_blockDims(c_mxSz, c_mxSz, c_mxSz, c_mxSz) {
 }
@@ -337,6 +338,7 @@ void QuaxolChunk::AddRenderCubeByDir(
 }
 
 void QuaxolChunk::UpdateTrisFromConnects() {
+  m_renderVersion++;
 
   int expectedVerts = m_cubeCount * 8;
   int expectedTris = m_cubeCount * 12; // probably should do quads?
@@ -135,6 +135,7 @@ namespace fd {
     QVertList m_packVerts;
     VecList m_verts;
     IndexList m_indices;
+    int m_renderVersion; // bumped on every remesh so gpu copies know to update
 
     Vec4f m_position;
     Vec4f m_blockSize; // this should probably live higher up?
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include "quaxol_slicer.h"
+
+#include "quaxol.h"
+
+namespace fd {
+
+QuaxolSlicer::QuaxolSlicer()
+    : _distance(0.0f)
+    , _chunk(NULL)
+    , _chunkVersion(-1)
+    , _version(0)
+    , _lastBricksSliced(0)
+{
+  _normal.storeZero();
+}
+
+bool QuaxolSlicer::Update(const QuaxolChunk* chunk,
+    const Vec4f& normal, float distance) {
+  _lastBricksSliced = 0;
+  if(!chunk)
+    return false;
+
+  // the cache is only good for the exact plane and mesh it was built from
+  if(chunk == _chunk && chunk->m_renderVersion == _chunkVersion
+      && normal == _normal && distance == _distance) {
+    return false;
+  }
+
+  _chunk = chunk;
+  _chunkVersion = chunk->m_renderVersion;
+  _normal = normal;
+  _distance = distance;
+  _bricks.resize(c_numBricks);
+
+  const Vec4f& blockSize = chunk->m_blockSize;
+  Vec4f brickExtent = blockSize * (float)c_brickSize;
+  for(int brickIndex = 0; brickIndex < c_numBricks; ++brickIndex) {
+    Vec4f brickMin;
+    int remaining = brickIndex;
+    for(int c = 3; c >= 0; --c) {
+      brickMin[c] = (float)(remaining % c_bricksPerSide) * brickExtent[c];
+      remaining /= c_bricksPerSide;
+    }
+
+    // range of n.x - d over the brick, a brick the plane misses is empty
+    float lo = -distance;
+    float hi = -distance;
+    for(int c = 0; c < 4; ++c) {
+      float a = normal[c] * brickMin[c];
+      float b = normal[c] * (brickMin[c] + brickExtent[c]);
+      lo += (std::min)(a, b);
+      hi += (std::max)(a, b);
+    }
+
+    Brick& brick = _bricks[brickIndex];
+    if(lo > 0.0f || hi < 0.0f) {
+      brick._verts.resize(0);
+      brick._indices.resize(0);
+      continue;
+    }
+    SliceBrick(chunk, brickIndex);
+    ++_lastBricksSliced;
+  }
+
+  ++_version;
+  return true;
+}
+
+void QuaxolSlicer::SliceBrick(const QuaxolChunk* chunk, int brickIndex) {
+  Brick& brick = _bricks[brickIndex];
+  brick._verts.resize(0);
+  brick._indices.resize(0);
+
+  int start[4];
+  int remaining = brickIndex;
+  for(int c = 3; c >= 0; --c) {
+    start[c] = (remaining % c_bricksPerSide) * c_brickSize;
+    remaining /= c_bricksPerSide;
+  }
+
+  const Vec4f& blockSize = chunk->m_blockSize;
+  Vec4f zeroOffset(0, 0, 0, 0);
+  for(int x = start[0]; x < start[0] + c_brickSize; ++x) {
+    for(int y = start[1]; y < start[1] + c_brickSize; ++y) {
+      for(int z = start[2]; z < start[2] + c_brickSize; ++z) {
+        for(int w = start[3]; w < start[3] + c_brickSize; ++w) {
+          if(!chunk->IsPresent(x, y, z, w))
+            continue;
+          unsigned char flags = chunk->m_connects[x][y][z][w].connectFlags;
+          if(flags == 0)
+            continue;
+
+          // same placement UpdateTrisFromConnects uses
+          QuaxolSpec blockSpec(x, y, z, w);
+          Vec4f blockMin = blockSpec.ToFloatCoords(zeroOffset, blockSize);
+          int uvInd = chunk->m_blocks[x][y][z][w].type;
+          for(int dir = 0; dir < RenderBlock::NumDirs; ++dir) {
+            if(flags & (1 << dir)) {
+              SliceCube(blockMin, blockSize, dir, uvInd, _normal, _distance,
+                  brick._verts, brick._indices);
+            }
+          }
+        } // w
+      } // z
+    } // y
+  } // x
+
+  for(int v = 0; v < (int)brick._verts.size(); ++v) {
+    const Vec4f& pos = brick._verts[v]._position;
+    if(v == 0) {
+      brick._min = pos;
+      brick._max = pos;
+    }
+    for(int c = 0; c < 4; ++c) {
+      brick._min[c] = (std::min)(brick._min[c], pos[c]);
+      brick._max[c] = (std::max)(brick._max[c], pos[c]);
+    }
+  }
+}
+
+// The face cube for dirIndex keeps one axis fixed on the block's side and
+// spans the other three. Where the plane crosses its 12 edges gives the
+// polygon's corners, which then just need ordering around their center.
+int QuaxolSlicer::SliceCube(const Vec4f& blockMin, const Vec4f& blockSize,
+    int dirIndex, int uvInd, const Vec4f& normal, float distance,
+    SliceVertList& verts, SliceIndexList& indices) {
+  const float c_epsilon = 0.00001f;
+  int fixedAxis = dirIndex / 2;
+  bool plusSide = (dirIndex % 2) == 0; // XPlusInd == 0, XMinusInd == 1...
+  int freeAxes[3];
+  for(int c = 0, f = 0; c < 4; ++c) {
+    if(c != fixedAxis) freeAxes[f++] = c;
+  }
+
+  Vec4f corners[8];
+  float sides[8];
+  for(int corner = 0; corner < 8; ++corner) {
+    Vec4f pos = blockMin;
+    if(plusSide) pos[fixedAxis] += blockSize[fixedAxis];
+    for(int f = 0; f < 3; ++f) {
+      if(corner & (1 << f)) pos[freeAxes[f]] += blockSize[freeAxes[f]];
+    }
+    corners[corner] = pos;
+    sides[corner] = normal.dot(pos) - distance;
+  }
+
+  Vec4f points[12];
+  int numPoints = 0;
+  for(int corner = 0; corner < 8; ++corner) {
+    for(int f = 0; f < 3; ++f) {
+      int other = corner | (1 << f);
+      if(other == corner) continue; // each edge once, from its low end
+      float a = sides[corner];
+      float b = sides[other];
+      if((a < 0.0f) == (b < 0.0f)) continue;
+      float t = a / (a - b);
+      Vec4f point = corners[corner] + (corners[other] - corners[corner]) * t;
+      // plane through a corner hits several edges at the same spot
+      bool duplicate = false;
+      for(int p = 0; p < numPoints; ++p) {
+        if((points[p] - point).lengthSq() < c_epsilon) {
+          duplicate = true;
+          break;
+        }
+      }
+      if(!duplicate) {
+        points[numPoints++] = point;
+      }
+    }
+  }
+  if(numPoints < 3)
+    return 0;
+
+  Vec4f center;
+  center.storeZero();
+  for(int p = 0; p < numPoints; ++p) {
+    center += points[p];
+  }
+  center *= 1.0f / (float)numPoints;
+
+  // any two independent in-polygon directions work as a 2d basis
+  Vec4f axisU = (points[0] - center).storeNormalized();
+  Vec4f axisV;
+  float bestLength = 0.0f;
+  for(int p = 1; p < numPoints; ++p) {
+    Vec4f offset = points[p] - center;
+    Vec4f perp = offset - axisU * offset.dot(axisU);
+    float length = perp.length();
+    if(length > bestLength) {
+      bestLength = length;
+      axisV = perp;
+    }
+  }
+  if(bestLength < c_epsilon)
+    return 0; // degenerate sliver
+  axisV *= 1.0f / bestLength;
+
+  float angles[12];
+  int order[12];
+  for(int p = 0; p < numPoints; ++p) {
+    Vec4f offset = points[p] - center;
+    angles[p] = atan2(offset.dot(axisV), offset.dot(axisU));
+    order[p] = p;
+  }
+  std::sort(order, order + numPoints,
+      [&angles](int lhs, int rhs) { return angles[lhs] < angles[rhs]; });
+
+  // uvs run across the first two spanned axes of the face
+  int baseVert = (int)verts.size();
+  for(int p = 0; p < numPoints; ++p) {
+    const Vec4f& point = points[order[p]];
+    SliceVert vert;
+    vert._position = point;
+    vert._u = (point[freeAxes[0]] - blockMin[freeAxes[0]]) / blockSize[freeAxes[0]];
+    vert._v = (point[freeAxes[1]] - blockMin[freeAxes[1]]) / blockSize[freeAxes[1]];
+    vert._uvInd = uvInd;
+    vert._colorW = blockMin.w;
+    verts.push_back(vert);
+  }
+  for(int tri = 0; tri < numPoints - 2; ++tri) {
+    indices.push_back(baseVert);
+    indices.push_back(baseVert + tri + 1);
+    indices.push_back(baseVert + tri + 2);
+  }
+  return numPoints - 2;
+}
+
+void QuaxolSlicer::RunTests() {
+  Vec4f blockMin(0.0f, 0.0f, 0.0f, 0.0f);
+  Vec4f blockSize(10.0f, 10.0f, 10.0f, 10.0f);
+  Vec4f wNormal(0.0f, 0.0f, 0.0f, 1.0f);
+  SliceVertList verts;
+  SliceIndexList indices;
+
+  // w = 5 through the x+ face cube cuts a full square
+  int tris = SliceCube(blockMin, blockSize, RenderBlock::XPlusInd, 0,
+      wNormal, 5.0f, verts, indices);
+  assert(tris == 2);
+  assert(verts.size() == 4);
+  for(const auto& vert : verts) {
+    assert(vert._position.x == 10.0f);
+    assert(fabs(vert._position.w - 5.0f) < 0.0001f);
+  }
+
+  // the w+ face cube lies in w = 10, so w = 5 misses it
+  verts.resize(0);
+  indices.resize(0);
+  tris = SliceCube(blockMin, blockSize, RenderBlock::WPlusInd, 0,
+      wNormal, 5.0f, verts, indices);
+  assert(tris == 0);
+
+  // a diagonal plane through the middle of a cube makes a hexagon
+  verts.resize(0);
+  indices.resize(0);
+  Vec4f diagonal(1.0f, 1.0f, 1.0f, 0.0f);
+  tris = SliceCube(blockMin, blockSize, RenderBlock::WMinusInd, 0,
+      diagonal, 15.0f, verts, indices);
+  assert(tris == 4);
+  assert(verts.size() == 6);
+  assert(indices.size() == 12);
+}
+
+} // namespace fd
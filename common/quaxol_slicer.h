@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include "fourmath.h"
+#include "quaxol.h"
+
+namespace fd {
+
+// Exact 3d cross section of a QuaxolChunk by the hyperplane n.x == d.
+// Every exposed boundary cube (3-cell) of a present block that the plane
+// passes through is cut into one convex polygon of the section's surface
+// and fanned into tris. Results are kept per 4^4 block brick, and bricks
+// are only resliced after the plane moves or the chunk is remeshed.
+class QuaxolSlicer {
+public:
+  static const int c_brickSize = 4; // in blocks per side
+  static const int c_bricksPerSide = QuaxolChunk::c_mxSz / c_brickSize;
+  static_assert(c_bricksPerSide * c_brickSize == QuaxolChunk::c_mxSz,
+      "bricks have to tile the chunk exactly");
+  static const int c_numBricks =
+      c_bricksPerSide * c_bricksPerSide * c_bricksPerSide * c_bricksPerSide;
+
+  struct SliceVert {
+    Vec4f _position; // on the plane, still in 4d chunk space
+    float _u, _v; // 0-1 across the block face
+    int _uvInd; // atlas tile, the block type
+    float _colorW; // block's min w, what the chunk colors by
+  };
+  typedef std::vector<SliceVert> SliceVertList;
+  typedef std::vector<int> SliceIndexList;
+
+  struct Brick {
+    SliceVertList _verts;
+    SliceIndexList _indices; // tri list, local to _verts
+    Vec4f _min; // bounds of _verts, only meaningful if there are any
+    Vec4f _max;
+  };
+  typedef std::vector<Brick> BrickList;
+  BrickList _bricks;
+
+  Vec4f _normal;
+  float _distance;
+  const QuaxolChunk* _chunk; // not owned, only used to spot a swapped chunk
+  int _chunkVersion;
+  int _version; // bumped whenever any brick's tris change
+  int _lastBricksSliced; // how much work the last Update did
+
+public:
+  QuaxolSlicer();
+
+  // returns true if anything was resliced
+  bool Update(const QuaxolChunk* chunk, const Vec4f& normal, float distance);
+  void Invalidate() { _chunk = NULL; }
+
+  // appends the section of one cube face of a block, returns tris added
+  static int SliceCube(const Vec4f& blockMin, const Vec4f& blockSize,
+      int dirIndex, int uvInd, const Vec4f& normal, float distance,
+      SliceVertList& verts, SliceIndexList& indices);
+
+  static void RunTests();
+
+protected:
+  void SliceBrick(const QuaxolChunk* chunk, int brickIndex);
+};
+
+} // namespace fd
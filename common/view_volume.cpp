@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <assert.h>
+#include "view_volume.h"
+
+#include "camera.h"
+
+namespace fd {
+
+const float ViewVolume::c_wFadeMargin = 0.1f;
+const float ViewVolume::c_zBufShiftMax = 0.1f * (1.0f + ViewVolume::c_wFadeMargin);
+
+ViewVolume::ViewVolume()
+    : _wNear(0.0f)
+    , _wFar(1.0f)
+    , _xyScaleMin(1.0f)
+    , _xyScaleMax(1.0f)
+{
+  _toThree.storeIdentity();
+  _position.storeZero();
+  _projection.storeIdentity();
+}
+
+void ViewVolume::UpdateFromCamera(const Camera& camera) {
+  // the shader does fourToThree * (renderMatrix * (world - renderPos))
+  _toThree = camera._fourToThree * camera.getRenderMatrix();
+  _position = camera.getRenderPos();
+  _projection = camera._zProjectionMatrix;
+  float wMargin = c_wFadeMargin * (camera._wFar - camera._wNear);
+  _wNear = camera._wNear - wMargin;
+  _wFar = camera._wFar + wMargin;
+  // getThreeSpace scales by mix(ratio, 1, wPos), getCenteredThreeSpace by 1.
+  // wPos is 1 at the near plane and 0 at far, so inside the margins it runs
+  // from -c_wFadeMargin to 1 + c_wFadeMargin, past both ends of the mix.
+  float ratio = camera._wScreenSizeRatio;
+  float scaleAtFar = ratio + (1.0f - ratio) * -c_wFadeMargin;
+  float scaleAtNear = ratio + (1.0f - ratio) * (1.0f + c_wFadeMargin);
+  _xyScaleMin = (std::min)((std::min)(scaleAtFar, scaleAtNear), 1.0f);
+  _xyScaleMax = (std::max)((std::max)(scaleAtFar, scaleAtNear), 1.0f);
+}
+
+bool ViewVolume::IsBoxVisible(const Vec4f& minCorner, const Vec4f& maxCorner) const {
+  // a linear map of a box is the hull of its mapped corners,
+  // so bounding those bounds the whole thing
+  Vec4f threeMin;
+  Vec4f threeMax;
+  for(int corner = 0; corner < 16; ++corner) {
+    Vec4f world(
+        (corner & 1) ? maxCorner.x : minCorner.x,
+        (corner & 2) ? maxCorner.y : minCorner.y,
+        (corner & 4) ? maxCorner.z : minCorner.z,
+        (corner & 8) ? maxCorner.w : minCorner.w);
+    Vec4f three = _toThree.transform(world - _position);
+    if(corner == 0) {
+      threeMin = three;
+      threeMax = three;
+    } else {
+      for(int c = 0; c < 4; ++c) {
+        threeMin[c] = (std::min)(threeMin[c], three[c]);
+        threeMax[c] = (std::max)(threeMax[c], three[c]);
+      }
+    }
+  }
+
+  // w slab, anything past the faded out margins draws nothing
+  if(threeMax.w < _wNear || threeMin.w > _wFar) {
+    return false;
+  }
+
+  // widen xy to cover every scale the w projection could apply, a low
+  // ratio can take the scale at the far margin below zero and flip it
+  for(int c = 0; c < 2; ++c) {
+    float a = threeMin[c] * _xyScaleMin;
+    float b = threeMin[c] * _xyScaleMax;
+    float d = threeMax[c] * _xyScaleMin;
+    float e = threeMax[c] * _xyScaleMax;
+    threeMin[c] = (std::min)((std::min)(a, b), (std::min)(d, e));
+    threeMax[c] = (std::max)((std::max)(a, b), (std::max)(d, e));
+  }
+
+  // projection is uploaded untransposed, so its rows act as columns here
+  int outsideMask = 0x3f;
+  for(int corner = 0; corner < 8; ++corner) {
+    float x = (corner & 1) ? threeMax.x : threeMin.x;
+    float y = (corner & 2) ? threeMax.y : threeMin.y;
+    float z = (corner & 4) ? threeMax.z : threeMin.z;
+    Vec4f clip = _projection[0] * x + _projection[1] * y
+        + _projection[2] * z + _projection[3];
+    int cornerMask = 0;
+    if(clip.x < -clip.w) cornerMask |= 0x01;
+    if(clip.x > clip.w) cornerMask |= 0x02;
+    if(clip.y < -clip.w) cornerMask |= 0x04;
+    if(clip.y > clip.w) cornerMask |= 0x08;
+    if(clip.z < -clip.w) cornerMask |= 0x10;
+    // the z buffer shift only ever moves things toward the camera
+    if(clip.z - c_zBufShiftMax > clip.w) cornerMask |= 0x20;
+    outsideMask &= cornerMask;
+    if(outsideMask == 0) {
+      return true;
+    }
+  }
+  // every corner was outside the same plane
+  return false;
+}
+
+void ViewVolume::RunTests() {
+  Camera camera;
+  camera.SetZProjection(100, 100, 90.0f /*fov*/, 0.1f, 1000.0f);
+  camera.SetWProjection(-10.0f, 10.0f, 1.0f);
+  camera.UpdateRenderMatrix(NULL /*lookOffset*/, NULL /*posOffset*/);
+
+  ViewVolume view;
+  view.UpdateFromCamera(camera);
+
+  Vec4f half(1.0f, 1.0f, 1.0f, 1.0f);
+  // looking down -z
+  Vec4f ahead(0.0f, 0.0f, -20.0f, 0.0f);
+  assert(view.IsBoxVisible(ahead - half, ahead + half));
+  Vec4f behind(0.0f, 0.0f, 20.0f, 0.0f);
+  assert(!view.IsBoxVisible(behind - half, behind + half));
+  Vec4f offToSide(100.0f, 0.0f, -20.0f, 0.0f);
+  assert(!view.IsBoxVisible(offToSide - half, offToSide + half));
+  Vec4f pastWFar(0.0f, 0.0f, -20.0f, 30.0f);
+  assert(!view.IsBoxVisible(pastWFar - half, pastWFar + half));
+  Vec4f beforeWNear(0.0f, 0.0f, -20.0f, -30.0f);
+  assert(!view.IsBoxVisible(beforeWNear - half, beforeWNear + half));
+  // past the plane but inside the 2 unit fade, still partly drawn
+  Vec4f inWFade(0.0f, 0.0f, -20.0f, -11.0f);
+  assert(view.IsBoxVisible(inWFade - half * 0.5f, inWFade + half * 0.5f));
+  Vec4f pastWFade(0.0f, 0.0f, -20.0f, -13.0f);
+  assert(!view.IsBoxVisible(pastWFade - half * 0.5f, pastWFade + half * 0.5f));
+  // the xy scale goes past the ratio in the fade, so with a strong w
+  // perspective the edge of the frustum moves out there
+  camera.SetWProjection(-10.0f, 10.0f, 0.5f);
+  view.UpdateFromCamera(camera);
+  assert(view._xyScaleMin < 0.5f && view._xyScaleMax > 1.0f);
+  // straddling the camera is always visible
+  assert(view.IsBoxVisible(Vec4f() - half * 50.0f, Vec4f() + half * 50.0f));
+}
+
+} // namespace fd
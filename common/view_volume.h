@@ -0,0 +1,40 @@
+#pragma once
+
+#include "fourmath.h"
+
+namespace fd {
+
+class Camera;
+
+// Conservative 4d view volume for a camera, matching what
+// cvCommonTransform.glsl does: the w slab between _wNear and _wFar,
+// then the 3d frustum from _zProjectionMatrix.
+// Boxes that come back invisible are guaranteed to draw nothing.
+class ViewVolume {
+public:
+  // vertQuaxol.glsl fades out over smoo = 0.1 of the w range past the
+  // planes rather than stopping at them
+  static const float c_wFadeMargin;
+  // and pulls clip z toward the camera by up to 0.1 * |savedW|
+  static const float c_zBufShiftMax;
+
+  Mat4f _toThree; // world offset from _position into three space
+  Vec4f _position;
+  Mat4f _projection;
+  float _wNear; // the camera's planes padded out by c_wFadeMargin
+  float _wFar;
+  // the shader scales xy by something between these depending on w
+  float _xyScaleMin;
+  float _xyScaleMax;
+
+  ViewVolume();
+
+  void UpdateFromCamera(const Camera& camera);
+  bool IsBoxVisible(const Vec4f& minCorner, const Vec4f& maxCorner) const;
+
+  static void RunTests();
+
+  ALIGNED_ALLOC_NEW_DEL_OVERRIDE
+};
+
+} // namespace fd
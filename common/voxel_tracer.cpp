@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <memory>
+#include "voxel_tracer.h"
+
+#include "camera.h"
+#include "physics.h"
+#include "quaxol.h"
+#include "timer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FD_TRACER_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace fd {
+
+// axis aligned rays would divide by zero in the bounds test, this stands in
+static const float c_minDirection = 0.000000000001f;
+static const float c_ambient = 0.35f;
+
+// by block type, there are no textures out here
+static const unsigned char s_palette[][3] = {
+  { 200, 200, 200 },
+  { 220, 80, 60 },
+  { 90, 190, 80 },
+  { 70, 110, 220 },
+  { 230, 200, 70 },
+  { 180, 90, 200 },
+  { 70, 200, 200 },
+  { 230, 140, 60 },
+};
+static const int s_paletteSize = sizeof(s_palette) / sizeof(s_palette[0]);
+
+VoxelTracer::VoxelTracer()
+    : _lastHits(0)
+    , _lastTraceMs(0.0)
+    , _lastMraysPerSecond(0.0)
+    , _invProjectionX(1.0f)
+    , _invProjectionY(1.0f)
+    , _maxDistance(FLT_MAX)
+    , _pChunk(NULL)
+    , _width(0)
+    , _height(0)
+    , _tilesX(0)
+    , _numTiles(0)
+    , _hits(0)
+    , _pPool(&WorkerPool::GetShared())
+{
+  _toThree.storeIdentity();
+  _position.storeZero();
+  _localPosition.storeZero();
+  _invBlockSize.set(1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+VoxelTracer::~VoxelTracer() {
+}
+
+void VoxelTracer::Trace(const Camera& camera, const QuaxolChunk& chunk,
+    int width, int height) {
+  Timer traceTimer;
+  _toThree = camera._fourToThree * camera.getRenderMatrix();
+  _position = camera.getRenderPos();
+  // projection is uploaded untransposed, [0].x and [1].y are the fov scales
+  _invProjectionX = 1.0f / camera._zProjectionMatrix[0][0];
+  _invProjectionY = 1.0f / camera._zProjectionMatrix[1][1];
+  _maxDistance = camera._zFar;
+  _pChunk = &chunk;
+  for(int c = 0; c < 4; ++c) {
+    _invBlockSize[c] = 1.0f / chunk.m_blockSize[c];
+    _localPosition[c] = (_position[c] - chunk.m_position[c]) * _invBlockSize[c];
+  }
+
+  if(width != _width || height != _height) {
+    _width = width;
+    _height = height;
+    _color.resize(width * height * 3);
+    _distance.resize(width * height);
+  }
+  _tilesX = (width + c_tileSize - 1) / c_tileSize;
+  _numTiles = _tilesX * ((height + c_tileSize - 1) / c_tileSize);
+  _hits = 0;
+
+  // this thread takes tiles too, Run is back once they're all done
+  _pPool->Run(_numTiles, [this](int tile) { TraceTile(tile); });
+  _pChunk = NULL;
+
+  _lastHits = _hits;
+  double seconds = traceTimer.GetElapsed();
+  _lastTraceMs = seconds * 1000.0;
+  _lastMraysPerSecond = (seconds > 0.0)
+      ? ((double)width * (double)height / seconds) / 1000000.0 : 0.0;
+}
+
+// each tile owns its pixels outright, so no locking in here
+void VoxelTracer::TraceTile(int tile) {
+  int minX = (tile % _tilesX) * c_tileSize;
+  int minY = (tile / _tilesX) * c_tileSize;
+  int maxX = (std::min)(minX + c_tileSize, _width);
+  int maxY = (std::min)(minY + c_tileSize, _height);
+  int hits = 0;
+  for(int y = minY; y < maxY; y += 2) {
+    for(int x = minX; x < maxX; x += 2) {
+      hits += TracePacket(x, y);
+    }
+  }
+  _hits += hits;
+}
+
+// lanes are (x,y) (x+1,y) (x,y+1) (x+1,y+1), ones off the image are traced
+// anyway and dropped
+int VoxelTracer::TracePacket(int x, int y) {
+  float ndcX[4];
+  float ndcY[4];
+  for(int lane = 0; lane < 4; ++lane) {
+    int px = x + (lane & 1);
+    int py = y + (lane >> 1);
+    ndcX[lane] = (((float)px + 0.5f) / (float)_width) * 2.0f - 1.0f;
+    ndcY[lane] = 1.0f - (((float)py + 0.5f) / (float)_height) * 2.0f;
+  }
+
+  float localDir[4][4]; // [axis][lane]
+  float axisNear[4][4];
+  float tEnter[4];
+  float tExit[4];
+  const float dims = (float)QuaxolChunk::c_mxSz;
+
+#ifdef FD_TRACER_SSE
+  {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 minDirection = _mm_set1_ps(c_minDirection);
+    __m128 viewX = _mm_mul_ps(_mm_loadu_ps(ndcX), _mm_set1_ps(_invProjectionX));
+    __m128 viewY = _mm_mul_ps(_mm_loadu_ps(ndcY), _mm_set1_ps(_invProjectionY));
+    // back through the transpose of _toThree, view z is -1
+    __m128 dir[4];
+    __m128 lengthSq = _mm_setzero_ps();
+    for(int c = 0; c < 4; ++c) {
+      dir[c] = _mm_sub_ps(_mm_add_ps(
+          _mm_mul_ps(viewX, _mm_set1_ps(_toThree[0][c])),
+          _mm_mul_ps(viewY, _mm_set1_ps(_toThree[1][c]))),
+          _mm_set1_ps(_toThree[2][c]));
+      lengthSq = _mm_add_ps(lengthSq, _mm_mul_ps(dir[c], dir[c]));
+    }
+    __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+
+    __m128 nearT = _mm_setzero_ps();
+    __m128 farT = _mm_set1_ps(_maxDistance);
+    for(int c = 0; c < 4; ++c) {
+      __m128 d = _mm_mul_ps(_mm_mul_ps(dir[c], invLength),
+          _mm_set1_ps(_invBlockSize[c]));
+      _mm_storeu_ps(localDir[c], d);
+      __m128 tooSmall = _mm_cmplt_ps(_mm_and_ps(d, absMask), minDirection);
+      d = _mm_or_ps(_mm_andnot_ps(tooSmall, d), _mm_and_ps(tooSmall, minDirection));
+      __m128 invD = _mm_div_ps(one, d);
+      __m128 start = _mm_set1_ps(_localPosition[c]);
+      __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), start), invD);
+      __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(dims), start), invD);
+      __m128 axisNearT = _mm_min_ps(t0, t1);
+      _mm_storeu_ps(axisNear[c], axisNearT);
+      nearT = _mm_max_ps(nearT, axisNearT);
+      farT = _mm_min_ps(farT, _mm_max_ps(t0, t1));
+    }
+    _mm_storeu_ps(tEnter, nearT);
+    _mm_storeu_ps(tExit, farT);
+  }
+#else
+  for(int lane = 0; lane < 4; ++lane) {
+    float viewX = ndcX[lane] * _invProjectionX;
+    float viewY = ndcY[lane] * _invProjectionY;
+    float dir[4];
+    float lengthSq = 0.0f;
+    for(int c = 0; c < 4; ++c) {
+      dir[c] = viewX * _toThree[0][c] + viewY * _toThree[1][c] - _toThree[2][c];
+      lengthSq += dir[c] * dir[c];
+    }
+    float invLength = 1.0f / sqrtf(lengthSq);
+
+    tEnter[lane] = 0.0f;
+    tExit[lane] = _maxDistance;
+    for(int c = 0; c < 4; ++c) {
+      float d = dir[c] * invLength * _invBlockSize[c];
+      localDir[c][lane] = d;
+      if(fabsf(d) < c_minDirection) {
+        d = c_minDirection;
+      }
+      float t0 = (0.0f - _localPosition[c]) / d;
+      float t1 = (dims - _localPosition[c]) / d;
+      axisNear[c][lane] = (std::min)(t0, t1);
+      tEnter[lane] = (std::max)(tEnter[lane], axisNear[c][lane]);
+      tExit[lane] = (std::min)(tExit[lane], (std::max)(t0, t1));
+    }
+  }
+#endif // FD_TRACER_SSE
+
+  const float* start = _localPosition.raw();
+  int hits = 0;
+  for(int lane = 0; lane < 4; ++lane) {
+    int px = x + (lane & 1);
+    int py = y + (lane >> 1);
+    if(px >= _width || py >= _height) continue;
+
+    Hit hit;
+    bool didHit = false;
+    if(tEnter[lane] <= tExit[lane]) {
+      int enterAxis = -1;
+      if(tEnter[lane] > 0.0f) {
+        for(int c = 0; c < 4; ++c) {
+          if(axisNear[c][lane] == tEnter[lane]) {
+            enterAxis = c;
+          }
+        }
+      }
+      float dir[4] = { localDir[0][lane], localDir[1][lane],
+          localDir[2][lane], localDir[3][lane] };
+      didHit = StepRay(start, dir, tEnter[lane], tExit[lane], enterAxis, hit);
+    }
+    Shade(px, py, didHit ? &hit : NULL);
+    if(didHit) {
+      ++hits;
+    }
+  }
+  return hits;
+}
+
+// The stepping from Physics::LocalRayCastChunk, with counters holding the
+// distance to each axis's next boundary so the hit distance falls out.
+bool VoxelTracer::StepRay(const float* start, const float* dir,
+    float tEnter, float tExit, int enterAxis, Hit& outHit) const {
+  const QuaxolChunk& chunk = *_pChunk;
+  int gridPos[4];
+  int sign[4];
+  float step[4];
+  float stepCounter[4];
+  for(int c = 0; c < 4; ++c) {
+    float entry = start[c] + dir[c] * tEnter;
+    gridPos[c] = (std::min)((std::max)((int)floorf(entry), 0),
+        QuaxolChunk::c_mxSz - 1);
+    sign[c] = std::signbit(dir[c]) ? -1 : 1;
+    if(dir[c] != 0.0f) {
+      step[c] = fabsf(1.0f / dir[c]);
+      float boundary = (float)((sign[c] > 0) ? gridPos[c] + 1 : gridPos[c]);
+      stepCounter[c] = (boundary - start[c]) / dir[c];
+    } else {
+      step[c] = 0.0f;
+      stepCounter[c] = FLT_MAX;
+    }
+  }
+
+  float t = tEnter;
+  int axis = enterAxis;
+  while(true) {
+    if(chunk.IsPresent(gridPos[0], gridPos[1], gridPos[2], gridPos[3])) {
+      outHit._distance = t;
+      outHit._axis = axis;
+      outHit._sign = (axis >= 0) ? sign[axis] : 0;
+      outHit._type = chunk.m_blocks[gridPos[0]][gridPos[1]][gridPos[2]][gridPos[3]].type;
+      return true;
+    }
+
+    axis = 0;
+    for(int c = 1; c < 4; ++c) {
+      if(stepCounter[c] < stepCounter[axis]) {
+        axis = c;
+      }
+    }
+    t = stepCounter[axis];
+    if(t > tExit) {
+      return false;
+    }
+    gridPos[axis] += sign[axis];
+    if(gridPos[axis] < 0 || gridPos[axis] >= QuaxolChunk::c_mxSz) {
+      return false;
+    }
+    stepCounter[axis] += step[axis];
+  }
+}
+
+void VoxelTracer::Shade(int x, int y, const Hit* pHit) {
+  int pixel = (y * _width) + x;
+  unsigned char* pColor = &_color[pixel * 3];
+  if(!pHit) {
+    _distance[pixel] = FLT_MAX;
+    pColor[0] = pColor[1] = pColor[2] = 0;
+    return;
+  }
+
+  // one light, from above and a little up w
+  static const float light[4] = { 0.3f, 0.8f, 0.4f, 0.33f };
+  float diffuse = 0.0f;
+  if(pHit->_axis >= 0) {
+    // the face normal points back against the ray
+    diffuse = (std::max)(0.0f, -(float)pHit->_sign * light[pHit->_axis]);
+  }
+  float brightness = c_ambient + ((1.0f - c_ambient) * diffuse);
+  const unsigned char* pBase = s_palette[pHit->_type % s_paletteSize];
+  for(int c = 0; c < 3; ++c) {
+    pColor[c] = (unsigned char)((float)pBase[c] * brightness);
+  }
+  _distance[pixel] = pHit->_distance;
+}
+
+void VoxelTracer::RunTests() {
+  std::unique_ptr<QuaxolChunk> chunk(new QuaxolChunk(
+      Vec4f(0.0f, 0.0f, 0.0f, 0.0f), Vec4f(10.0f, 10.0f, 10.0f, 10.0f)));
+  chunk->Clear();
+  chunk->SetAt(QuaxolSpec(8, 8, 2, 8), true /*present*/, 3 /*type*/);
+
+  // in the middle of the chunk, looking down -z at the block
+  Camera camera;
+  camera.SetZProjection(32, 32, 90.0f /*fov*/, 0.1f, 1000.0f);
+  camera.SetWProjection(-10.0f, 10.0f, 1.0f);
+  camera.SetCameraPosition(Vec4f(85.0f, 85.0f, 85.0f, 85.0f));
+  camera.UpdateRenderMatrix(NULL /*lookOffset*/, NULL /*posOffset*/);
+
+  VoxelTracer tracer;
+  tracer.Trace(camera, *chunk, 32, 32);
+  assert(tracer._lastHits > 0);
+  assert(tracer._lastHits < 32 * 32);
+
+  // the block's near face is at z 30, the center pixel is a hair off axis
+  int center = (16 * 32) + 16;
+  float centerDistance = tracer.GetDistance()[center];
+  assert(fabsf(centerDistance - 55.0f) < 0.1f);
+  assert(tracer.GetColor()[center * 3 + 2] > tracer.GetColor()[center * 3 + 0]);
+  // corners look well past the block and out of the chunk
+  assert(tracer.GetDistance()[0] == FLT_MAX);
+  assert(tracer.GetDistance()[(32 * 32) - 1] == FLT_MAX);
+
+  // agrees with the physics ray cast it's based on
+  Vec4f centerRay(1.0f / 32.0f, -1.0f / 32.0f, -1.0f, 0.0f);
+  centerRay = centerRay.normalized() * 1000.0f;
+  Physics physics;
+  float physicsDistance = 0.0f;
+  assert(physics.RayCastChunk(*chunk, camera.getRenderPos(), centerRay,
+      &physicsDistance));
+  assert(fabsf(physicsDistance - centerDistance) < 0.05f);
+
+  // same picture again, workers and all
+  std::vector<float> firstDistance(tracer.GetDistance(),
+      tracer.GetDistance() + (32 * 32));
+  tracer.Trace(camera, *chunk, 32, 32);
+  assert(std::equal(firstDistance.begin(), firstDistance.end(),
+      tracer.GetDistance()));
+}
+
+} // namespace fd
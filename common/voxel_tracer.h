@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "fourmath.h"
+#include "worker_pool.h"
+
+namespace fd {
+
+class Camera;
+class QuaxolChunk;
+
+// Ray casts a QuaxolChunk on the cpu, no gl anywhere, so it's the reference
+// image for regressions and runs on boxes with no gpu. Each pixel's ray is
+// made in the camera's three space and taken back to four space through the
+// transpose of the basis the shaders use, so it stays in the camera's w
+// slice and hits are exact blocks rather than sliced triangles.
+// Rays go out as 2x2 packets, SSE for setup and the chunk bounds test where
+// there is SSE, then each lane steps through blocks the same way
+// Physics::LocalRayCastChunk does. Tiles go to the shared WorkerPool.
+class VoxelTracer {
+public:
+  static const int c_tileSize = 16; // pixels per side, even for the packets
+
+  VoxelTracer();
+  ~VoxelTracer();
+
+  // traces every pixel into the color and distance buffers, blocks until done
+  void Trace(const Camera& camera, const QuaxolChunk& chunk, int width, int height);
+
+  // rgb, top row first so it can go straight to a png
+  const unsigned char* GetColor() const { return _color.data(); }
+  // world distance to the hit along the ray, FLT_MAX where nothing was hit
+  const float* GetDistance() const { return _distance.data(); }
+  int GetWidth() const { return _width; }
+  int GetHeight() const { return _height; }
+
+  int _lastHits;
+  double _lastTraceMs;
+  double _lastMraysPerSecond;
+
+  static void RunTests();
+
+  ALIGNED_ALLOC_NEW_DEL_OVERRIDE
+
+protected:
+  struct Hit {
+    float _distance;
+    int _axis; // that was crossed into the block, -1 if the ray started in it
+    int _sign; // of the ray along _axis, the normal faces the other way
+    int _type;
+  };
+
+  void TraceTile(int tile);
+  // returns how many of its pixels hit
+  int TracePacket(int x, int y);
+  // chunk local start and dir, dir scaled so t is still world distance
+  bool StepRay(const float* start, const float* dir,
+      float tEnter, float tExit, int enterAxis, Hit& outHit) const;
+  void Shade(int x, int y, const Hit* pHit);
+
+  // Trace sets all of these before it starts the pool, tiles only read them
+  // same meaning as in ViewVolume
+  Mat4f _toThree;
+  Vec4f _position;
+  float _invProjectionX; // view space x per ndc x
+  float _invProjectionY;
+  float _maxDistance;
+  Vec4f _localPosition; // _position in chunk blocks
+  Vec4f _invBlockSize;
+  const QuaxolChunk* _pChunk; // only valid during Trace
+
+  int _width;
+  int _height;
+  int _tilesX;
+  int _numTiles;
+  std::vector<unsigned char> _color;
+  std::vector<float> _distance;
+
+  std::atomic<int> _hits;
+  WorkerPool* _pPool; // WorkerPool::GetShared, not owned
+};
+
+} // namespace fd
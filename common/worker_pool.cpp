@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <assert.h>
+#include "worker_pool.h"
+
+namespace fd {
+
+int WorkerPool::GetDefaultWorkerCount() {
+  return (std::max)(0, (int)std::thread::hardware_concurrency() - 1);
+}
+
+WorkerPool& WorkerPool::GetShared() {
+  static WorkerPool s_shared(GetDefaultWorkerCount());
+  return s_shared;
+}
+
+WorkerPool::WorkerPool(int numWorkers)
+    : _generation(0)
+    , _quit(false)
+    , _busy(0)
+    , _numJobs(0)
+    , _nextJob(0)
+{
+  for(int w = 0; w < numWorkers; ++w) {
+    _workers.push_back(std::thread(&WorkerPool::WorkerLoop, this));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _quit = true;
+  }
+  _startCondition.notify_all();
+  for(auto& worker : _workers) {
+    worker.join();
+  }
+}
+
+void WorkerPool::Start(int numJobs, const JobFunc& job) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    // a worker that woke late for the last batch may still be checking for jobs
+    _doneCondition.wait(lock, [&]() { return _busy == 0; });
+    _job = job;
+    _numJobs = numJobs;
+    _nextJob = 0;
+    ++_generation;
+  }
+  _startCondition.notify_all();
+}
+
+void WorkerPool::Finish() {
+  TakeJobs();
+  // every job is taken, so once nobody is busy they're all done
+  std::unique_lock<std::mutex> lock(_mutex);
+  _doneCondition.wait(lock, [&]() { return _busy == 0; });
+}
+
+void WorkerPool::WorkerLoop() {
+  int seenGeneration = 0;
+  while(true) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _startCondition.wait(lock, [&]() {
+        return _quit || _generation != seenGeneration;
+      });
+      if(_quit) return;
+      seenGeneration = _generation;
+      ++_busy;
+    }
+    TakeJobs();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      --_busy;
+    }
+    _doneCondition.notify_all();
+  }
+}
+
+void WorkerPool::TakeJobs() {
+  int job;
+  while((job = _nextJob++) < _numJobs) {
+    _job(job);
+  }
+}
+
+void WorkerPool::RunTests() {
+  std::vector<int> counts(1000, 0);
+  auto countJob = [&](int job) { ++counts[job]; };
+
+  WorkerPool pool(3);
+  for(int batch = 0; batch < 50; ++batch) {
+    pool.Run((int)counts.size(), countJob);
+  }
+  for(int count : counts) {
+    assert(count == 50);
+  }
+
+  // a batch smaller than the pool, then one with nothing in it
+  std::atomic<int> total(0);
+  pool.Run(1, [&](int job) { total += job + 1; });
+  pool.Run(0, [&](int job) { total += 100; });
+  assert(total == 1);
+
+  // the shared pool runs batches like any other
+  std::atomic<int> sharedTotal(0);
+  GetShared().Run(100, [&](int job) { sharedTotal += 1; });
+  assert(sharedTotal == 100);
+  assert(&GetShared() == &GetShared());
+
+  // no workers, Finish does it all on this thread
+  WorkerPool empty(0);
+  empty.Run(10, [&](int job) { total += 1; });
+  assert(total == 11);
+}
+
+} // namespace fd
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fd {
+
+// A few long lived threads that work through one batch of numbered jobs at
+// a time. Start publishes the batch under _mutex along with the generation
+// bump, and won't do that while a worker is still inside the last batch, so
+// a slow worker can never take a job of the next batch. Anything a job
+// reads that the owner wrote before Start is safe for the same reason.
+// Only the owning thread calls Start, Finish and Run.
+class WorkerPool {
+public:
+  typedef std::function<void(int job)> JobFunc;
+
+  // one less than the cores, the owning thread makes up the last one
+  static int GetDefaultWorkerCount();
+  // the one pool the tracer, occlusion buffer and texture loader all use,
+  // made on first use with the default count and owned by the main thread
+  static WorkerPool& GetShared();
+
+  explicit WorkerPool(int numWorkers);
+  ~WorkerPool();
+
+  // hands jobs 0 to numJobs - 1 to the workers and returns right away
+  void Start(int numJobs, const JobFunc& job);
+  // takes whatever jobs are left on this thread, then waits for the rest
+  void Finish();
+  void Run(int numJobs, const JobFunc& job) { Start(numJobs, job); Finish(); }
+
+  int GetNumWorkers() const { return (int)_workers.size(); }
+
+  static void RunTests();
+
+protected:
+  void WorkerLoop();
+  void TakeJobs();
+
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _startCondition;
+  std::condition_variable _doneCondition;
+  int _generation; // bumped per Start, under _mutex
+  bool _quit;
+  int _busy; // workers inside the current batch, under _mutex
+  // only written by Start, under _mutex while _busy is 0
+  JobFunc _job;
+  int _numJobs;
+  std::atomic<int> _nextJob;
+};
+
+} // namespace fd
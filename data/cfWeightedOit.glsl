@@ -0,0 +1,23 @@
+// cfWeightedOit
+#version 330
+
+// Weighted blended order independent transparency (McGuire & Bavoil 2013).
+// The accumulate pass blends with ONE, ONE for color and ZERO,
+// ONE_MINUS_SRC_ALPHA for alpha, see Render::RenderWeightedOit, so
+// attachment 0 sums weighted premultiplied color in rgb and multiplies
+// the revealage down in a, and attachment 1 sums the weights in r.
+
+// nearer and more opaque wins, gl_FragCoord.z so it works on any projection
+float getOitScale(float alpha) {
+  float depth = 1.0 - gl_FragCoord.z * 0.9;
+  float weight = pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(depth, 3.0);
+  return alpha * clamp(weight, 1e-2, 3e3);
+}
+
+vec4 getOitAccum(vec4 color) {
+  return vec4(color.rgb * getOitScale(color.a), color.a);
+}
+
+vec4 getOitWeight(vec4 color) {
+  return vec4(getOitScale(color.a), 0.0, 0.0, 0.0);
+}
@@ -3,21 +3,51 @@
 
 uniform mat4 worldMatrix;
 uniform vec4 worldPosition;
-uniform vec4 cameraPosition;
-uniform mat4 cameraMatrix;
-uniform mat4 fourToThree;
 
-// wNear in x, wFar in y, wFarToNearSizeRatio in z
-uniform vec4 wPlaneNearFar;
+// shared by every program, see Shader::CameraBlock
+layout(std140) uniform CameraBlock {
+  layout(row_major) mat4 cameraMatrix[2]; // per eye
+  mat4 projectionMatrix[2];
+  layout(row_major) mat4 fourToThree;
+  vec4 cameraPosition[2];
+  // wNear in x, wFar in y, wFarToNearSizeRatio in z
+  vec4 wPlaneNearFar;
+  // single pass stereo in x, every draw is instanced once per eye
+  vec4 stereo;
+};
+
+bool isStereo() {
+  return stereo.x > 0.5;
+}
+
+// odd instances are the right eye when drawing both at once
+int getEye() {
+  return isStereo() ? (gl_InstanceID & 1) : 0;
+}
+
+// per instance world transform, used instead of the uniforms when instanced
+uniform bool instanced;
+in vec4 instWorldPosition;
+in mat4 instWorldMatrix;
+
 //// any projection enabled in x, inv proj in y, ratio proj in z
 //uniform vec4 wProjectionFlags;
 
-vec4 getThreeSpace(in vec4 vertPosition) {
+vec4 getWorldSpace(in vec4 vertPosition) {
+  if(instanced) {
+    return (instWorldMatrix * vertPosition) + instWorldPosition;
+  }
   vec4 worldSpace = worldMatrix * vertPosition; // rotation/scale in 4d around origin
   worldSpace += worldPosition; // final 4d world space position
+  return worldSpace;
+}
 
-  vec4 cameraSpace = worldSpace - cameraPosition; // translate to be around camera origin but not transformed
-  cameraSpace = cameraMatrix * cameraSpace; // final camera space position
+vec4 getThreeSpace(in vec4 vertPosition) {
+  vec4 worldSpace = getWorldSpace(vertPosition);
+
+  int eye = getEye();
+  vec4 cameraSpace = worldSpace - cameraPosition[eye]; // translate to be around camera origin but not transformed
+  cameraSpace = cameraMatrix[eye] * cameraSpace; // final camera space position
 	
   vec4 threeSpace = fourToThree * cameraSpace;
   // 0=at far plane, 1=at near plane
@@ -31,11 +61,11 @@ vec4 getThreeSpace(in vec4 vertPosition) {
 // takes a model where 0 is in the middle of the w-planes
 // essentially remove the projection code so it renders appropriately
 vec4 getCenteredThreeSpace(in vec4 vertPosition) {
-  vec4 worldSpace = worldMatrix * vertPosition; // rotation/scale in 4d around origin
-  worldSpace += worldPosition; // final 4d world space position
+  vec4 worldSpace = getWorldSpace(vertPosition);
 
-  vec4 cameraSpace = worldSpace - cameraPosition; // translate to be around camera origin but not transformed
-  cameraSpace = cameraMatrix * cameraSpace; // final camera space position
+  int eye = getEye();
+  vec4 cameraSpace = worldSpace - cameraPosition[eye]; // translate to be around camera origin but not transformed
+  cameraSpace = cameraMatrix[eye] * cameraSpace; // final camera space position
 	
   vec4 threeSpace = fourToThree * cameraSpace;
   // 0=at far plane, 1=at near plane
@@ -46,8 +76,29 @@ vec4 getCenteredThreeSpace(in vec4 vertPosition) {
   return threeSpace;
 }
 
+// three space to homogenous clip space
+vec4 getClipSpace(in vec4 threeSpace) {
+  int eye = getEye();
+  vec4 clipSpace = projectionMatrix[eye] * threeSpace;
+  gl_ClipDistance[0] = 1.0;
+  if(isStereo()) {
+    // squash into this eye's half of the double wide target and clip
+    // anything that would bleed into the other half
+    float side = (eye == 0) ? -1.0 : 1.0;
+    clipSpace.x = (clipSpace.x * 0.5) + (side * 0.5 * clipSpace.w);
+    gl_ClipDistance[0] = side * clipSpace.x;
+  }
+  return clipSpace;
+}
+
 float smoothClip(float hardMin, float softMin, float softMax, float hardMax, float val) {
 	float smoothNear = smoothstep(hardMin, softMin, val);
 	float smoothFar = smoothstep(-hardMax, -softMax, -val);
 	return smoothNear * smoothFar;
 }
+
+// the block type out of a QuaxolVert passed through as is, see
+// QuaxolBuffer::Vert, it's the texBlocks layer
+int getBlockLayer(int packed) {
+	return (packed >> 20) & 63;
+}
@@ -0,0 +1,26 @@
+// fragOverdrawRainbowOit
+#version 330
+
+in vec4 fragHPos;
+in vec4 fragCol0;
+in float fragVertDepth;
+in vec2 fragTex0;
+
+layout(location = 0) out vec4 oitAccum;
+layout(location = 1) out vec4 oitWeight;
+
+////////////////////
+// includes from cfWeightedOit.glsl
+vec4 getOitAccum(vec4 color);
+vec4 getOitWeight(vec4 color);
+///////////////////
+
+// fragOverdrawRainbow into the weighted oit targets
+void main() {
+  vec4 color = vec4(fragCol0.rgb, fragCol0.a * 0.2);
+  if (color.a <= 0.0) {
+    discard;
+  }
+  oitAccum = getOitAccum(color);
+  oitWeight = getOitWeight(color);
+}
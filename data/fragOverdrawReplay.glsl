@@ -0,0 +1,12 @@
+// fragOverdrawReplay
+#version 330
+
+in vec4 fragCol0;
+
+out vec4 finalColor;
+
+// what fragOverdrawRainbow writes
+void main() {
+  finalColor.rgb = fragCol0.rgb;
+  finalColor.a = fragCol0.a * 0.2;
+}
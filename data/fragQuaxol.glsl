@@ -0,0 +1,17 @@
+// fragQuaxol
+#version 330
+
+uniform sampler2DArray texBlocks;
+
+in vec4 fragHPos;
+in vec4 fragCol0;
+in float fragTexBlend;
+in vec2 fragTex0;
+flat in int fragBlockLayer;
+
+out vec4 finalColor;
+
+void main() {
+  finalColor.rgb = mix(fragCol0.rgb, texture(texBlocks, vec3(fragTex0, fragBlockLayer)).rgb, fragTexBlend);
+  finalColor.a = fragCol0.a;
+}
\ No newline at end of file
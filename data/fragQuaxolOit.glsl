@@ -0,0 +1,31 @@
+// fragQuaxolOit
+#version 330
+
+uniform sampler2DArray texBlocks;
+
+in vec4 fragHPos;
+in vec4 fragCol0;
+in float fragTexBlend;
+in vec2 fragTex0;
+flat in int fragBlockLayer;
+
+layout(location = 0) out vec4 oitAccum;
+layout(location = 1) out vec4 oitWeight;
+
+////////////////////
+// includes from cfWeightedOit.glsl
+vec4 getOitAccum(vec4 color);
+vec4 getOitWeight(vec4 color);
+///////////////////
+
+// fragQuaxol into the weighted oit targets
+void main() {
+  vec4 color;
+  color.rgb = mix(fragCol0.rgb, texture(texBlocks, vec3(fragTex0, fragBlockLayer)).rgb, fragTexBlend);
+  color.a = fragCol0.a;
+  if (color.a <= 0.0) {
+    discard;
+  }
+  oitAccum = getOitAccum(color);
+  oitWeight = getOitWeight(color);
+}
@@ -1,16 +1,17 @@
 // fragSliced
 #version 330
 
-uniform sampler2D texDiffuse0;
+uniform sampler2DArray texBlocks;
 
 in vec4 fragHPos;
 //in vec4 fragCol0;
 in float fragTexBlend;
 in vec2 fragTex0;
+flat in int fragBlockLayer;
 
 out vec4 finalColor;
 
 void main() {
-  finalColor.rgb = texture2D(texDiffuse0, fragTex0).rgb;
+  finalColor.rgb = texture(texBlocks, vec3(fragTex0, fragBlockLayer)).rgb;
   finalColor.a = fragTexBlend;
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+// geomSlicedLayers
+#version 330
+
+// Every triangle goes to each layer of the target array with that layer's
+// slice range, so a whole stack of w slices comes out of one draw.
+// The 8 is Render::c_maxSliceLayers.
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 24) out;
+
+uniform vec4 sliceRanges[8]; // near and far in xy, same units as sliceRange
+uniform int sliceLayers;
+
+in vec2 geomTex0[];
+flat in int geomBlockLayer[];
+in float geomSavedW[];
+
+out vec4 fragHPos;
+out float fragTexBlend;
+out vec2 fragTex0;
+flat out int fragBlockLayer;
+
+void main() {
+  for (int layer = 0; layer < sliceLayers; layer++) {
+    vec4 range = sliceRanges[layer];
+    float blend[3];
+    bool anySolid = false;
+    for (int v = 0; v < 3; v++) {
+      blend[v] = (geomSavedW[v] >= range.x && geomSavedW[v] <= range.y) ? 1.0 : 0.0;
+      anySolid = anySolid || (blend[v] > 0.0);
+    }
+    // none of it would get past the alpha test in this layer
+    if (!anySolid) {
+      continue;
+    }
+
+    for (int v = 0; v < 3; v++) {
+      gl_Layer = layer;
+      gl_Position = gl_in[v].gl_Position;
+      fragHPos = gl_in[v].gl_Position;
+      fragTexBlend = blend[v];
+      fragTex0 = geomTex0[v];
+      fragBlockLayer = geomBlockLayer[v];
+      EmitVertex();
+    }
+    EndPrimitive();
+  }
+}
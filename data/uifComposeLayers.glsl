@@ -0,0 +1,35 @@
+// uifComposeLayers
+#version 330
+
+uniform sampler2DArray texLayers;
+uniform int sliceLayers;
+uniform bool layerBlend; // stacked over each other, otherwise tiled
+
+in vec2 fragTex0;
+
+out vec4 finalColor;
+
+void main() {
+  if (layerBlend) {
+    // far slices first so the nearer ones end up on top, each see through
+    vec3 color = vec3(0.0);
+    for (int layer = sliceLayers - 1; layer >= 0; layer--) {
+      vec4 slice = texture(texLayers, vec3(fragTex0, layer));
+      color = mix(color, slice.rgb, slice.a * 0.6);
+    }
+    finalColor = vec4(color, 1.0);
+    return;
+  }
+
+  // square grid so each tile keeps the screen's aspect, nearest slice top left
+  int tilesPerSide = int(ceil(sqrt(float(sliceLayers))));
+  vec2 tileCoord = fragTex0 * float(tilesPerSide);
+  int column = min(int(tileCoord.x), tilesPerSide - 1);
+  int row = (tilesPerSide - 1) - min(int(tileCoord.y), tilesPerSide - 1);
+  int layer = (row * tilesPerSide) + column;
+  if (layer >= sliceLayers) {
+    finalColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+  finalColor = texture(texLayers, vec3(fract(tileCoord), layer));
+}
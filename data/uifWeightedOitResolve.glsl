@@ -0,0 +1,23 @@
+// uifWeightedOitResolve
+#version 330
+
+uniform sampler2D texOitAccum;
+uniform sampler2D texOitWeight;
+
+in vec2 fragTex0;
+
+out vec4 finalColor;
+
+// weighted average color, covering as much as the revealage says it should
+void main() {
+  // by pixel so it lines up whatever the viewport is
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  vec4 accum = texelFetch(texOitAccum, texel, 0);
+  float revealage = accum.a;
+  if (revealage >= 1.0) {
+    discard; // nothing transparent here
+  }
+  float weight = texelFetch(texOitWeight, texel, 0).r;
+  finalColor.rgb = accum.rgb / max(weight, 1e-5);
+  finalColor.a = 1.0 - revealage;
+}
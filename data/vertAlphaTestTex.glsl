@@ -1,8 +1,6 @@
 // vertAlphaTestTex
 #version 330
 
-uniform mat4 projectionMatrix;
-
 in vec4 vertPosition;
 in vec2 vertCoord;
 in vec4 vertColor;
@@ -12,6 +10,7 @@ out vec4 fragCol0;
 out vec2 fragTex0;
 
 vec4 getThreeSpace(vec4);
+vec4 getClipSpace(vec4);
 
 void main() {
  	vec4 threeSpace = getThreeSpace(vertPosition); 
@@ -28,7 +27,7 @@ void main() {
 	threeSpace.w = 1.0;
 	//threeSpace = cameraSpace;
 	
-	vec4 homogenousCoords = projectionMatrix * threeSpace; // homogenous clip space position
+	vec4 homogenousCoords = getClipSpace(threeSpace); // homogenous clip space position
 	//homogenousCoords.z = homogenousCoords.z * wSpaceFrustrumPos;
 	//homogenousCoords.w = abs(homogenousCoords.w + savedW);
 	//homogenousCoords.z = abs(homogenousCoords.z);
@@ -1,8 +1,6 @@
 // vertBlendNoTex
 #version 330
 
-uniform mat4 projectionMatrix;
-
 in vec4 vertPosition;
 in vec4 vertColor;
 
@@ -10,6 +8,7 @@ out vec4 fragHPos;
 out vec4 fragCol0;
 
 vec4 getThreeSpace(vec4);
+vec4 getClipSpace(vec4);
 
 void main() {
 	vec4 threeSpace = getThreeSpace(vertPosition); 
@@ -17,7 +16,7 @@ void main() {
 	threeSpace.w = 1.0;
 	//threeSpace = cameraSpace;
 	
-	vec4 homogenousCoords = projectionMatrix * threeSpace; // homogenous clip space position
+	vec4 homogenousCoords = getClipSpace(threeSpace); // homogenous clip space position
 	//homogenousCoords.w = abs(homogenousCoords.w + savedW);
 	//homogenousCoords.z = abs(homogenousCoords.z);
 	fragHPos = homogenousCoords;
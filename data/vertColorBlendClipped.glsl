@@ -1,8 +1,6 @@
 //vertColorBlendClipped
 #version 330
 
-uniform mat4 projectionMatrix;
-
 in vec4 vertPosition;
 in vec4 vertColor;
 
@@ -12,6 +10,7 @@ out vec4 fragCol0;
 ////////////////////
 // includes from cvCommonTransform.glsl
 vec4 getThreeSpace(vec4); 
+vec4 getClipSpace(vec4);
 float smoothClip(float hardMin, float softMin, float softMax, float hardMax, float val);
 ///////////////////
 
@@ -21,7 +20,7 @@ void main() {
 	threeSpace.w = 1.0;
 	//threeSpace = cameraSpace;
 	
-	vec4 homogenousCoords = projectionMatrix * threeSpace; // homogenous clip space position
+	vec4 homogenousCoords = getClipSpace(threeSpace); // homogenous clip space position
 	//homogenousCoords.w = abs(homogenousCoords.w + savedW);
 	//homogenousCoords.z = abs(homogenousCoords.z);
 	fragHPos = homogenousCoords;
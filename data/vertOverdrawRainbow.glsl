@@ -1,7 +1,6 @@
 // vertOverdrawRainbow
 #version 330
 
-uniform mat4 projectionMatrix;
 uniform vec4 sliceRange;
 
 in vec4 vertPosition;
@@ -14,6 +13,7 @@ out float fragVertDepth;
 out vec2 fragTex0;
 
 vec4 getThreeSpace(vec4);
+vec4 getClipSpace(vec4);
 
 void main() {
   vec4 threeSpace = getThreeSpace(vertPosition); 
@@ -28,7 +28,7 @@ void main() {
   rainbow.g = mod(abs(vertPosition.z / 10.0), 2.0) + 0.5;
   rainbow.b = mod(abs(vertPosition.w / 10.0), 2.0) + 0.5;
   
-  vec4 homogenousCoords = projectionMatrix * threeSpace;
+  vec4 homogenousCoords = getClipSpace(threeSpace);
 
   //float zBufShift = 0.1;
   //homogenousCoords.z -= abs(zBufShift * savedW);
@@ -0,0 +1,15 @@
+// vertOverdrawReplay
+#version 330
+
+// a vertSlicedOverdraw vert as it was captured, already in clip space
+in vec4 vertPosition;
+in vec4 vertColor;
+in float vertClip;
+
+out vec4 fragCol0;
+
+void main() {
+  gl_Position = vertPosition;
+  gl_ClipDistance[0] = vertClip;
+  fragCol0 = vertColor;
+}
@@ -0,0 +1,58 @@
+// vertQuaxol
+#version 330
+
+in vec4 vertPosition;
+in vec2 vertCoord;
+in vec4 vertColor;
+in int vertPacked;
+
+out vec4 fragHPos;
+out vec4 fragCol0;
+out float fragTexBlend;
+out vec2 fragTex0;
+flat out int fragBlockLayer;
+
+////////////////////
+// includes from cvCommonTransform.glsl
+vec4 getThreeSpace(vec4); 
+vec4 getClipSpace(vec4);
+float smoothClip(float hardMin, float softMin, float softMax, float hardMax, float val);
+int getBlockLayer(int packed);
+///////////////////
+
+// vertRainbow for chunk geometry, the block texture comes from the packed
+// vert instead of an atlas uv
+void main() {
+	vec4 threeSpace = getThreeSpace(vertPosition); 
+
+	fragTex0.xy = vertCoord.xy;
+	fragBlockLayer = getBlockLayer(vertPacked);
+
+	float savedW = 1.0 - threeSpace.w;
+	threeSpace.w = 1.0;
+
+	vec3 rainbow;
+	rainbow.r = mod(abs(vertPosition.x / 10.0), 2.0);
+	rainbow.g = mod(abs(vertPosition.z / 10.0), 2.0);
+	rainbow.b = mod(abs(vertPosition.w / 10.0), 2.0);
+  
+	vec4 homogenousCoords = getClipSpace(threeSpace);
+
+	float zBufShift = 0.1;
+	homogenousCoords.z -= abs(zBufShift * savedW);
+	fragHPos = homogenousCoords;
+	gl_Position = fragHPos;
+  
+	fragCol0.rgb = rainbow;
+
+	float smoo = 0.1;
+	float near = 0.0;
+	float solidnear = 0.33; 
+	float rainbowfar = 1.0;
+	float rainbowsmoo = 0.1;
+	fragTexBlend = smoothClip(-smoo, near, solidnear - smoo, solidnear + smoo, savedW);
+	fragCol0.a = smoothClip(-smoo, near, solidnear - smoo, solidnear + smoo, savedW);
+			   + 0.2 * smoothClip(solidnear - smoo, solidnear + smoo, 
+								  rainbowfar, rainbowfar + rainbowsmoo,
+								  savedW);
+}
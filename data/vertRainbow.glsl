@@ -1,8 +1,6 @@
 // vertRainbow
 #version 330
 
-uniform mat4 projectionMatrix;
-
 in vec4 vertPosition;
 in vec2 vertCoord;
 in vec4 vertColor;
@@ -15,6 +13,7 @@ out vec2 fragTex0;
 ////////////////////
 // includes from cvCommonTransform.glsl
 vec4 getThreeSpace(vec4); 
+vec4 getClipSpace(vec4);
 float smoothClip(float hardMin, float softMin, float softMax, float hardMax, float val);
 ///////////////////
 
@@ -31,7 +30,7 @@ void main() {
 	rainbow.g = mod(abs(vertPosition.z / 10.0), 2.0);
 	rainbow.b = mod(abs(vertPosition.w / 10.0), 2.0);
   
-	vec4 homogenousCoords = projectionMatrix * threeSpace;
+	vec4 homogenousCoords = getClipSpace(threeSpace);
 
 	float zBufShift = 0.1;
 	homogenousCoords.z -= abs(zBufShift * savedW);
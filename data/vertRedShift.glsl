@@ -1,8 +1,6 @@
 //vertRedShift
 #version 330
 
-uniform mat4 projectionMatrix;
-
 in vec4 vertPosition;
 in vec2 vertCoord;
 in vec4 vertColor;
@@ -12,6 +10,7 @@ out vec4 fragCol0;
 out vec2 fragTex0;
 
 vec4 getThreeSpace(vec4);
+vec4 getClipSpace(vec4);
 
 void main() {
   vec4 threeSpace = getThreeSpace(vertPosition); 
@@ -21,7 +20,7 @@ void main() {
   float savedW = 1.0 - threeSpace.w;
   threeSpace.w = 1;
   
-  vec4 homogenousCoords = projectionMatrix * threeSpace;
+  vec4 homogenousCoords = getClipSpace(threeSpace);
 
   float zBufShift = 0.1;
   homogenousCoords.z += abs(zBufShift * savedW);
@@ -1,9 +1,8 @@
 //vertColorBlendClipped
 #version 330
 
-uniform mat4 projectionMatrix;
-uniform mat4 boneRotations[20];
-uniform vec4 bonePositions[20];
+// 5 texels a bone, the rotation columns then the position, see MeshBuffer
+uniform samplerBuffer texBones;
 
 in vec4 vertPosition;
 in vec4 vertColor;
@@ -15,12 +14,18 @@ out vec4 fragCol0;
 ////////////////////
 // includes from cvCommonTransform.glsl
 vec4 getThreeSpace(vec4); 
+vec4 getClipSpace(vec4);
 float smoothClip(float hardMin, float softMin, float softMax, float hardMax, float val);
 ///////////////////
 
 vec4 getObjectSpace(in vec4 vertPosition, in int vertBoneIndex) {
-  vec4 objectSpace = boneRotations[vertBoneIndex] * vertPosition; // rotation/scale in 4d around origin
-  objectSpace += bonePositions[vertBoneIndex]; // final 4d world space position
+  int texel = vertBoneIndex * 5;
+  mat4 boneRotation = mat4(texelFetch(texBones, texel + 0),
+      texelFetch(texBones, texel + 1),
+      texelFetch(texBones, texel + 2),
+      texelFetch(texBones, texel + 3));
+  vec4 objectSpace = boneRotation * vertPosition; // rotation/scale in 4d around origin
+  objectSpace += texelFetch(texBones, texel + 4); // final 4d world space position
   return objectSpace;
 }
 
@@ -30,7 +35,7 @@ void main() {
 	float savedW = threeSpace.w;
 	threeSpace.w = 1.0;
 	
-	vec4 homogenousCoords = projectionMatrix * threeSpace; // homogenous clip space position
+	vec4 homogenousCoords = getClipSpace(threeSpace); // homogenous clip space position
 	fragHPos = homogenousCoords;
 
 	fragCol0.a = 0.2 * smoothClip(0.0, 0.1, 0.9, 1.0, savedW);
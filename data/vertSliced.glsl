@@ -1,30 +1,34 @@
 // vertSliced
 #version 330
 
-uniform mat4 projectionMatrix;
 uniform vec4 sliceRange;
 
 in vec4 vertPosition;
 in vec2 vertCoord;
 in vec4 vertColor;
+in int vertPacked;
 
 out vec4 fragHPos;
 out float fragTexBlend;
 out vec2 fragTex0;
+flat out int fragBlockLayer;
 
 vec4 getThreeSpace(vec4);
 vec4 getCenteredThreeSpace(vec4);
+vec4 getClipSpace(vec4);
+int getBlockLayer(int packed);
 
 void main() {
   //vec4 threeSpace = getThreeSpace(vertPosition); 
   vec4 threeSpace = getCenteredThreeSpace(vertPosition); 
 
   fragTex0.xy = vertCoord.xy;
+  fragBlockLayer = getBlockLayer(vertPacked);
 
   float savedW = 1.0 - threeSpace.w;
   threeSpace.w = 1.0;
   
-  vec4 homogenousCoords = projectionMatrix * threeSpace;
+  vec4 homogenousCoords = getClipSpace(threeSpace);
 
   //float zBufShift = 0.1;
   //homogenousCoords.z -= abs(zBufShift * savedW);
@@ -0,0 +1,28 @@
+// vertSlicedLayers
+#version 330
+
+in vec4 vertPosition;
+in vec2 vertCoord;
+in vec4 vertColor;
+in int vertPacked;
+
+out vec2 geomTex0;
+flat out int geomBlockLayer;
+out float geomSavedW;
+
+vec4 getCenteredThreeSpace(vec4);
+vec4 getClipSpace(vec4);
+int getBlockLayer(int packed);
+
+// vertSliced without the range test, geomSlicedLayers does that per layer
+void main() {
+  vec4 threeSpace = getCenteredThreeSpace(vertPosition);
+
+  geomTex0.xy = vertCoord.xy;
+  geomBlockLayer = getBlockLayer(vertPacked);
+
+  geomSavedW = 1.0 - threeSpace.w;
+  threeSpace.w = 1.0;
+
+  gl_Position = getClipSpace(threeSpace);
+}
@@ -0,0 +1,72 @@
+// vertSlicedOverdraw
+#version 330
+
+uniform vec4 sliceRange;
+
+in vec4 vertPosition;
+in vec2 vertCoord;
+in vec4 vertColor;
+in int vertPacked;
+
+out vec4 fragHPos;
+out float fragTexBlend;
+out vec2 fragTex0;
+flat out int fragBlockLayer;
+
+// only captured by transform feedback, OverdrawReplay draws these later
+out vec4 overdrawPosition;
+out vec4 overdrawColor;
+out float overdrawClip;
+
+vec4 getThreeSpace(vec4);
+vec4 getCenteredThreeSpace(vec4);
+vec4 getClipSpace(vec4);
+int getBlockLayer(int packed);
+
+// Sliced with OverdrawRainbow's vertex work along for the ride. The solid
+// slice is rasterized from the centered transform exactly like Sliced, the
+// overdraw keeps the projected one and goes out through the capture.
+void main() {
+  // overdraw first, as getClipSpace sets gl_ClipDistance and the solid's
+  // has to be the one left at the end
+  vec4 projected = getThreeSpace(vertPosition);
+  float projectedW = 1.0 - projected.w;
+  projected.w = 1.0;
+  overdrawPosition = getClipSpace(projected);
+  overdrawClip = gl_ClipDistance[0];
+
+  overdrawColor.r = mod(abs(vertPosition.x / 10.0), 2.0) + 0.5;
+  overdrawColor.g = mod(abs(vertPosition.z / 10.0), 2.0) + 0.5;
+  overdrawColor.b = mod(abs(vertPosition.w / 10.0), 2.0) + 0.5;
+
+  if (projectedW < 0.0) { // clip near
+    overdrawColor.a = 0.0;
+  } else if (projectedW <= sliceRange.x) {
+    overdrawColor.a = 1.0;
+  } else if (projectedW <= sliceRange.y) {
+    overdrawColor.a = 0.0;
+  } else if (projectedW <= 1.0) { // rainbow
+    overdrawColor.a = 1.0;
+  } else { // clip far
+    overdrawColor.a = 0.0;
+  }
+
+  vec4 threeSpace = getCenteredThreeSpace(vertPosition);
+
+  fragTex0.xy = vertCoord.xy;
+  fragBlockLayer = getBlockLayer(vertPacked);
+
+  float savedW = 1.0 - threeSpace.w;
+  threeSpace.w = 1.0;
+
+  fragHPos = getClipSpace(threeSpace);
+  gl_Position = fragHPos;
+
+  if (savedW < sliceRange.x) { // clip near
+    fragTexBlend = 0.0;
+  } else if (savedW <= sliceRange.y) { // solid slice
+    fragTexBlend = 1.0;
+  } else { // clip far
+    fragTexBlend = 0.0;
+  }
+}
@@ -7,11 +7,9 @@ uniform vec4 worldPosition;
 
 uniform mat4 worldMatrix;
 //uniform vec4 worldPosition;
-uniform vec4 cameraPosition;
-uniform mat4 cameraMatrix;
-uniform mat4 projectionMatrix;
-uniform mat4 fourToThree;
-uniform vec4 wPlaneNearFar;
+// camera is in the CameraBlock from cvCommonTransform
+
+vec4 getThreeSpace(vec4);
 
 in vec4 vertPosition;
 in vec4 vertColor;
@@ -20,8 +18,7 @@ out vec2 fragTex0;
 
 void main()
 {	
-  blarg = cameraPosition * worldMatrix * cameraMatrix * projectionMatrix * fourToThree;
-	blarg += wPlaneNearFar;
+  blarg = getThreeSpace(vertPosition);
 
   //fragTex0.xy = gl_MultiTexCoord0.xy;
   normal = gl_Normal;
@@ -1,7 +1,6 @@
 //vertVolumeColor
 #version 330
 
-uniform mat4 projectionMatrix;
 in vec4 vertPosition;
 in vec4 vertColor;
 out vec4 fragHPos;
@@ -10,6 +9,7 @@ out vec4 fragCol0;
 ////////////////////
 // includes from cvCommonTransform.glsl
 vec4 getThreeSpace(vec4); 
+vec4 getClipSpace(vec4);
 float smoothClip(float hardMin, float softMin, float softMax, float hardMax, float val);
 ///////////////////
 
@@ -18,7 +18,7 @@ void main() {
 	float savedW = threeSpace.w;
 	threeSpace.w = 1.0;
 	
-	vec4 homogenousCoords = projectionMatrix * threeSpace;
+	vec4 homogenousCoords = getClipSpace(threeSpace);
 	fragHPos = homogenousCoords;
 
 	fragCol0.a = 0.8 * smoothClip(0.0, 0.1, 0.9, 1.0, savedW);